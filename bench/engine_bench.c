@@ -0,0 +1,198 @@
+// Execution engine benchmark.
+//
+// Usage: engine_bench [rounds] [file.lox ...]
+//
+// Runs every script (bench/corpus/*.lox by default) on the tree walker
+// without and with its JIT, the closure compiler and the bytecode VM, and
+// reports the best of `rounds`
+// runs (3 by default) for each in milliseconds. Scripts are parsed and
+// optimized again for every run, outside of the timing, since running them
+// rewrites the tree; the time covers resolving or compiling plus running.
+// What the scripts print is discarded.
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scanner.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "interpreter.h"
+#include "closure.h"
+#include "vm.h"
+
+typedef enum
+{
+    ENGINE_TREE,
+    ENGINE_TREE_JIT,
+    ENGINE_CLOSURE,
+    ENGINE_VM,
+    NUMBER_ENGINES,
+} Engine;
+
+static const char *engine_columns[NUMBER_ENGINES] = {"tree ms", "tree+jit ms", "closure ms", "vm ms"};
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *read_source(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *length = (size_t)ftell(file);
+    rewind(file);
+    char *source = malloc(*length + 1);
+    *length = fread(source, 1, *length, file);
+    fclose(file);
+    return source;
+}
+
+// Seconds taken by one run, or a negative number when the script failed
+static double run_once(const char *source, size_t length, Engine engine)
+{
+    Scanner *scanner = scanTokenParallel(source, length, 1, 1);
+    Parser *parser = init_parser(scanner->source, scanner->tokens);
+    int error_code = 0;
+    size_t len_statements = 0;
+    Statement **statements = parse(parser, &len_statements, &error_code);
+    if (error_code == 0)
+    {
+        optimize(statements, &len_statements, parser->arena, NULL);
+    }
+
+    double start = now_seconds();
+    if (error_code == 0)
+    {
+        switch (engine)
+        {
+        case ENGINE_TREE:
+        case ENGINE_TREE_JIT:
+            resolve(statements, len_statements);
+            interpret(statements, len_statements, engine == ENGINE_TREE_JIT, &error_code);
+            break;
+        case ENGINE_CLOSURE:
+            resolve(statements, len_statements);
+            interpret_closure(statements, len_statements, &error_code);
+            break;
+        case ENGINE_VM:
+            interpret_vm(statements, len_statements, 0, &error_code);
+            break;
+        default:
+            break;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    free_parser(parser);
+    free_scanner(scanner);
+    return error_code == 0 ? elapsed : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    setbuf(stdout, NULL);
+    int rounds = argc > 1 ? atoi(argv[1]) : 3;
+    if (rounds < 1)
+    {
+        rounds = 1;
+    }
+
+    glob_t corpus = {0};
+    char **paths = argv + 2;
+    size_t len_paths = argc > 2 ? (size_t)(argc - 2) : 0;
+    if (len_paths == 0)
+    {
+        glob("bench/corpus/*.lox", 0, NULL, &corpus);
+        paths = corpus.gl_pathv;
+        len_paths = corpus.gl_pathc;
+    }
+    if (len_paths == 0)
+    {
+        fprintf(stderr, "No scripts found, run from the repository root or pass files\n");
+        return 1;
+    }
+
+    // Scripts print to the real stdout, which is pointed at /dev/null while
+    // they run
+    int out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+
+    printf("%-32s", "script");
+    for (int engine = 0; engine < NUMBER_ENGINES; engine++)
+    {
+        printf(" %12s", engine_columns[engine]);
+    }
+    printf("\n");
+    double totals[NUMBER_ENGINES] = {0};
+    for (size_t i = 0; i < len_paths; i++)
+    {
+        size_t length = 0;
+        char *source = read_source(paths[i], &length);
+        if (source == NULL)
+        {
+            fprintf(stderr, "Cannot read %s\n", paths[i]);
+            continue;
+        }
+        double best[NUMBER_ENGINES];
+        for (int engine = 0; engine < NUMBER_ENGINES; engine++)
+        {
+            best[engine] = -1;
+            for (int round = 0; round < rounds; round++)
+            {
+                dup2(null, STDOUT_FILENO);
+                double elapsed = run_once(source, length, (Engine)engine);
+                dup2(out, STDOUT_FILENO);
+                if (elapsed < 0)
+                {
+                    best[engine] = -1;
+                    break;
+                }
+                if (best[engine] < 0 || elapsed < best[engine])
+                {
+                    best[engine] = elapsed;
+                }
+            }
+            totals[engine] += best[engine] > 0 ? best[engine] : 0;
+        }
+        const char *name = strrchr(paths[i], '/') != NULL ? strrchr(paths[i], '/') + 1 : paths[i];
+        printf("%-32s", name);
+        for (int engine = 0; engine < NUMBER_ENGINES; engine++)
+        {
+            if (best[engine] < 0)
+            {
+                printf(" %12s", "error");
+            }
+            else
+            {
+                printf(" %12.1f", best[engine] * 1e3);
+            }
+        }
+        printf("\n");
+        free(source);
+    }
+    printf("%-32s", "total");
+    for (int engine = 0; engine < NUMBER_ENGINES; engine++)
+    {
+        printf(" %12.1f", totals[engine] * 1e3);
+    }
+    printf("\n");
+
+    close(null);
+    close(out);
+    globfree(&corpus);
+    free_objects();
+    return 0;
+}
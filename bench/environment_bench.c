@@ -0,0 +1,86 @@
+// Global environment benchmark.
+//
+// Usage: environment_bench [max_globals]
+//
+// For 1 000, 10 000, ... up to max_globals (1 000 000 by default) distinct
+// names, defines them all in a fresh global environment, then looks each of
+// them up in a shuffled order, and reports the average cost of a define and
+// of a lookup in nanoseconds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "environment.h"
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    setbuf(stdout, NULL);
+    size_t max_globals = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+
+    ObjString **names = malloc(max_globals * sizeof(ObjString *));
+    size_t *order = malloc(max_globals * sizeof(size_t));
+    char buffer[32];
+    for (size_t i = 0; i < max_globals; i++)
+    {
+        int length = snprintf(buffer, sizeof(buffer), "global_%zu", i);
+        names[i] = copy_string(buffer, (size_t)length);
+    }
+
+    printf("%10s %12s %12s\n", "globals", "define ns", "lookup ns");
+    for (size_t count = 1000; count <= max_globals; count *= 10)
+    {
+        // Shuffled so lookups do not simply walk the table in insertion order
+        for (size_t i = 0; i < count; i++)
+        {
+            order[i] = i;
+        }
+        unsigned seed = 12345;
+        for (size_t i = count - 1; i > 0; i--)
+        {
+            seed = seed * 1103515245u + 12345u;
+            size_t j = seed % (i + 1);
+            size_t tmp = order[i];
+            order[i] = order[j];
+            order[j] = tmp;
+        }
+
+        Environment *globals = init_environment(NULL, 0);
+        double start = now_seconds();
+        for (size_t i = 0; i < count; i++)
+        {
+            define_environment(globals, names[i], NUMBER_VAL((double)i));
+        }
+        double define_time = now_seconds() - start;
+
+        // Enough rounds that small tables are not timed on a handful of calls
+        size_t rounds = 10000000 / count + 1;
+        int error_code = 0;
+        double sum = 0;
+        start = now_seconds();
+        for (size_t round = 0; round < rounds; round++)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                sum += AS_NUMBER(get_environment(globals, names[order[i]], &error_code));
+            }
+        }
+        double lookup_time = now_seconds() - start;
+        free_environment(globals);
+
+        printf("%10zu %12.1f %12.1f%s\n", count, define_time * 1e9 / count,
+               lookup_time * 1e9 / ((double)count * rounds), sum < 0 ? " (checksum)" : "");
+    }
+
+    free(order);
+    free(names);
+    free_objects();
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Scanner throughput benchmark.
+//
+// Usage: scanner_bench [--jobs=N] [megabytes] [rounds] [file.lox]
+//
+// Generates a Lox program of roughly the requested size (8 MB by default)
+// mixing declarations, expressions, control flow, string literals, comments
+// and indentation, then scans it `rounds` times and reports the best
+// throughput in MB/s. When a file is given it is scanned instead. With
+// --jobs the parallel scanner is used (0 = one thread per CPU). Like
+// `./clox tokenize`, symbols are not interned.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scanner.h"
+
+typedef struct
+{
+    char *chars;
+    size_t length;
+    size_t size;
+} Buffer;
+
+static void append(Buffer *buffer, const char *text)
+{
+    size_t length = strlen(text);
+    if (buffer->length + length > buffer->size)
+    {
+        buffer->size = (buffer->length + length) * 2;
+        buffer->chars = realloc(buffer->chars, buffer->size);
+    }
+    memcpy(buffer->chars + buffer->length, text, length);
+    buffer->length += length;
+}
+
+static void generate(Buffer *buffer, size_t target)
+{
+    static const char *snippets[] = {
+        "var counter_%u = %u;\n",
+        "    // keep the running total of element %u in range\n",
+        "print \"iteration %u of the benchmark loop\";\n",
+        "if (counter_%u >= 1000.5) { counter_%u = counter_%u - 1000; } else { print nil; }\n",
+        "        while (index_%u < %u) { index_%u = index_%u + 1; }\n",
+        "for (var i = 0; i < %u; i = i + 1) {\n    total = total * 2 + i / 3;\n}\n",
+        "var message_%u = \"a somewhat longer string literal that spans\nmultiple lines %u\";\n",
+        "\n\n        \t// indented comment %u with some trailing text to skip over\n",
+    };
+    size_t count = sizeof(snippets) / sizeof(snippets[0]);
+    char line[256];
+    unsigned seed = 12345;
+    while (buffer->length < target)
+    {
+        seed = seed * 1103515245u + 12345u;
+        unsigned n = (seed >> 16) & 0x7fff;
+        snprintf(line, sizeof(line), snippets[n % count], n, n, n, n);
+        append(buffer, line);
+    }
+}
+
+static char *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *length = (size_t)ftell(file);
+    rewind(file);
+    char *chars = malloc(*length + 1);
+    if (fread(chars, 1, *length, file) != *length)
+    {
+        fprintf(stderr, "Error reading %s\n", path);
+        exit(1);
+    }
+    chars[*length] = '\0';
+    fclose(file);
+    return chars;
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int jobs = 1;
+    if (argc > 1 && strncmp(argv[1], "--jobs=", 7) == 0)
+    {
+        jobs = atoi(argv[1] + 7);
+        argc--;
+        argv++;
+    }
+    size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 8;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+
+    Buffer source = {NULL, 0, 0};
+    if (argc > 3)
+    {
+        source.chars = read_file(argv[3], &source.length);
+    }
+    else
+    {
+        generate(&source, megabytes * 1024 * 1024);
+    }
+
+    double best = 0;
+    size_t tokens = 0;
+    for (int i = 0; i < rounds; i++)
+    {
+        double start = now_seconds();
+        Scanner *scanner = scanTokenParallel(source.chars, source.length, jobs, 0);
+        double elapsed = now_seconds() - start;
+        tokens = scanner->number_tokens;
+        free_scanner(scanner);
+        if (best == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+
+    double mb = source.length / (1024.0 * 1024.0);
+    printf("scanned %.1f MB, %zu tokens, %d jobs, best of %d: %.3f s, %.1f MB/s\n",
+           mb, tokens, jobs, rounds, best, mb / best);
+    free(source.chars);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+ArenaBlock *init_arena_block(size_t size, ArenaBlock *next)
+{
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+Arena *init_arena()
+{
+    Arena *arena = calloc(1, sizeof(Arena));
+    arena->head = init_arena_block(ARENA_BLOCK_SIZE, NULL);
+    return arena;
+}
+
+// Returns zeroed memory, so it can stand in for calloc
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->head;
+    if (block->used + size > block->size)
+    {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = init_arena_block(block_size, arena->head);
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// Frees every block but the current one and starts filling it again. All
+// memory handed out so far becomes invalid.
+void reset_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->head->next;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head->next = NULL;
+    arena->head->used = 0;
+}
+
+void free_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    free(arena);
+}
@@ -0,0 +1,28 @@
+#ifndef __ARENA__
+#define __ARENA__
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock_
+{
+    struct ArenaBlock_ *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+} ArenaBlock;
+
+// Bump-pointer allocator: memory is handed out from large blocks and only
+// ever released all at once, by reset_arena or free_arena.
+typedef struct
+{
+    ArenaBlock *head; // block currently being filled, older blocks follow
+} Arena;
+
+Arena *init_arena();
+void *arena_alloc(Arena *arena, size_t size);
+void reset_arena(Arena *arena);
+void free_arena(Arena *arena);
+
+#endif //__ARENA__
@@ -0,0 +1,690 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "astcache.h"
+
+// Bumped whenever the meaning of the node types or of TokenType changes.
+// Changes to the size of the structs are caught by the layout field.
+#define AST_CACHE_VERSION 4
+
+// File layout: the header, the node image (size_nodes bytes), the
+// relocations (one uint32_t per pointer in the image), the string fixups and
+// then the strings, each a uint64_t length followed by its characters padded
+// to 8 bytes. Pointer and Value fields are 8-byte aligned, so the image is
+// addressed in 8-byte words to keep the offsets 32 bits.
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t layout;
+    uint64_t source_hash;
+    uint64_t source_length;
+    uint64_t optimized;
+    uint64_t hoisted;
+    uint64_t strength_reduced;
+    uint64_t len_statements;
+    uint64_t statements; // offset of the Statement * array in the image
+    uint64_t size_nodes;
+    uint64_t len_relocations;
+    uint64_t len_fixups;
+    uint64_t len_strings;
+    uint64_t size_strings;
+    uint64_t checksum; // of the whole file, see checksum_file()
+} CacheHeader;
+
+// A field of the image that refers to an interned string, either directly
+// (ObjString *) or as a string Value
+typedef struct
+{
+    uint32_t word;
+    uint32_t string; // index, STRING_VALUE set for a Value
+} StringFixup;
+
+#define STRING_VALUE 0x80000000u
+
+#define LAYOUT ((uint64_t)sizeof(Expression) | (uint64_t)sizeof(Statement) << 16 | \
+                (uint64_t)sizeof(Block) << 32 | (uint64_t)sizeof(Token) << 48)
+#define NO_NODE SIZE_MAX
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} Buffer;
+
+typedef struct
+{
+    Buffer nodes;
+    Buffer relocations;
+    Buffer fixups;
+    Buffer strings;
+    size_t len_strings;
+    // Index of every string written so far, open addressing on the string's
+    // own hash
+    ObjString **string_keys;
+    uint32_t *string_indexes;
+    size_t size_string_table; // a power of two
+} Writer;
+
+static uint64_t hash_bytes(const uint8_t *source, size_t length)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, source + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, source + i, length - i);
+    hash = (hash ^ tail) * 0xff51afd7ed558ccdULL;
+    return hash ^ (hash >> 29);
+}
+
+// Of the header, taken with its checksum zeroed, and the four sections after
+// it. A file damaged after it was written is parsed again, not run.
+static uint64_t checksum_file(const CacheHeader *header, const uint8_t *nodes, const uint8_t *relocations,
+                              const uint8_t *fixups, const uint8_t *strings)
+{
+    CacheHeader unsummed = *header;
+    unsummed.checksum = 0;
+    const uint8_t *sections[] = {(const uint8_t *)&unsummed, nodes, relocations, fixups, strings};
+    size_t sizes[] = {sizeof(unsummed), header->size_nodes, header->len_relocations * sizeof(uint32_t),
+                      header->len_fixups * sizeof(StringFixup), header->size_strings};
+    uint64_t checksum = 0;
+    for (int i = 0; i < 5; i++)
+    {
+        // An empty section may have no buffer at all
+        uint64_t hash = sizes[i] > 0 ? hash_bytes(sections[i], sizes[i]) : 0;
+        checksum = (checksum ^ hash) * 0xc4ceb9fe1a85ec53ULL;
+    }
+    return checksum;
+}
+
+// Room for size more bytes, zeroed, at an 8-byte aligned offset
+static size_t reserve(Buffer *buffer, size_t size)
+{
+    size_t at = (buffer->len + 7) & ~(size_t)7;
+    if (at + size > buffer->size)
+    {
+        buffer->size = buffer->size == 0 ? 4096 : buffer->size;
+        while (at + size > buffer->size)
+        {
+            buffer->size *= 2;
+        }
+        buffer->data = realloc(buffer->data, buffer->size);
+    }
+    memset(buffer->data + buffer->len, 0, at + size - buffer->len);
+    buffer->len = at + size;
+    return at;
+}
+
+// Makes the pointer field at `at` refer to the node at target
+static void write_pointer(Writer *writer, size_t at, size_t target)
+{
+    uint64_t offset = target == NO_NODE ? 0 : target;
+    memcpy(writer->nodes.data + at, &offset, sizeof(offset));
+    if (target != NO_NODE)
+    {
+        // 4-byte entries packed back to back, reserve() would pad them
+        if (writer->relocations.len + sizeof(uint32_t) > writer->relocations.size)
+        {
+            writer->relocations.size = writer->relocations.size == 0 ? 4096 : writer->relocations.size * 2;
+            writer->relocations.data = realloc(writer->relocations.data, writer->relocations.size);
+        }
+        uint32_t word = (uint32_t)(at / 8);
+        memcpy(writer->relocations.data + writer->relocations.len, &word, sizeof(word));
+        writer->relocations.len += sizeof(word);
+    }
+}
+
+static uint32_t string_index(Writer *writer, ObjString *string)
+{
+    if (writer->len_strings * 2 >= writer->size_string_table)
+    {
+        // Grow and rehash
+        size_t size = writer->size_string_table == 0 ? 256 : writer->size_string_table * 2;
+        ObjString **keys = calloc(size, sizeof(ObjString *));
+        uint32_t *indexes = malloc(size * sizeof(uint32_t));
+        for (size_t i = 0; i < writer->size_string_table; i++)
+        {
+            ObjString *key = writer->string_keys[i];
+            if (key == NULL)
+            {
+                continue;
+            }
+            size_t slot = key->hash & (size - 1);
+            while (keys[slot] != NULL)
+            {
+                slot = (slot + 1) & (size - 1);
+            }
+            keys[slot] = key;
+            indexes[slot] = writer->string_indexes[i];
+        }
+        free(writer->string_keys);
+        free(writer->string_indexes);
+        writer->string_keys = keys;
+        writer->string_indexes = indexes;
+        writer->size_string_table = size;
+    }
+    size_t slot = string->hash & (writer->size_string_table - 1);
+    while (writer->string_keys[slot] != NULL)
+    {
+        if (writer->string_keys[slot] == string)
+        {
+            return writer->string_indexes[slot];
+        }
+        slot = (slot + 1) & (writer->size_string_table - 1);
+    }
+    uint64_t length = string->length;
+    size_t at = reserve(&writer->strings, sizeof(length) + length);
+    memcpy(writer->strings.data + at, &length, sizeof(length));
+    memcpy(writer->strings.data + at + sizeof(length), string->chars, length);
+    writer->string_keys[slot] = string;
+    writer->string_indexes[slot] = (uint32_t)writer->len_strings;
+    return (uint32_t)writer->len_strings++;
+}
+
+// Makes the field at `at` refer to string once loaded, NULL stays NULL
+static void write_string(Writer *writer, size_t at, ObjString *string, int is_value)
+{
+    memset(writer->nodes.data + at, 0, sizeof(void *));
+    if (string == NULL)
+    {
+        return;
+    }
+    StringFixup fixup = {(uint32_t)(at / 8), string_index(writer, string) | (is_value ? STRING_VALUE : 0)};
+    size_t where = reserve(&writer->fixups, sizeof(fixup));
+    memcpy(writer->fixups.data + where, &fixup, sizeof(fixup));
+}
+
+static size_t write_token(Writer *writer, Token *token)
+{
+    if (token == NULL)
+    {
+        return NO_NODE;
+    }
+    size_t at = reserve(&writer->nodes, sizeof(Token));
+    memcpy(writer->nodes.data + at, token, sizeof(Token));
+    if (token->type == IDENTIFIER || token->type == STRING)
+    {
+        write_string(writer, at + offsetof(Token, symbol), token->symbol, 0);
+    }
+    return at;
+}
+
+// The image moves as it grows, so fields are always addressed by offset and
+// children are written before the field pointing at them is set
+#define FIELD(type, at, field) ((at) + offsetof(type, field))
+
+static size_t write_expression(Writer *writer, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return NO_NODE;
+    }
+    size_t at = reserve(&writer->nodes, sizeof(Expression));
+    memcpy(writer->nodes.data + at, expr, sizeof(Expression));
+    size_t child;
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        // Short strings are in the value itself
+        if (IS_OBJ(expr->as.value))
+        {
+            write_string(writer, FIELD(Expression, at, as.value), AS_STRING(expr->as.value), 1);
+        }
+        break;
+    case EXPR_VARIABLE:
+    case EXPR_LOCAL:
+    case EXPR_GLOBAL:
+        child = write_token(writer, expr->as.variable.name);
+        write_pointer(writer, FIELD(Expression, at, as.variable.name), child);
+        write_string(writer, FIELD(Expression, at, as.variable.identifier), expr->as.variable.identifier, 0);
+        break;
+    case EXPR_ASSIGN:
+        child = write_token(writer, expr->as.assign.name);
+        write_pointer(writer, FIELD(Expression, at, as.assign.name), child);
+        write_string(writer, FIELD(Expression, at, as.assign.identifier), expr->as.assign.identifier, 0);
+        child = write_expression(writer, expr->as.assign.value);
+        write_pointer(writer, FIELD(Expression, at, as.assign.value), child);
+        break;
+    case EXPR_INVARIANT:
+        child = write_expression(writer, expr->as.invariant.expr);
+        write_pointer(writer, FIELD(Expression, at, as.invariant.expr), child);
+        write_string(writer, FIELD(Expression, at, as.invariant.identifier), expr->as.invariant.identifier, 0);
+        break;
+    default: // binary, grouping, unary and their specialized forms
+        child = write_expression(writer, expr->as.binary.left);
+        write_pointer(writer, FIELD(Expression, at, as.binary.left), child);
+        child = write_token(writer, expr->as.binary.operator);
+        write_pointer(writer, FIELD(Expression, at, as.binary.operator), child);
+        child = write_expression(writer, expr->as.binary.right);
+        write_pointer(writer, FIELD(Expression, at, as.binary.right), child);
+        break;
+    }
+    return at;
+}
+
+static size_t write_statement(Writer *writer, Statement *stmt);
+
+// Array of len statement pointers
+static size_t write_statements(Writer *writer, Statement **statements, size_t len)
+{
+    size_t at = reserve(&writer->nodes, len * sizeof(Statement *));
+    for (size_t i = 0; i < len; i++)
+    {
+        size_t child = write_statement(writer, statements[i]);
+        write_pointer(writer, at + i * sizeof(Statement *), child);
+    }
+    return at;
+}
+
+static size_t write_statement(Writer *writer, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return NO_NODE;
+    }
+    size_t at = reserve(&writer->nodes, sizeof(Statement));
+    memcpy(writer->nodes.data + at, stmt, sizeof(Statement));
+    // Runtime state is not part of the program
+    memset(writer->nodes.data + FIELD(Statement, at, iterations), 0, sizeof(stmt->iterations));
+    memset(writer->nodes.data + FIELD(Statement, at, jit), 0, sizeof(stmt->jit));
+    size_t child;
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        child = write_expression(writer, stmt->data.expr.expression);
+        write_pointer(writer, FIELD(Statement, at, data.expr.expression), child);
+        break;
+    case STMT_PRINT:
+        child = write_expression(writer, stmt->data.print.expression);
+        write_pointer(writer, FIELD(Statement, at, data.print.expression), child);
+        break;
+    case STMT_VAR:
+        child = write_token(writer, stmt->data.var.name);
+        write_pointer(writer, FIELD(Statement, at, data.var.name), child);
+        write_string(writer, FIELD(Statement, at, data.var.identifier), stmt->data.var.identifier, 0);
+        child = write_expression(writer, stmt->data.var.initializer);
+        write_pointer(writer, FIELD(Statement, at, data.var.initializer), child);
+        break;
+    case STMT_BLOCK:
+    {
+        Block *block = stmt->data.block;
+        size_t block_at = reserve(&writer->nodes, sizeof(Block));
+        memcpy(writer->nodes.data + block_at, block, sizeof(Block));
+        write_pointer(writer, FIELD(Statement, at, data.block), block_at);
+        child = write_statements(writer, block->statements, block->len_statements);
+        write_pointer(writer, FIELD(Block, block_at, statements), child);
+        break;
+    }
+    case STMT_IF:
+        child = write_expression(writer, stmt->data.if_stmt.condition);
+        write_pointer(writer, FIELD(Statement, at, data.if_stmt.condition), child);
+        child = write_statement(writer, stmt->data.if_stmt.thenBranch);
+        write_pointer(writer, FIELD(Statement, at, data.if_stmt.thenBranch), child);
+        child = write_statement(writer, stmt->data.if_stmt.elseBranch);
+        write_pointer(writer, FIELD(Statement, at, data.if_stmt.elseBranch), child);
+        break;
+    case STMT_WHILE:
+        child = write_expression(writer, stmt->data.while_stmt.condition);
+        write_pointer(writer, FIELD(Statement, at, data.while_stmt.condition), child);
+        child = write_statement(writer, stmt->data.while_stmt.body);
+        write_pointer(writer, FIELD(Statement, at, data.while_stmt.body), child);
+        break;
+    case STMT_FOR:
+        child = write_statement(writer, stmt->data.for_stmt.initializer);
+        write_pointer(writer, FIELD(Statement, at, data.for_stmt.initializer), child);
+        child = write_expression(writer, stmt->data.for_stmt.condition);
+        write_pointer(writer, FIELD(Statement, at, data.for_stmt.condition), child);
+        child = write_expression(writer, stmt->data.for_stmt.increment);
+        write_pointer(writer, FIELD(Statement, at, data.for_stmt.increment), child);
+        child = write_statement(writer, stmt->data.for_stmt.body);
+        write_pointer(writer, FIELD(Statement, at, data.for_stmt.body), child);
+        break;
+    }
+    return at;
+}
+
+// An empty section may have no buffer at all, and then writes nothing
+static int write_section(FILE *file, const Buffer *section)
+{
+    return section->len == 0 || fwrite(section->data, 1, section->len, file) == section->len;
+}
+
+char *ast_cache_path(const char *script_path)
+{
+    size_t length = strlen(script_path);
+    int is_lox = length >= 4 && strcmp(script_path + length - 4, ".lox") == 0;
+    char *path = malloc(length + 6);
+    sprintf(path, "%s%s", script_path, is_lox ? "c" : ".loxc");
+    return path;
+}
+
+void save_ast_cache(const char *path, const char *source, size_t length, Statement **statements,
+                    size_t len_statements, const OptimizerStats *stats)
+{
+    Writer writer = {0};
+    size_t statements_at = write_statements(&writer, statements, len_statements);
+    reserve(&writer.nodes, 0); // pads the image to 8 bytes
+
+    CacheHeader header = {{'L', 'O', 'X', 'C'}, AST_CACHE_VERSION, LAYOUT,
+                          hash_bytes((const uint8_t *)source, length), length, stats != NULL,
+                          stats != NULL ? stats->hoisted : 0, stats != NULL ? stats->strength_reduced : 0,
+                          len_statements, statements_at, writer.nodes.len,
+                          writer.relocations.len / sizeof(uint32_t), writer.fixups.len / sizeof(StringFixup),
+                          writer.len_strings, writer.strings.len, 0};
+    header.checksum = checksum_file(&header, writer.nodes.data, writer.relocations.data, writer.fixups.data,
+                                    writer.strings.data);
+
+    // Written aside and renamed, so a reader never sees half a file. Trees
+    // too big for 32-bit word offsets are not cached.
+    int fits = writer.nodes.len / 8 <= UINT32_MAX && writer.len_strings < STRING_VALUE;
+    char *temporary = malloc(strlen(path) + 5);
+    sprintf(temporary, "%s.tmp", path);
+    FILE *file = fits ? fopen(temporary, "wb") : NULL;
+    if (file != NULL)
+    {
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && write_section(file, &writer.nodes) && write_section(file, &writer.relocations) &&
+             write_section(file, &writer.fixups) && write_section(file, &writer.strings);
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temporary, path) != 0)
+        {
+            remove(temporary);
+        }
+    }
+    free(temporary);
+    free(writer.nodes.data);
+    free(writer.relocations.data);
+    free(writer.fixups.data);
+    free(writer.strings.data);
+    free(writer.string_keys);
+    free(writer.string_indexes);
+}
+
+// Whether node, unless NULL, is a size-byte node of the image written after
+// the one at holder. The writer puts every node before its children, so
+// this also rules out cycles.
+static int node_in_image(const uint8_t *nodes, size_t size_nodes, size_t holder, const void *node, size_t size)
+{
+    size_t at = (uintptr_t)node - (uintptr_t)nodes;
+    return node == NULL || (at > holder && at % 8 == 0 && at <= size_nodes && size <= size_nodes - at);
+}
+
+static size_t node_offset(const uint8_t *nodes, const void *node)
+{
+    return (uintptr_t)node - (uintptr_t)nodes;
+}
+
+static int check_token(const uint8_t *nodes, size_t size_nodes, size_t holder, Token *token)
+{
+    return node_in_image(nodes, size_nodes, holder, token, sizeof(Token)) &&
+           (token == NULL || (unsigned)token->type <= EOF_LOX);
+}
+
+static int check_expression(const uint8_t *nodes, size_t size_nodes, size_t holder, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return 1;
+    }
+    if (!node_in_image(nodes, size_nodes, holder, expr, sizeof(Expression)) || (unsigned)expr->type > EXPR_GLOBAL)
+    {
+        return 0;
+    }
+    size_t at = node_offset(nodes, expr);
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        return 1;
+    case EXPR_VARIABLE:
+    case EXPR_LOCAL:
+    case EXPR_GLOBAL:
+        return check_token(nodes, size_nodes, at, expr->as.variable.name);
+    case EXPR_ASSIGN:
+        return check_token(nodes, size_nodes, at, expr->as.assign.name) &&
+               check_expression(nodes, size_nodes, at, expr->as.assign.value);
+    case EXPR_INVARIANT:
+        return check_expression(nodes, size_nodes, at, expr->as.invariant.expr);
+    default:
+        return check_expression(nodes, size_nodes, at, expr->as.binary.left) &&
+               check_token(nodes, size_nodes, at, expr->as.binary.operator) &&
+               check_expression(nodes, size_nodes, at, expr->as.binary.right);
+    }
+}
+
+static int check_statement(const uint8_t *nodes, size_t size_nodes, size_t holder, Statement *stmt);
+
+// The array at `at` itself has already been checked
+static int check_statements(const uint8_t *nodes, size_t size_nodes, size_t at, Statement **statements, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!check_statement(nodes, size_nodes, at, statements[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int check_statement(const uint8_t *nodes, size_t size_nodes, size_t holder, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return 1;
+    }
+    if (!node_in_image(nodes, size_nodes, holder, stmt, sizeof(Statement)) || (unsigned)stmt->type > STMT_FOR)
+    {
+        return 0;
+    }
+    size_t at = node_offset(nodes, stmt);
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        return check_expression(nodes, size_nodes, at, stmt->data.expr.expression);
+    case STMT_PRINT:
+        return check_expression(nodes, size_nodes, at, stmt->data.print.expression);
+    case STMT_VAR:
+        return check_token(nodes, size_nodes, at, stmt->data.var.name) &&
+               check_expression(nodes, size_nodes, at, stmt->data.var.initializer);
+    case STMT_BLOCK:
+    {
+        Block *block = stmt->data.block;
+        if (block == NULL || !node_in_image(nodes, size_nodes, at, block, sizeof(Block)))
+        {
+            return 0;
+        }
+        size_t block_at = node_offset(nodes, block);
+        if (block->len_statements > size_nodes / sizeof(Statement *) ||
+            !node_in_image(nodes, size_nodes, block_at, block->statements, block->len_statements * sizeof(Statement *)))
+        {
+            return 0;
+        }
+        return block->len_statements == 0 ||
+               check_statements(nodes, size_nodes, node_offset(nodes, block->statements), block->statements,
+                                block->len_statements);
+    }
+    case STMT_IF:
+        return check_expression(nodes, size_nodes, at, stmt->data.if_stmt.condition) &&
+               check_statement(nodes, size_nodes, at, stmt->data.if_stmt.thenBranch) &&
+               check_statement(nodes, size_nodes, at, stmt->data.if_stmt.elseBranch);
+    case STMT_WHILE:
+        return check_expression(nodes, size_nodes, at, stmt->data.while_stmt.condition) &&
+               check_statement(nodes, size_nodes, at, stmt->data.while_stmt.body);
+    case STMT_FOR:
+        return check_statement(nodes, size_nodes, at, stmt->data.for_stmt.initializer) &&
+               check_expression(nodes, size_nodes, at, stmt->data.for_stmt.condition) &&
+               check_expression(nodes, size_nodes, at, stmt->data.for_stmt.increment) &&
+               check_statement(nodes, size_nodes, at, stmt->data.for_stmt.body);
+    }
+    return 0;
+}
+
+// Every string's length has to fit in what is left of the section
+static int check_strings(const uint8_t *strings, size_t size_strings, size_t len_strings)
+{
+    size_t at = 0;
+    for (size_t i = 0; i < len_strings; i++)
+    {
+        uint64_t string_length;
+        if (at + sizeof(string_length) > size_strings)
+        {
+            return 0;
+        }
+        memcpy(&string_length, strings + at, sizeof(string_length));
+        if (string_length > size_strings - at - sizeof(string_length))
+        {
+            return 0;
+        }
+        at += (sizeof(string_length) + string_length + 7) & ~(size_t)7;
+    }
+    return 1;
+}
+
+// Relocates and checks the mapped file. Nothing it finds is trusted until it
+// has been checked, the caller unmaps it on failure.
+static int load_mapping(uint8_t *mapping, size_t size, const char *source, size_t length, int optimized,
+                        CachedProgram *program)
+{
+    CacheHeader *header = (CacheHeader *)mapping;
+    size_t payload = size - sizeof(CacheHeader);
+    // Each section is bounded by the file first, so their sum cannot overflow
+    if (memcmp(header->magic, "LOXC", 4) != 0 || header->version != AST_CACHE_VERSION || header->layout != LAYOUT ||
+        header->source_length != length || header->optimized != (uint64_t)optimized ||
+        header->source_hash != hash_bytes((const uint8_t *)source, length) ||
+        header->size_nodes > payload || header->len_relocations > payload / sizeof(uint32_t) ||
+        header->len_fixups > payload / sizeof(StringFixup) || header->size_strings > payload ||
+        header->len_strings > header->size_strings / sizeof(uint64_t) || header->size_nodes % 8 != 0)
+    {
+        return 0;
+    }
+    size_t relocations_at = sizeof(CacheHeader) + header->size_nodes;
+    size_t fixups_at = relocations_at + header->len_relocations * sizeof(uint32_t);
+    size_t strings_at = fixups_at + header->len_fixups * sizeof(StringFixup);
+    if (strings_at + header->size_strings != size || header->statements % 8 != 0 ||
+        header->statements > header->size_nodes ||
+        header->len_statements > (header->size_nodes - header->statements) / sizeof(Statement *))
+    {
+        return 0;
+    }
+    uint8_t *nodes = mapping + sizeof(CacheHeader);
+    if (header->checksum !=
+            checksum_file(header, nodes, mapping + relocations_at, mapping + fixups_at, mapping + strings_at) ||
+        !check_strings(mapping + strings_at, header->size_strings, header->len_strings))
+    {
+        return 0;
+    }
+
+    // A pointer lands in the image here, check_statements() then checks it
+    // lands on a node of the right kind
+    uint32_t *relocations = (uint32_t *)(mapping + relocations_at);
+    for (size_t i = 0; i < header->len_relocations; i++)
+    {
+        if (relocations[i] >= header->size_nodes / 8)
+        {
+            return 0;
+        }
+        uint64_t *field = (uint64_t *)nodes + relocations[i];
+        if (*field >= header->size_nodes)
+        {
+            return 0;
+        }
+        *field += (uint64_t)(uintptr_t)nodes;
+    }
+    StringFixup *fixups = (StringFixup *)(mapping + fixups_at);
+    for (size_t i = 0; i < header->len_fixups; i++)
+    {
+        if (fixups[i].word >= header->size_nodes / 8 || (fixups[i].string & ~STRING_VALUE) >= header->len_strings)
+        {
+            return 0;
+        }
+    }
+    Statement **statements = (Statement **)(nodes + header->statements);
+    if (!check_statements(nodes, header->size_nodes, header->statements, statements, header->len_statements))
+    {
+        return 0;
+    }
+
+    ObjString **strings = malloc((header->len_strings + 1) * sizeof(ObjString *));
+    uint8_t *string = mapping + strings_at;
+    for (size_t i = 0; i < header->len_strings; i++)
+    {
+        uint64_t string_length;
+        memcpy(&string_length, string, sizeof(string_length));
+        strings[i] = copy_string((const char *)string + sizeof(string_length), string_length);
+        string += (sizeof(string_length) + string_length + 7) & ~(size_t)7;
+    }
+    for (size_t i = 0; i < header->len_fixups; i++)
+    {
+        ObjString *target = strings[fixups[i].string & ~STRING_VALUE];
+        uint8_t *field = nodes + (size_t)fixups[i].word * 8;
+        if (fixups[i].string & STRING_VALUE)
+        {
+            Value value = OBJ_VAL(target);
+            memcpy(field, &value, sizeof(value));
+        }
+        else
+        {
+            memcpy(field, &target, sizeof(target));
+        }
+    }
+    free(strings);
+
+    program->mapping = mapping;
+    program->size_mapping = size;
+    program->statements = statements;
+    program->len_statements = header->len_statements;
+    program->stats.hoisted = header->hoisted;
+    program->stats.strength_reduced = header->strength_reduced;
+    return 1;
+}
+
+int load_ast_cache(const char *path, const char *source, size_t length, int optimized, CachedProgram *program)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    // Private so relocating, and later running, never touches the file
+    uint8_t *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return 0;
+    }
+    if (!load_mapping(mapping, size, source, length, optimized, program))
+    {
+        munmap(mapping, size);
+        return 0;
+    }
+    return 1;
+}
+
+void unload_ast_cache(CachedProgram *program)
+{
+    if (program->mapping != NULL)
+    {
+        munmap(program->mapping, program->size_mapping);
+    }
+    program->mapping = NULL;
+    program->statements = NULL;
+    program->len_statements = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __ASTCACHE__
+#define __ASTCACHE__
+
+#include "parser.h"
+#include "optimizer.h"
+
+// Parsed programs saved next to their script (file.lox -> file.loxc) so
+// that running an unchanged script again skips scanning and parsing. The
+// file is one image of the tree with pointers stored as offsets, plus the
+// list of where those pointers are and the strings the tree refers to.
+// Loading maps it copy-on-write, adds the mapping's address to every
+// pointer and interns the strings. The tree is saved as it is about to run,
+// after the optimizer if that is on, so a cached run skips optimizing too.
+// The cache is keyed by a hash of the source, by whether the tree was
+// optimized and by the layout of the nodes; anything else is ignored. A
+// file that fails its checksum, or whose tree points outside itself, counts
+// as missing: the script is parsed again and the cache rewritten.
+typedef struct
+{
+    void *mapping;
+    size_t size_mapping;
+    Statement **statements; // point into the mapping, which may be written to
+    size_t len_statements;
+    OptimizerStats stats; // what optimizing did, zero if the tree is not optimized
+} CachedProgram;
+
+// Path of the cache file for a script, to be freed by the caller
+char *ast_cache_path(const char *script_path);
+// 1 when path holds a tree parsed from exactly this source, and optimized
+// when `optimized` is set
+int load_ast_cache(const char *path, const char *source, size_t length, int optimized, CachedProgram *program);
+void unload_ast_cache(CachedProgram *program);
+// Best effort, a cache that cannot be written is simply not there next time.
+// stats is NULL when the tree was not optimized.
+void save_ast_cache(const char *path, const char *source, size_t length, Statement **statements,
+                    size_t len_statements, const OptimizerStats *stats);
+
+#endif //__ASTCACHE__
@@ -0,0 +1,746 @@
+#include <string.h>
+
+#include "cgen.h"
+
+// Every expression is lowered into statements that leave its value in a
+// fresh temporary, t<n>. That keeps the interpreter's left to right order
+// of evaluation (C leaves the order of operands unspecified) and gives and/or
+// a place to short-circuit. gcc folds the temporaries away.
+//
+// Globals become file-level variables g_<name> that start out undefined, so
+// that reading one before its declaration runs fails like in the
+// interpreter. Locals become C locals l<scope>_<slot>, declared at the top of
+// the C block that mirrors their Lox scope.
+
+// Runtime copied at the top of every generated file. Values are tagged
+// structs and strings are compared by content rather than interned; what a
+// script can observe is the same.
+//
+// A string value is a prefix of a buffer. Appending to a value that covers
+// its whole buffer writes in place, growing the buffer when needed, so a
+// string built in a loop is not copied on every step; the shorter values
+// sharing the buffer still see the same prefix. Buffers are freed by a mark
+// and sweep collection at the top of loop iterations, where the only values
+// still in use are the globals and the locals in scope.
+static const char *runtime =
+    "#include <math.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "// Arithmetic must round like the interpreter's: no fused multiply-adds\n"
+    "#if defined(__clang__)\n"
+    "#pragma STDC FP_CONTRACT OFF\n"
+    "#elif defined(__GNUC__)\n"
+    "#pragma GCC optimize(\"fp-contract=off\")\n"
+    "#endif\n"
+    "\n"
+    "typedef enum { VAL_NIL, VAL_BOOL, VAL_NUMBER, VAL_STRING, VAL_UNDEFINED } ValueType;\n"
+    "// capacity is 0 for literals, which are never written to or freed\n"
+    "typedef struct Buffer { struct Buffer *next; size_t length; size_t capacity; int marked; char *chars; } Buffer;\n"
+    "// A string's length fills the padding after the type: at 16 bytes gcc\n"
+    "// keeps values in registers and folds arithmetic on them\n"
+    "typedef struct { ValueType type; uint32_t length; union { int boolean; double number; Buffer *buffer; } as; } Value;\n"
+    "\n"
+    "#define NIL ((Value){VAL_NIL, 0, {0}})\n"
+    "#define UNDEFINED ((Value){VAL_UNDEFINED, 0, {0}})\n"
+    "#define BOOL(b) ((Value){VAL_BOOL, 0, {.boolean = (b)}})\n"
+    "#define NUMBER(n) ((Value){VAL_NUMBER, 0, {.number = (n)}})\n"
+    "#define STRING(b, n) ((Value){VAL_STRING, (n), {.buffer = (b)}})\n"
+    "\n"
+    "#define GC_MIN_THRESHOLD (1024 * 1024)\n"
+    "\n"
+    "static Buffer *buffers = NULL; // every buffer made at run time\n"
+    "static size_t bytes_allocated = 0; // capacity of the buffers\n"
+    "static size_t gc_threshold = GC_MIN_THRESHOLD;\n"
+    "static int gc_requested = 0; // checked at the top of every loop iteration\n"
+    "\n"
+    "// stdout is flushed first so that the output interleaves like the\n"
+    "// interpreter's, which does not buffer it\n"
+    "static void runtime_error(const char *message)\n"
+    "{\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"%s\\n\", message);\n"
+    "    exit(70);\n"
+    "}\n"
+    "\n"
+    "static void undefined_variable(const char *name)\n"
+    "{\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"Undefined variable '%s'.\\n\", name);\n"
+    "    exit(70);\n"
+    "}\n"
+    "\n"
+    "static inline Value get_global(Value value, const char *name)\n"
+    "{\n"
+    "    if (value.type == VAL_UNDEFINED)\n"
+    "        undefined_variable(name);\n"
+    "    return value;\n"
+    "}\n"
+    "\n"
+    "static inline void set_global(Value *global, Value value, const char *name)\n"
+    "{\n"
+    "    if (global->type == VAL_UNDEFINED)\n"
+    "        undefined_variable(name);\n"
+    "    *global = value;\n"
+    "}\n"
+    "\n"
+    "static inline int truthy(Value value)\n"
+    "{\n"
+    "    return value.type == VAL_BOOL ? value.as.boolean : value.type != VAL_NIL;\n"
+    "}\n"
+    "\n"
+    "static inline int equal(Value a, Value b)\n"
+    "{\n"
+    "    if (a.type != b.type)\n"
+    "        return 0;\n"
+    "    switch (a.type)\n"
+    "    {\n"
+    "    case VAL_BOOL:\n"
+    "        return a.as.boolean == b.as.boolean;\n"
+    "    case VAL_NUMBER:\n"
+    "        return a.as.number == b.as.number;\n"
+    "    case VAL_STRING:\n"
+    "        return a.length == b.length && memcmp(a.as.buffer->chars, b.as.buffer->chars, a.length) == 0;\n"
+    "    default:\n"
+    "        return 1;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void check_numbers(Value a, Value b)\n"
+    "{\n"
+    "    if (a.type != VAL_NUMBER || b.type != VAL_NUMBER)\n"
+    "        runtime_error(\"Operands must be numbers.\");\n"
+    "}\n"
+    "\n"
+    "static void note_allocation(size_t size)\n"
+    "{\n"
+    "    bytes_allocated += size;\n"
+    "    if (bytes_allocated > gc_threshold)\n"
+    "        gc_requested = 1;\n"
+    "}\n"
+    "\n"
+    "static Buffer *new_buffer(size_t capacity)\n"
+    "{\n"
+    "    Buffer *buffer = malloc(sizeof(Buffer));\n"
+    "    buffer->next = buffers;\n"
+    "    buffer->length = 0;\n"
+    "    buffer->capacity = capacity;\n"
+    "    buffer->marked = 0;\n"
+    "    buffer->chars = malloc(capacity);\n"
+    "    buffers = buffer;\n"
+    "    note_allocation(capacity);\n"
+    "    return buffer;\n"
+    "}\n"
+    "\n"
+    "static Value concatenate(Value a, Value b)\n"
+    "{\n"
+    "    if (b.length == 0)\n"
+    "        return a;\n"
+    "    if (a.length == 0)\n"
+    "        return b;\n"
+    "    size_t length = (size_t)a.length + b.length;\n"
+    "    if (length > UINT32_MAX)\n"
+    "        runtime_error(\"String too long.\");\n"
+    "    Buffer *buffer = a.as.buffer;\n"
+    "    if (buffer->capacity == 0 || a.length != buffer->length)\n"
+    "    {\n"
+    "        // Only the value covering the whole buffer may append to it\n"
+    "        buffer = new_buffer(length);\n"
+    "        memcpy(buffer->chars, a.as.buffer->chars, a.length);\n"
+    "    }\n"
+    "    else if (length > buffer->capacity)\n"
+    "    {\n"
+    "        size_t capacity = buffer->capacity * 2 > length ? buffer->capacity * 2 : length;\n"
+    "        note_allocation(capacity - buffer->capacity);\n"
+    "        buffer->chars = realloc(buffer->chars, capacity);\n"
+    "        buffer->capacity = capacity;\n"
+    "    }\n"
+    "    // b may be a prefix of the same buffer, it ends before a does\n"
+    "    memcpy(buffer->chars + a.length, b.as.buffer->chars, b.length);\n"
+    "    buffer->length = length;\n"
+    "    return STRING(buffer, length);\n"
+    "}\n"
+    "\n"
+    "static void mark(Value value)\n"
+    "{\n"
+    "    if (value.type == VAL_STRING)\n"
+    "        value.as.buffer->marked = 1;\n"
+    "}\n"
+    "\n"
+    "// locals are the ones in scope, globals ends with NULL\n"
+    "static inline void collect_garbage(const Value *locals, size_t len_locals, const Value *const *globals)\n"
+    "{\n"
+    "    for (size_t i = 0; i < len_locals; i++)\n"
+    "        mark(locals[i]);\n"
+    "    for (size_t i = 0; globals[i] != NULL; i++)\n"
+    "        mark(*globals[i]);\n"
+    "    Buffer **link = &buffers;\n"
+    "    while (*link != NULL)\n"
+    "    {\n"
+    "        Buffer *buffer = *link;\n"
+    "        if (!buffer->marked)\n"
+    "        {\n"
+    "            *link = buffer->next;\n"
+    "            bytes_allocated -= buffer->capacity;\n"
+    "            free(buffer->chars);\n"
+    "            free(buffer);\n"
+    "            continue;\n"
+    "        }\n"
+    "        buffer->marked = 0;\n"
+    "        link = &buffer->next;\n"
+    "    }\n"
+    "    gc_threshold = bytes_allocated * 2 > GC_MIN_THRESHOLD ? bytes_allocated * 2 : GC_MIN_THRESHOLD;\n"
+    "    gc_requested = 0;\n"
+    "}\n"
+    "\n"
+    "static inline Value add(Value a, Value b)\n"
+    "{\n"
+    "    if (a.type == VAL_NUMBER && b.type == VAL_NUMBER)\n"
+    "        return NUMBER(a.as.number + b.as.number);\n"
+    "    if (a.type != VAL_STRING || b.type != VAL_STRING)\n"
+    "        runtime_error(\"Operands must be two numbers or two strings.\");\n"
+    "    return concatenate(a, b);\n"
+    "}\n"
+    "\n"
+    "static inline Value subtract(Value a, Value b) { check_numbers(a, b); return NUMBER(a.as.number - b.as.number); }\n"
+    "static inline Value multiply(Value a, Value b) { check_numbers(a, b); return NUMBER(a.as.number * b.as.number); }\n"
+    "static inline Value divide(Value a, Value b) { check_numbers(a, b); return NUMBER(a.as.number / b.as.number); }\n"
+    "static inline Value less(Value a, Value b) { check_numbers(a, b); return BOOL(a.as.number < b.as.number); }\n"
+    "static inline Value less_equal(Value a, Value b) { check_numbers(a, b); return BOOL(a.as.number <= b.as.number); }\n"
+    "static inline Value greater(Value a, Value b) { check_numbers(a, b); return BOOL(a.as.number > b.as.number); }\n"
+    "static inline Value greater_equal(Value a, Value b) { check_numbers(a, b); return BOOL(a.as.number >= b.as.number); }\n"
+    "\n"
+    "static inline Value negate(Value a)\n"
+    "{\n"
+    "    if (a.type != VAL_NUMBER)\n"
+    "        runtime_error(\"Operand must be a number.\");\n"
+    "    return NUMBER(-a.as.number);\n"
+    "}\n"
+    "\n"
+    "// Whole numbers are printed without a fractional part\n"
+    "static void print(Value value)\n"
+    "{\n"
+    "    switch (value.type)\n"
+    "    {\n"
+    "    case VAL_NUMBER:\n"
+    "        if (floor(value.as.number) == value.as.number)\n"
+    "            printf(\"%.0lf\\n\", value.as.number);\n"
+    "        else\n"
+    "            printf(\"%.15g\\n\", value.as.number);\n"
+    "        break;\n"
+    "    case VAL_BOOL:\n"
+    "        printf(value.as.boolean ? \"true\\n\" : \"false\\n\");\n"
+    "        break;\n"
+    "    case VAL_NIL:\n"
+    "        printf(\"nil\\n\");\n"
+    "        break;\n"
+    "    case VAL_STRING:\n"
+    "    {\n"
+    "        // Up to a NUL like the interpreter's %s, there is none at the end\n"
+    "        const char *end = memchr(value.as.buffer->chars, '\\0', value.length);\n"
+    "        fwrite(value.as.buffer->chars, 1, end != NULL ? (size_t)(end - value.as.buffer->chars) : value.length, stdout);\n"
+    "        putchar('\\n');\n"
+    "        break;\n"
+    "    }\n"
+    "    default:\n"
+    "        break;\n"
+    "    }\n"
+    "}\n"
+    "\n";
+
+typedef struct
+{
+    FILE *out;       // body of main
+    FILE *constants; // string literals
+    size_t len_constants;
+    ObjString **globals; // in the order they were first seen
+    size_t len_globals;
+    size_t size_globals;
+    // Open addressing table from global name to index + 1, 0 marks an empty
+    // bucket
+    uint32_t *global_index;
+    size_t size_global_index; // a power of two
+    size_t temporaries;
+    size_t scopes;    // scopes opened so far, each gets its own id
+    size_t *scope_ids; // ids of the scopes enclosing the current node, innermost last
+    size_t *scope_locals; // number of locals each of those declares
+    size_t len_scope_ids;
+    size_t size_scope_ids;
+    int has_safepoints; // whether main refers to global_roots
+    int indent;
+} CGen;
+
+static void indent(CGen *gen)
+{
+    fprintf(gen->out, "%*s", gen->indent * 4, "");
+}
+
+static void grow_global_index(CGen *gen)
+{
+    size_t size = gen->size_global_index == 0 ? 64 : gen->size_global_index * 2;
+    uint32_t *index = calloc(size, sizeof(uint32_t));
+    for (size_t i = 0; i < gen->len_globals; i++)
+    {
+        size_t bucket = gen->globals[i]->hash & (size - 1);
+        while (index[bucket] != 0)
+        {
+            bucket = (bucket + 1) & (size - 1);
+        }
+        index[bucket] = i + 1;
+    }
+    free(gen->global_index);
+    gen->global_index = index;
+    gen->size_global_index = size;
+}
+
+// Names are interned, so they are compared by address
+static void note_global(CGen *gen, ObjString *name)
+{
+    if ((gen->len_globals + 1) * 2 > gen->size_global_index)
+    {
+        grow_global_index(gen);
+    }
+    size_t bucket = name->hash & (gen->size_global_index - 1);
+    while (gen->global_index[bucket] != 0)
+    {
+        if (gen->globals[gen->global_index[bucket] - 1] == name)
+        {
+            return;
+        }
+        bucket = (bucket + 1) & (gen->size_global_index - 1);
+    }
+    gen->global_index[bucket] = gen->len_globals + 1;
+    if (gen->len_globals == gen->size_globals)
+    {
+        gen->size_globals = gen->size_globals == 0 ? 16 : gen->size_globals * 2;
+        gen->globals = realloc(gen->globals, gen->size_globals * sizeof(ObjString *));
+    }
+    gen->globals[gen->len_globals++] = name;
+}
+
+// Opens the Lox scope of a block or for loop and declares its locals
+static void open_scope(CGen *gen, size_t len_locals)
+{
+    if (gen->len_scope_ids == gen->size_scope_ids)
+    {
+        gen->size_scope_ids = gen->size_scope_ids == 0 ? 16 : gen->size_scope_ids * 2;
+        gen->scope_ids = realloc(gen->scope_ids, gen->size_scope_ids * sizeof(size_t));
+        gen->scope_locals = realloc(gen->scope_locals, gen->size_scope_ids * sizeof(size_t));
+    }
+    size_t id = gen->scopes++;
+    gen->scope_locals[gen->len_scope_ids] = len_locals;
+    gen->scope_ids[gen->len_scope_ids++] = id;
+    for (size_t slot = 0; slot < len_locals; slot++)
+    {
+        indent(gen);
+        fprintf(gen->out, "Value l%zu_%zu = NIL;\n", id, slot);
+    }
+}
+
+// Writes the variable at depth/slot, which must be a local, as a C lvalue
+static void write_local(CGen *gen, int depth, int slot)
+{
+    fprintf(gen->out, "l%zu_%d", gen->scope_ids[gen->len_scope_ids - 1 - depth], slot);
+}
+
+// String literal with everything that is not plainly printable escaped
+static void write_c_string(FILE *out, const char *chars, size_t length)
+{
+    fputc('"', out);
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)chars[i];
+        if (c == '"' || c == '\\')
+        {
+            fprintf(out, "\\%c", c);
+        }
+        else if (c < 0x20 || c >= 0x7f || c == '?')
+        {
+            fprintf(out, "\\%03o", c);
+        }
+        else
+        {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// Writes the C expression for a literal
+static void write_literal(CGen *gen, Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        // Hexadecimal so the double comes back bit for bit
+        fprintf(gen->out, "NUMBER(%a)", AS_NUMBER(value));
+    }
+    else if (IS_BOOL(value))
+    {
+        fprintf(gen->out, "BOOL(%d)", AS_BOOL(value));
+    }
+    else if (IS_STRING(value))
+    {
+        ShortString buffer;
+        ObjString *string = as_string(value, &buffer);
+        fprintf(gen->constants, "static Buffer s%zu = {NULL, %zu, 0, 0, ", gen->len_constants, string->length);
+        write_c_string(gen->constants, string->chars, string->length);
+        fprintf(gen->constants, "};\n");
+        fprintf(gen->out, "STRING(&s%zu, %zu)", gen->len_constants++, string->length);
+    }
+    else
+    {
+        fprintf(gen->out, "NIL");
+    }
+}
+
+// Starts the declaration of a new temporary, returns its number
+static size_t begin_temporary(CGen *gen)
+{
+    indent(gen);
+    fprintf(gen->out, "Value t%zu = ", gen->temporaries);
+    return gen->temporaries++;
+}
+
+static const char *binary_function(TokenType operator)
+{
+    switch (operator)
+    {
+    case PLUS:
+        return "add";
+    case MINUS:
+        return "subtract";
+    case STAR:
+        return "multiply";
+    case SLASH:
+        return "divide";
+    case LESS:
+        return "less";
+    case LESS_EQUAL:
+        return "less_equal";
+    case GREATER:
+        return "greater";
+    case GREATER_EQUAL:
+        return "greater_equal";
+    default:
+        return NULL;
+    }
+}
+
+// Emits the statements that evaluate expr, returns the temporary holding
+// its value
+static size_t emit_expression(CGen *gen, Expression *expr)
+{
+    size_t result;
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        result = begin_temporary(gen);
+        write_literal(gen, expr->as.value);
+        fprintf(gen->out, ";\n");
+        return result;
+    case EXPR_GROUPING:
+        return emit_expression(gen, expr->as.binary.left);
+    case EXPR_INVARIANT:
+        return emit_expression(gen, expr->as.invariant.expr);
+    case EXPR_UNARY:
+    {
+        size_t right = emit_expression(gen, expr->as.binary.right);
+        result = begin_temporary(gen);
+        if (expr->as.binary.operator->type == MINUS)
+        {
+            fprintf(gen->out, "negate(t%zu);\n", right);
+        }
+        else
+        {
+            fprintf(gen->out, "BOOL(!truthy(t%zu));\n", right);
+        }
+        return result;
+    }
+    case EXPR_VARIABLE:
+        result = begin_temporary(gen);
+        if (expr->as.variable.depth < 0)
+        {
+            note_global(gen, expr->as.variable.identifier);
+            fprintf(gen->out, "get_global(g_%s, \"%s\");\n", expr->as.variable.identifier->chars,
+                    expr->as.variable.identifier->chars);
+        }
+        else
+        {
+            write_local(gen, expr->as.variable.depth, expr->as.variable.slot);
+            fprintf(gen->out, ";\n");
+        }
+        return result;
+    case EXPR_ASSIGN:
+        result = emit_expression(gen, expr->as.assign.value);
+        indent(gen);
+        if (expr->as.assign.depth < 0)
+        {
+            note_global(gen, expr->as.assign.identifier);
+            fprintf(gen->out, "set_global(&g_%s, t%zu, \"%s\");\n", expr->as.assign.identifier->chars, result,
+                    expr->as.assign.identifier->chars);
+        }
+        else
+        {
+            write_local(gen, expr->as.assign.depth, expr->as.assign.slot);
+            fprintf(gen->out, " = t%zu;\n", result);
+        }
+        return result;
+    default:
+        break;
+    }
+
+    TokenType operator = expr->as.binary.operator->type;
+    if (operator == AND || operator == OR)
+    {
+        result = emit_expression(gen, expr->as.binary.left);
+        indent(gen);
+        fprintf(gen->out, "if (%struthy(t%zu))\n", operator == OR ? "!" : "", result);
+        indent(gen);
+        fprintf(gen->out, "{\n");
+        gen->indent++;
+        size_t right = emit_expression(gen, expr->as.binary.right);
+        indent(gen);
+        fprintf(gen->out, "t%zu = t%zu;\n", result, right);
+        gen->indent--;
+        indent(gen);
+        fprintf(gen->out, "}\n");
+        return result;
+    }
+    size_t left = emit_expression(gen, expr->as.binary.left);
+    size_t right = emit_expression(gen, expr->as.binary.right);
+    result = begin_temporary(gen);
+    if (operator == EQUAL_EQUAL || operator == BANG_EQUAL)
+    {
+        fprintf(gen->out, "BOOL(%sequal(t%zu, t%zu));\n", operator == BANG_EQUAL ? "!" : "", left, right);
+    }
+    else
+    {
+        fprintf(gen->out, "%s(t%zu, t%zu);\n", binary_function(operator), left, right);
+    }
+    return result;
+}
+
+static void emit_statement(CGen *gen, Statement *stmt);
+
+static void open_brace(CGen *gen)
+{
+    indent(gen);
+    fprintf(gen->out, "{\n");
+    gen->indent++;
+}
+
+static void close_brace(CGen *gen)
+{
+    gen->indent--;
+    indent(gen);
+    fprintf(gen->out, "}\n");
+}
+
+// Collects the string buffers at the top of a loop iteration, when it is
+// due. No temporary is in use there, so the roots are the locals of the
+// enclosing scopes, passed by value, and the globals.
+static void emit_safepoint(CGen *gen)
+{
+    gen->has_safepoints = 1;
+    indent(gen);
+    fprintf(gen->out, "if (gc_requested)\n");
+    open_brace(gen);
+    size_t len_locals = 0;
+    indent(gen);
+    fprintf(gen->out, "Value locals[] = {");
+    for (size_t scope = 0; scope < gen->len_scope_ids; scope++)
+    {
+        for (size_t slot = 0; slot < gen->scope_locals[scope]; slot++)
+        {
+            fprintf(gen->out, "%sl%zu_%zu", len_locals++ > 0 ? ", " : "", gen->scope_ids[scope], slot);
+        }
+    }
+    // An empty initializer is not C
+    fprintf(gen->out, "%s};\n", len_locals == 0 ? "NIL" : "");
+    indent(gen);
+    fprintf(gen->out, "collect_garbage(locals, %zu, global_roots);\n", len_locals);
+    close_brace(gen);
+}
+
+// Evaluates condition inside the current C block and leaves it when false
+static void emit_loop_condition(CGen *gen, Expression *condition)
+{
+    if (condition == NULL)
+    {
+        return;
+    }
+    size_t value = emit_expression(gen, condition);
+    indent(gen);
+    fprintf(gen->out, "if (!truthy(t%zu))\n", value);
+    indent(gen);
+    fprintf(gen->out, "    break;\n");
+}
+
+static void emit_statement(CGen *gen, Statement *stmt)
+{
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+    {
+        size_t value = emit_expression(gen, stmt->data.expr.expression);
+        indent(gen);
+        fprintf(gen->out, "(void)t%zu;\n", value);
+        break;
+    }
+    case STMT_PRINT:
+    {
+        size_t value = emit_expression(gen, stmt->data.print.expression);
+        indent(gen);
+        fprintf(gen->out, "print(t%zu);\n", value);
+        break;
+    }
+    case STMT_VAR:
+    {
+        int has_value = stmt->data.var.initializer != NULL;
+        size_t value = has_value ? emit_expression(gen, stmt->data.var.initializer) : 0;
+        indent(gen);
+        if (stmt->data.var.slot < 0)
+        {
+            note_global(gen, stmt->data.var.identifier);
+            fprintf(gen->out, "g_%s", stmt->data.var.identifier->chars);
+        }
+        else
+        {
+            write_local(gen, 0, stmt->data.var.slot);
+        }
+        if (has_value)
+        {
+            fprintf(gen->out, " = t%zu;\n", value);
+        }
+        else
+        {
+            fprintf(gen->out, " = NIL;\n");
+        }
+        break;
+    }
+    case STMT_BLOCK:
+    {
+        Block *block = stmt->data.block;
+        open_brace(gen);
+        if (block->len_locals > 0)
+        {
+            open_scope(gen, block->len_locals);
+        }
+        for (size_t i = 0; i < block->len_statements; i++)
+        {
+            emit_statement(gen, block->statements[i]);
+        }
+        if (block->len_locals > 0)
+        {
+            gen->len_scope_ids--;
+        }
+        close_brace(gen);
+        break;
+    }
+    case STMT_IF:
+    {
+        open_brace(gen);
+        size_t condition = emit_expression(gen, stmt->data.if_stmt.condition);
+        indent(gen);
+        fprintf(gen->out, "if (truthy(t%zu))\n", condition);
+        open_brace(gen);
+        emit_statement(gen, stmt->data.if_stmt.thenBranch);
+        close_brace(gen);
+        if (stmt->data.if_stmt.elseBranch != NULL)
+        {
+            indent(gen);
+            fprintf(gen->out, "else\n");
+            open_brace(gen);
+            emit_statement(gen, stmt->data.if_stmt.elseBranch);
+            close_brace(gen);
+        }
+        close_brace(gen);
+        break;
+    }
+    case STMT_WHILE:
+        indent(gen);
+        fprintf(gen->out, "for (;;)\n");
+        open_brace(gen);
+        emit_safepoint(gen);
+        emit_loop_condition(gen, stmt->data.while_stmt.condition);
+        emit_statement(gen, stmt->data.while_stmt.body);
+        close_brace(gen);
+        break;
+    case STMT_FOR:
+        open_brace(gen);
+        if (stmt->data.for_stmt.len_locals > 0)
+        {
+            open_scope(gen, stmt->data.for_stmt.len_locals);
+        }
+        if (stmt->data.for_stmt.initializer != NULL)
+        {
+            emit_statement(gen, stmt->data.for_stmt.initializer);
+        }
+        indent(gen);
+        fprintf(gen->out, "for (;;)\n");
+        open_brace(gen);
+        emit_safepoint(gen);
+        emit_loop_condition(gen, stmt->data.for_stmt.condition);
+        emit_statement(gen, stmt->data.for_stmt.body);
+        if (stmt->data.for_stmt.increment != NULL)
+        {
+            size_t value = emit_expression(gen, stmt->data.for_stmt.increment);
+            indent(gen);
+            fprintf(gen->out, "(void)t%zu;\n", value);
+        }
+        close_brace(gen);
+        if (stmt->data.for_stmt.len_locals > 0)
+        {
+            gen->len_scope_ids--;
+        }
+        close_brace(gen);
+        break;
+    }
+}
+
+void compile_c(Statement **statements, size_t len_statements, FILE *out)
+{
+    CGen gen = {0};
+    char *body = NULL;
+    size_t len_body = 0;
+    char *constants = NULL;
+    size_t len_constants = 0;
+    gen.out = open_memstream(&body, &len_body);
+    gen.constants = open_memstream(&constants, &len_constants);
+    gen.indent = 1;
+    for (size_t i = 0; i < len_statements; i++)
+    {
+        emit_statement(&gen, statements[i]);
+    }
+    fclose(gen.out);
+    fclose(gen.constants);
+
+    // Globals and string literals are only all known once main is written
+    fputs(runtime, out);
+    for (size_t i = 0; i < gen.len_globals; i++)
+    {
+        fprintf(out, "static Value g_%s = UNDEFINED;\n", gen.globals[i]->chars);
+    }
+    if (gen.has_safepoints)
+    {
+        fprintf(out, "static const Value *const global_roots[] = {");
+        for (size_t i = 0; i < gen.len_globals; i++)
+        {
+            fprintf(out, "&g_%s, ", gen.globals[i]->chars);
+        }
+        fprintf(out, "NULL};\n");
+    }
+    fwrite(constants, 1, len_constants, out);
+    fprintf(out, "\nint main(void)\n{\n");
+    fwrite(body, 1, len_body, out);
+    fprintf(out, "    return 0;\n}\n");
+
+    free(body);
+    free(constants);
+    free(gen.globals);
+    free(gen.global_index);
+    free(gen.scope_ids);
+    free(gen.scope_locals);
+}
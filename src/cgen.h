@@ -0,0 +1,15 @@
+#ifndef __CGEN__
+#define __CGEN__
+
+#include <stdio.h>
+
+#include "parser.h"
+
+// Ahead-of-time backend: writes a resolved program out as a standalone C
+// file, with the runtime it needs (values, strings and their collector,
+// printing, the error checks) embedded at the top. Built with
+// `gcc -O2 out.c -o out -lm`, it prints the same output and exits with the
+// same code as `./clox run`.
+void compile_c(Statement **statements, size_t len_statements, FILE *out);
+
+#endif //__CGEN__
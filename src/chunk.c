@@ -0,0 +1,202 @@
+#include "chunk.h"
+
+Chunk *init_chunk()
+{
+    Chunk *chunk = calloc(1, sizeof(Chunk));
+    chunk->size_code = 256;
+    chunk->code = calloc(chunk->size_code, sizeof(uint8_t));
+    chunk->lines = calloc(chunk->size_code, sizeof(int));
+    chunk->size_constants = 64;
+    chunk->constants = calloc(chunk->size_constants, sizeof(Value));
+    chunk->size_globals = 64;
+    chunk->global_names = calloc(chunk->size_globals, sizeof(ObjString *));
+    return chunk;
+}
+
+void free_chunk(Chunk *chunk)
+{
+    free(chunk->code);
+    chunk->code = NULL;
+    free(chunk->lines);
+    chunk->lines = NULL;
+    free(chunk->constants);
+    chunk->constants = NULL;
+    free(chunk->global_names);
+    chunk->global_names = NULL;
+    free(chunk);
+}
+
+// Drops the code and constants but keeps the global slots
+void reset_chunk(Chunk *chunk)
+{
+    chunk->len_code = 0;
+    chunk->len_constants = 0;
+    chunk->max_stack = 0;
+}
+
+void write_chunk(Chunk *chunk, uint8_t byte, int line)
+{
+    if (chunk->len_code >= chunk->size_code)
+    {
+        chunk->size_code *= 2;
+        chunk->code = realloc(chunk->code, chunk->size_code * sizeof(uint8_t));
+        chunk->lines = realloc(chunk->lines, chunk->size_code * sizeof(int));
+    }
+    chunk->code[chunk->len_code] = byte;
+    chunk->lines[chunk->len_code] = line;
+    chunk->len_code++;
+}
+
+size_t add_constant(Chunk *chunk, Value value)
+{
+    if (chunk->len_constants >= chunk->size_constants)
+    {
+        chunk->size_constants *= 2;
+        chunk->constants = realloc(chunk->constants, chunk->size_constants * sizeof(Value));
+    }
+    chunk->constants[chunk->len_constants] = value;
+    return chunk->len_constants++;
+}
+
+size_t add_global(Chunk *chunk, ObjString *name)
+{
+    if (chunk->len_globals >= chunk->size_globals)
+    {
+        chunk->size_globals *= 2;
+        chunk->global_names = realloc(chunk->global_names, chunk->size_globals * sizeof(ObjString *));
+    }
+    chunk->global_names[chunk->len_globals] = name;
+    return chunk->len_globals++;
+}
+
+static size_t simple_instruction(const char *name, size_t offset)
+{
+    printf("%s\n", name);
+    return offset + 1;
+}
+
+static size_t byte_instruction(const char *name, Chunk *chunk, size_t offset)
+{
+    printf("%-20s %4d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+static size_t constant_instruction(const char *name, Chunk *chunk, size_t offset)
+{
+    uint16_t constant = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-20s %4d '", name, constant);
+    Value value = chunk->constants[constant];
+    if (IS_NUMBER(value))
+    {
+        printf("%g'\n", AS_NUMBER(value));
+    }
+    else
+    {
+        ShortString buffer;
+        printf("%s'\n", as_string(value, &buffer)->chars);
+    }
+    return offset + 3;
+}
+
+static size_t global_instruction(const char *name, Chunk *chunk, size_t offset)
+{
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-20s %4d '%s'\n", name, slot, chunk->global_names[slot]->chars);
+    return offset + 3;
+}
+
+static size_t jump_instruction(const char *name, int sign, Chunk *chunk, size_t offset)
+{
+    uint16_t jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-20s %4zu -> %zu\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+static size_t disassemble_instruction(Chunk *chunk, size_t offset)
+{
+    printf("%04zu ", offset);
+    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
+    {
+        printf("   | ");
+    }
+    else
+    {
+        printf("%4d ", chunk->lines[offset]);
+    }
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+        return constant_instruction("OP_CONSTANT", chunk, offset);
+    case OP_NIL:
+        return simple_instruction("OP_NIL", offset);
+    case OP_TRUE:
+        return simple_instruction("OP_TRUE", offset);
+    case OP_FALSE:
+        return simple_instruction("OP_FALSE", offset);
+    case OP_POP:
+        return simple_instruction("OP_POP", offset);
+    case OP_POPN:
+        return byte_instruction("OP_POPN", chunk, offset);
+    case OP_GET_LOCAL:
+        return byte_instruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+        return byte_instruction("OP_SET_LOCAL", chunk, offset);
+    case OP_GET_GLOBAL:
+        return global_instruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_DEFINE_GLOBAL:
+        return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return global_instruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_EQUAL:
+        return simple_instruction("OP_EQUAL", offset);
+    case OP_NOT_EQUAL:
+        return simple_instruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER:
+        return simple_instruction("OP_GREATER", offset);
+    case OP_GREATER_EQUAL:
+        return simple_instruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS:
+        return simple_instruction("OP_LESS", offset);
+    case OP_LESS_EQUAL:
+        return simple_instruction("OP_LESS_EQUAL", offset);
+    case OP_ADD:
+        return simple_instruction("OP_ADD", offset);
+    case OP_SUBTRACT:
+        return simple_instruction("OP_SUBTRACT", offset);
+    case OP_MULTIPLY:
+        return simple_instruction("OP_MULTIPLY", offset);
+    case OP_DIVIDE:
+        return simple_instruction("OP_DIVIDE", offset);
+    case OP_NOT:
+        return simple_instruction("OP_NOT", offset);
+    case OP_NEGATE:
+        return simple_instruction("OP_NEGATE", offset);
+    case OP_PRINT:
+        return simple_instruction("OP_PRINT", offset);
+    case OP_JUMP:
+        return jump_instruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jump_instruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_DEFINED:
+        return jump_instruction("OP_JUMP_IF_DEFINED", 1, chunk, offset);
+    case OP_LOOP:
+        return jump_instruction("OP_LOOP", -1, chunk, offset);
+    case OP_RETURN:
+        return simple_instruction("OP_RETURN", offset);
+    default:
+        printf("Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+}
+
+void disassemble_chunk(Chunk *chunk, const char *name)
+{
+    printf("== %s ==\n", name);
+    for (size_t offset = 0; offset < chunk->len_code;)
+    {
+        offset = disassemble_instruction(chunk, offset);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef __CHUNK__
+#define __CHUNK__
+
+#include "value.h"
+
+// Operands are stored big endian right after the opcode. Constants and
+// globals take a 16 bit index, locals an 8 bit stack slot and jumps a 16 bit
+// offset.
+typedef enum
+{
+    OP_CONSTANT,
+    OP_NIL,
+    OP_TRUE,
+    OP_FALSE,
+    OP_POP,
+    OP_POPN,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_GET_GLOBAL,
+    OP_DEFINE_GLOBAL,
+    OP_SET_GLOBAL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_NOT,
+    OP_NEGATE,
+    OP_PRINT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,     // leaves the condition on the stack (and/or)
+    OP_POP_JUMP_IF_FALSE, // pops the condition (if/while)
+    OP_JUMP_IF_DEFINED,   // leaves the value on the stack (cached invariants)
+    OP_LOOP,
+    OP_RETURN,
+} OpCode;
+
+typedef struct
+{
+    uint8_t *code;
+    int *lines;
+    size_t len_code;
+    size_t size_code;
+    Value *constants;
+    size_t len_constants;
+    size_t size_constants;
+    ObjString **global_names; // slot index -> variable name, for error messages
+    size_t len_globals;
+    size_t size_globals;
+    size_t max_stack; // deepest the value stack can get, computed by the compiler
+} Chunk;
+
+Chunk *init_chunk();
+void free_chunk(Chunk *chunk);
+void reset_chunk(Chunk *chunk);
+void write_chunk(Chunk *chunk, uint8_t byte, int line);
+size_t add_constant(Chunk *chunk, Value value);
+size_t add_global(Chunk *chunk, ObjString *name);
+void disassemble_chunk(Chunk *chunk, const char *name);
+
+#endif //__CHUNK__
@@ -0,0 +1,565 @@
+#include "closure.h"
+#include "environment.h"
+#include "gc.h"
+
+typedef struct
+{
+    Environment *env;
+    Environment *globals;
+    Arena *scratch; // partial concatenations, emptied after each statement
+    int error_code;
+} Runtime;
+
+typedef struct ExprClosure_ ExprClosure;
+typedef struct StmtClosure_ StmtClosure;
+typedef Value (*ExprFn)(ExprClosure *self, Runtime *rt);
+typedef void (*StmtFn)(StmtClosure *self, Runtime *rt);
+
+struct ExprClosure_
+{
+    ExprFn fn;
+    ExprClosure *left; // also the only operand of unary operators and assignments
+    ExprClosure *right;
+    Value value;     // literals
+    ObjString *name; // globals, looked up by name
+    int depth;
+    int slot; // local slot, or the globals table entry seen last
+};
+
+struct StmtClosure_
+{
+    StmtFn fn;
+    ExprClosure *expr;      // expression, initializer or condition
+    ExprClosure *increment; // for loops
+    StmtClosure *init;      // for loop initializer
+    StmtClosure *body;      // loop body or then branch
+    StmtClosure *other;     // else branch
+    StmtClosure **statements;
+    size_t len_statements;
+    size_t len_locals; // size of the environment a block or for loop creates
+    ObjString *name;
+    int slot;
+};
+
+struct ClosureEngine_
+{
+    Arena *arena; // the closures of the last run_closures call
+    Runtime rt;
+};
+
+#define EVAL(closure) ((closure)->fn((closure), rt))
+
+// The tree walker stops evaluating as soon as an error is set, so only the
+// first error is reported. The error paths here check for an earlier one
+// instead, which keeps the checks off the fast paths.
+static Value runtime_error(Runtime *rt, const char *message)
+{
+    if (rt->error_code == 0)
+    {
+        fprintf(stderr, "%s\n", message);
+        rt->error_code = 70;
+    }
+    return NIL_VAL;
+}
+
+static Value run_literal(ExprClosure *self, Runtime *rt)
+{
+    (void)rt;
+    return self->value;
+}
+
+static Value run_local(ExprClosure *self, Runtime *rt)
+{
+    return rt->env->slots[self->slot];
+}
+
+static Value run_enclosing_local(ExprClosure *self, Runtime *rt)
+{
+    return get_at_environment(rt->env, self->depth, self->slot);
+}
+
+static Value run_global(ExprClosure *self, Runtime *rt)
+{
+    if (rt->error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    return get_hinted_environment(rt->globals, self->name, &self->slot, &rt->error_code);
+}
+
+static Value run_assign_local(ExprClosure *self, Runtime *rt)
+{
+    Value value = EVAL(self->left);
+    if (rt->error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    assign_at_environment(rt->env, self->depth, self->slot, value);
+    return value;
+}
+
+static Value run_assign_global(ExprClosure *self, Runtime *rt)
+{
+    Value value = EVAL(self->left);
+    if (rt->error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    assign_environment(rt->globals, self->name, value, &rt->error_code);
+    return value;
+}
+
+static Value run_invariant(ExprClosure *self, Runtime *rt)
+{
+    Value value = get_at_environment(rt->env, self->depth, self->slot);
+    if (!IS_UNDEFINED(value))
+    {
+        return value;
+    }
+    value = EVAL(self->left);
+    if (rt->error_code == 0)
+    {
+        assign_at_environment(rt->env, self->depth, self->slot, value);
+    }
+    return value;
+}
+
+static Value run_not(ExprClosure *self, Runtime *rt)
+{
+    Value right = EVAL(self->left);
+    return rt->error_code != 0 ? NIL_VAL : BOOL_VAL(!is_truthy(right));
+}
+
+static Value run_negate(ExprClosure *self, Runtime *rt)
+{
+    Value right = EVAL(self->left);
+    if (IS_NUMBER(right))
+    {
+        return NUMBER_VAL(-AS_NUMBER(right));
+    }
+    return runtime_error(rt, "Operand must be a number.");
+}
+
+static Value run_or(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    if (rt->error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    return is_truthy(left) ? left : EVAL(self->right);
+}
+
+static Value run_and(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    if (rt->error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    return !is_truthy(left) ? left : EVAL(self->right);
+}
+
+static Value run_add(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    Value right = EVAL(self->right);
+    if (IS_NUMBER(left) && IS_NUMBER(right))
+    {
+        return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+    }
+    if (IS_STRING(left) && IS_STRING(right))
+    {
+        return concatenate_strings(left, right);
+    }
+    return runtime_error(rt, "Operands must be two numbers or two strings.");
+}
+
+// An addition whose result only an enclosing addition sees (see
+// concatenate_scratch), so strings are built in the scratch arena
+static Value run_add_operand(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    Value right = EVAL(self->right);
+    if (IS_NUMBER(left) && IS_NUMBER(right))
+    {
+        return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+    }
+    if (IS_STRING(left) && IS_STRING(right))
+    {
+        return concatenate_scratch(rt->scratch, left, right);
+    }
+    return runtime_error(rt, "Operands must be two numbers or two strings.");
+}
+
+static Value run_equal(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    Value right = EVAL(self->right);
+    return rt->error_code != 0 ? NIL_VAL : BOOL_VAL(values_equal(left, right));
+}
+
+static Value run_not_equal(ExprClosure *self, Runtime *rt)
+{
+    Value left = EVAL(self->left);
+    Value right = EVAL(self->right);
+    return rt->error_code != 0 ? NIL_VAL : BOOL_VAL(!values_equal(left, right));
+}
+
+#define NUMBER_BINARY(name, value_type, op)                                   \
+    static Value name(ExprClosure *self, Runtime *rt)                         \
+    {                                                                         \
+        Value left = EVAL(self->left);                                        \
+        Value right = EVAL(self->right);                                      \
+        if (IS_NUMBER(left) && IS_NUMBER(right))                              \
+        {                                                                     \
+            return value_type(AS_NUMBER(left) op AS_NUMBER(right));           \
+        }                                                                     \
+        return runtime_error(rt, "Operands must be numbers.");                \
+    }
+
+NUMBER_BINARY(run_subtract, NUMBER_VAL, -)
+NUMBER_BINARY(run_multiply, NUMBER_VAL, *)
+NUMBER_BINARY(run_divide, NUMBER_VAL, /)
+NUMBER_BINARY(run_less, BOOL_VAL, <)
+NUMBER_BINARY(run_less_equal, BOOL_VAL, <=)
+NUMBER_BINARY(run_greater, BOOL_VAL, >)
+NUMBER_BINARY(run_greater_equal, BOOL_VAL, >=)
+
+static void run_expression_statement(StmtClosure *self, Runtime *rt)
+{
+    EVAL(self->expr);
+}
+
+static void run_print(StmtClosure *self, Runtime *rt)
+{
+    Value value = EVAL(self->expr);
+    if (rt->error_code == 0)
+    {
+        print_value(value);
+    }
+}
+
+static void run_var_local(StmtClosure *self, Runtime *rt)
+{
+    rt->env->slots[self->slot] = EVAL(self->expr);
+}
+
+static void run_var_global(StmtClosure *self, Runtime *rt)
+{
+    Value value = EVAL(self->expr);
+    define_environment(rt->globals, self->name, value);
+}
+
+static void run_statements(StmtClosure **statements, size_t len_statements, Runtime *rt)
+{
+    for (size_t i = 0; i < len_statements && rt->error_code == 0; i++)
+    {
+        safepoint_environment(rt->env);
+        statements[i]->fn(statements[i], rt);
+        reset_arena(rt->scratch);
+    }
+}
+
+// Declares nothing, so it runs in the enclosing environment
+static void run_plain_block(StmtClosure *self, Runtime *rt)
+{
+    run_statements(self->statements, self->len_statements, rt);
+}
+
+static void run_block(StmtClosure *self, Runtime *rt)
+{
+    Environment *previous = rt->env;
+    rt->env = acquire_environment(previous, self->len_locals);
+    run_statements(self->statements, self->len_statements, rt);
+    release_environment(rt->env);
+    rt->env = previous;
+}
+
+static void run_if(StmtClosure *self, Runtime *rt)
+{
+    Value condition = EVAL(self->expr);
+    if (rt->error_code != 0)
+    {
+        return;
+    }
+    if (is_truthy(condition))
+    {
+        self->body->fn(self->body, rt);
+    }
+    else if (self->other != NULL)
+    {
+        self->other->fn(self->other, rt);
+    }
+}
+
+static void run_while(StmtClosure *self, Runtime *rt)
+{
+    ExprClosure *condition = self->expr;
+    StmtClosure *body = self->body;
+    while (is_truthy(condition->fn(condition, rt)) && rt->error_code == 0)
+    {
+        safepoint_environment(rt->env);
+        body->fn(body, rt);
+        reset_arena(rt->scratch);
+    }
+}
+
+static void run_for(StmtClosure *self, Runtime *rt)
+{
+    Environment *previous = rt->env;
+    if (self->len_locals > 0)
+    {
+        rt->env = acquire_environment(previous, self->len_locals);
+    }
+    if (self->init != NULL)
+    {
+        self->init->fn(self->init, rt);
+    }
+    ExprClosure *condition = self->expr;
+    ExprClosure *increment = self->increment;
+    StmtClosure *body = self->body;
+    while (rt->error_code == 0)
+    {
+        if (condition != NULL && !is_truthy(condition->fn(condition, rt)))
+        {
+            break;
+        }
+        safepoint_environment(rt->env);
+        body->fn(body, rt);
+        reset_arena(rt->scratch);
+        if (increment != NULL && rt->error_code == 0)
+        {
+            increment->fn(increment, rt);
+        }
+    }
+    if (rt->env != previous)
+    {
+        release_environment(rt->env);
+        rt->env = previous;
+    }
+}
+
+static ExprClosure *new_expr(ClosureEngine *engine, ExprFn fn)
+{
+    ExprClosure *closure = arena_alloc(engine->arena, sizeof(ExprClosure));
+    closure->fn = fn;
+    return closure;
+}
+
+static StmtClosure *new_stmt(ClosureEngine *engine, StmtFn fn)
+{
+    StmtClosure *closure = arena_alloc(engine->arena, sizeof(StmtClosure));
+    closure->fn = fn;
+    return closure;
+}
+
+static ExprFn binary_fn(TokenType operator)
+{
+    switch (operator)
+    {
+    case PLUS:
+        return run_add;
+    case MINUS:
+        return run_subtract;
+    case STAR:
+        return run_multiply;
+    case SLASH:
+        return run_divide;
+    case LESS:
+        return run_less;
+    case LESS_EQUAL:
+        return run_less_equal;
+    case GREATER:
+        return run_greater;
+    case GREATER_EQUAL:
+        return run_greater_equal;
+    case EQUAL_EQUAL:
+        return run_equal;
+    case BANG_EQUAL:
+        return run_not_equal;
+    case OR:
+        return run_or;
+    case AND:
+        return run_and;
+    default:
+        return NULL;
+    }
+}
+
+static ExprClosure *compile_expr(ClosureEngine *engine, Expression *expr)
+{
+    ExprClosure *closure;
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        closure = new_expr(engine, run_literal);
+        closure->value = expr->as.value;
+        return closure;
+    case EXPR_GROUPING:
+        return compile_expr(engine, expr->as.binary.left);
+    case EXPR_UNARY:
+        closure = new_expr(engine, expr->as.binary.operator->type == BANG ? run_not : run_negate);
+        closure->left = compile_expr(engine, expr->as.binary.right);
+        return closure;
+    case EXPR_BINARY:
+    {
+        ExprFn fn = binary_fn(expr->as.binary.operator->type);
+        if (fn == NULL)
+        {
+            break;
+        }
+        closure = new_expr(engine, fn);
+        closure->left = compile_expr(engine, expr->as.binary.left);
+        closure->right = compile_expr(engine, expr->as.binary.right);
+        if (fn == run_add)
+        {
+            closure->left->fn = closure->left->fn == run_add ? run_add_operand : closure->left->fn;
+            closure->right->fn = closure->right->fn == run_add ? run_add_operand : closure->right->fn;
+        }
+        return closure;
+    }
+    case EXPR_VARIABLE:
+        if (expr->as.variable.depth < 0)
+        {
+            closure = new_expr(engine, run_global);
+            closure->name = expr->as.variable.identifier;
+            return closure;
+        }
+        closure = new_expr(engine, expr->as.variable.depth == 0 ? run_local : run_enclosing_local);
+        closure->depth = expr->as.variable.depth;
+        closure->slot = expr->as.variable.slot;
+        return closure;
+    case EXPR_ASSIGN:
+        closure = new_expr(engine, expr->as.assign.depth < 0 ? run_assign_global : run_assign_local);
+        closure->left = compile_expr(engine, expr->as.assign.value);
+        closure->name = expr->as.assign.identifier;
+        closure->depth = expr->as.assign.depth;
+        closure->slot = expr->as.assign.slot;
+        return closure;
+    case EXPR_INVARIANT:
+        closure = new_expr(engine, run_invariant);
+        closure->left = compile_expr(engine, expr->as.invariant.expr);
+        closure->depth = expr->as.invariant.depth;
+        closure->slot = expr->as.invariant.slot;
+        return closure;
+    default:
+        break;
+    }
+    fprintf(stderr, "Compiling expression type %d not implemented\n", expr->type);
+    closure = new_expr(engine, run_literal);
+    closure->value = NIL_VAL;
+    return closure;
+}
+
+static StmtClosure *compile_stmt(ClosureEngine *engine, Statement *stmt)
+{
+    StmtClosure *closure;
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        closure = new_stmt(engine, run_expression_statement);
+        closure->expr = compile_expr(engine, stmt->data.expr.expression);
+        return closure;
+    case STMT_PRINT:
+        closure = new_stmt(engine, run_print);
+        closure->expr = compile_expr(engine, stmt->data.print.expression);
+        return closure;
+    case STMT_VAR:
+        closure = new_stmt(engine, stmt->data.var.slot >= 0 ? run_var_local : run_var_global);
+        closure->expr = compile_expr(engine, stmt->data.var.initializer);
+        closure->name = stmt->data.var.identifier;
+        closure->slot = stmt->data.var.slot;
+        return closure;
+    case STMT_BLOCK:
+    {
+        Block *blk = stmt->data.block;
+        closure = new_stmt(engine, blk->len_locals == 0 ? run_plain_block : run_block);
+        closure->statements = arena_alloc(engine->arena, blk->len_statements * sizeof(StmtClosure *));
+        closure->len_statements = blk->len_statements;
+        closure->len_locals = blk->len_locals;
+        for (size_t i = 0; i < blk->len_statements; i++)
+        {
+            closure->statements[i] = compile_stmt(engine, blk->statements[i]);
+        }
+        return closure;
+    }
+    case STMT_IF:
+        closure = new_stmt(engine, run_if);
+        closure->expr = compile_expr(engine, stmt->data.if_stmt.condition);
+        closure->body = compile_stmt(engine, stmt->data.if_stmt.thenBranch);
+        if (stmt->data.if_stmt.elseBranch != NULL)
+        {
+            closure->other = compile_stmt(engine, stmt->data.if_stmt.elseBranch);
+        }
+        return closure;
+    case STMT_WHILE:
+        closure = new_stmt(engine, run_while);
+        closure->expr = compile_expr(engine, stmt->data.while_stmt.condition);
+        closure->body = compile_stmt(engine, stmt->data.while_stmt.body);
+        return closure;
+    case STMT_FOR:
+        closure = new_stmt(engine, run_for);
+        if (stmt->data.for_stmt.initializer != NULL)
+        {
+            closure->init = compile_stmt(engine, stmt->data.for_stmt.initializer);
+        }
+        if (stmt->data.for_stmt.condition != NULL)
+        {
+            closure->expr = compile_expr(engine, stmt->data.for_stmt.condition);
+        }
+        if (stmt->data.for_stmt.increment != NULL)
+        {
+            closure->increment = compile_expr(engine, stmt->data.for_stmt.increment);
+        }
+        closure->body = compile_stmt(engine, stmt->data.for_stmt.body);
+        closure->len_locals = stmt->data.for_stmt.len_locals;
+        return closure;
+    default:
+        break;
+    }
+    fprintf(stderr, "Compiling statement type %d not implemented\n", stmt->type);
+    return new_stmt(engine, run_plain_block);
+}
+
+ClosureEngine *init_closure_engine()
+{
+    ClosureEngine *engine = calloc(1, sizeof(ClosureEngine));
+    engine->arena = init_arena();
+    engine->rt.globals = init_environment(NULL, 0);
+    engine->rt.env = engine->rt.globals;
+    engine->rt.scratch = init_arena();
+    return engine;
+}
+
+void free_closure_engine(ClosureEngine *engine)
+{
+    free_environment(engine->rt.globals);
+    engine->rt.globals = engine->rt.env = NULL;
+    free_environment_pool();
+    free_arena(engine->arena);
+    engine->arena = NULL;
+    free_arena(engine->rt.scratch);
+    engine->rt.scratch = NULL;
+    free(engine);
+}
+
+void run_closures(ClosureEngine *engine, Statement **statements, size_t len_statements, int *error_code)
+{
+    reset_arena(engine->arena);
+    StmtClosure **closures = arena_alloc(engine->arena, len_statements * sizeof(StmtClosure *));
+    for (size_t i = 0; i < len_statements; i++)
+    {
+        closures[i] = compile_stmt(engine, statements[i]);
+    }
+    engine->rt.error_code = *error_code;
+    run_statements(closures, len_statements, &engine->rt);
+    *error_code = engine->rt.error_code;
+}
+
+void interpret_closure(Statement **statements, size_t len_statements, int *error_code)
+{
+    ClosureEngine *engine = init_closure_engine();
+    run_closures(engine, statements, len_statements, error_code);
+    free_closure_engine(engine);
+}
@@ -0,0 +1,21 @@
+#ifndef __CLOSURE__
+#define __CLOSURE__
+
+#include "parser.h"
+
+// Third engine, between the tree walker and the VM: every node of a resolved
+// program is compiled into a closure, a struct holding the C function that
+// runs it and its operands already looked up (operator, slot, constant), so
+// running the program is a chain of indirect calls with no switch on node
+// types or tokens. Variables live in the same environments as with the tree
+// walker.
+typedef struct ClosureEngine_ ClosureEngine;
+
+ClosureEngine *init_closure_engine();
+void free_closure_engine(ClosureEngine *engine);
+// Compiles statements (which must have been resolved) and runs them. Globals
+// are kept from one call to the next, the compiled closures are not.
+void run_closures(ClosureEngine *engine, Statement **statements, size_t len_statements, int *error_code);
+void interpret_closure(Statement **statements, size_t len_statements, int *error_code);
+
+#endif //__CLOSURE__
@@ -0,0 +1,566 @@
+#include "compiler.h"
+
+#define LOCALS_MAX 256
+
+typedef struct
+{
+    ObjString *name;
+    int depth;
+} Local;
+
+struct Compiler_
+{
+    Chunk *chunk;
+    Local locals[LOCALS_MAX];
+    int len_locals;
+    int scope_depth;
+    size_t stack_depth;
+    // Open addressing table from global name to slot + 1, 0 marks an empty bucket
+    uint32_t *global_index;
+    size_t size_global_index;
+    int line;
+    int had_error;
+};
+
+static void compile_expression(Compiler *compiler, Expression *expr);
+static void compile_statement(Compiler *compiler, Statement *stmt);
+
+Compiler *init_compiler()
+{
+    Compiler *compiler = calloc(1, sizeof(Compiler));
+    compiler->chunk = init_chunk();
+    compiler->size_global_index = 64;
+    compiler->global_index = calloc(compiler->size_global_index, sizeof(uint32_t));
+    compiler->line = 1;
+    return compiler;
+}
+
+// Also frees the chunk, unless compile() handed it out
+void free_compiler(Compiler *compiler)
+{
+    if (compiler->chunk != NULL)
+    {
+        free_chunk(compiler->chunk);
+    }
+    free(compiler->global_index);
+    compiler->global_index = NULL;
+    free(compiler);
+}
+
+static void compile_error(Compiler *compiler, const char *message)
+{
+    fprintf(stderr, "[line %d] Error: %s\n", compiler->line, message);
+    compiler->had_error = 1;
+}
+
+static void adjust_stack(Compiler *compiler, int delta)
+{
+    compiler->stack_depth += delta;
+    if (compiler->stack_depth > compiler->chunk->max_stack)
+    {
+        compiler->chunk->max_stack = compiler->stack_depth;
+    }
+}
+
+static void emit_byte(Compiler *compiler, uint8_t byte)
+{
+    write_chunk(compiler->chunk, byte, compiler->line);
+}
+
+static void emit_short(Compiler *compiler, uint16_t operand)
+{
+    emit_byte(compiler, (operand >> 8) & 0xff);
+    emit_byte(compiler, operand & 0xff);
+}
+
+static void emit_constant(Compiler *compiler, Value value)
+{
+    size_t constant = add_constant(compiler->chunk, value);
+    if (constant > UINT16_MAX)
+    {
+        compile_error(compiler, "Too many constants in one chunk.");
+        return;
+    }
+    emit_byte(compiler, OP_CONSTANT);
+    emit_short(compiler, (uint16_t)constant);
+    adjust_stack(compiler, 1);
+}
+
+static size_t emit_jump(Compiler *compiler, uint8_t instruction)
+{
+    emit_byte(compiler, instruction);
+    emit_short(compiler, 0xffff);
+    return compiler->chunk->len_code - 2;
+}
+
+static void patch_jump(Compiler *compiler, size_t offset)
+{
+    size_t jump = compiler->chunk->len_code - offset - 2;
+    if (jump > UINT16_MAX)
+    {
+        compile_error(compiler, "Too much code to jump over.");
+        return;
+    }
+    compiler->chunk->code[offset] = (jump >> 8) & 0xff;
+    compiler->chunk->code[offset + 1] = jump & 0xff;
+}
+
+static void emit_loop(Compiler *compiler, size_t loop_start)
+{
+    emit_byte(compiler, OP_LOOP);
+    size_t offset = compiler->chunk->len_code - loop_start + 2;
+    if (offset > UINT16_MAX)
+    {
+        compile_error(compiler, "Loop body too large.");
+    }
+    emit_short(compiler, (uint16_t)offset);
+}
+
+static void grow_global_index(Compiler *compiler)
+{
+    size_t size = compiler->size_global_index * 2;
+    uint32_t *index = calloc(size, sizeof(uint32_t));
+    for (size_t slot = 0; slot < compiler->chunk->len_globals; slot++)
+    {
+        size_t bucket = compiler->chunk->global_names[slot]->hash & (size - 1);
+        while (index[bucket] != 0)
+        {
+            bucket = (bucket + 1) & (size - 1);
+        }
+        index[bucket] = slot + 1;
+    }
+    free(compiler->global_index);
+    compiler->global_index = index;
+    compiler->size_global_index = size;
+}
+
+// Globals live in a flat array in the VM, so every name is mapped to its slot
+// once here instead of being hashed on each access at runtime.
+static uint16_t resolve_global(Compiler *compiler, ObjString *name)
+{
+    size_t mask = compiler->size_global_index - 1;
+    size_t bucket = name->hash & mask;
+    while (compiler->global_index[bucket] != 0)
+    {
+        uint32_t slot = compiler->global_index[bucket] - 1;
+        if (compiler->chunk->global_names[slot] == name)
+        {
+            return (uint16_t)slot;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    size_t slot = add_global(compiler->chunk, name);
+    if (slot > UINT16_MAX)
+    {
+        compile_error(compiler, "Too many global variables.");
+        return 0;
+    }
+    compiler->global_index[bucket] = slot + 1;
+    if ((compiler->chunk->len_globals + 1) * 4 > compiler->size_global_index * 3)
+    {
+        grow_global_index(compiler);
+    }
+    return (uint16_t)slot;
+}
+
+static int resolve_local(Compiler *compiler, ObjString *name)
+{
+    for (int i = compiler->len_locals - 1; i >= 0; i--)
+    {
+        if (compiler->locals[i].name == name)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void begin_scope(Compiler *compiler)
+{
+    compiler->scope_depth++;
+}
+
+static void end_scope(Compiler *compiler)
+{
+    compiler->scope_depth--;
+    int popped = 0;
+    while (compiler->len_locals > 0 && compiler->locals[compiler->len_locals - 1].depth > compiler->scope_depth)
+    {
+        compiler->len_locals--;
+        popped++;
+    }
+    if (popped == 1)
+    {
+        emit_byte(compiler, OP_POP);
+    }
+    else if (popped > 1)
+    {
+        emit_byte(compiler, OP_POPN);
+        emit_byte(compiler, (uint8_t)popped);
+    }
+    adjust_stack(compiler, -popped);
+}
+
+static void compile_variable(Compiler *compiler, Token *name, ObjString *identifier, int is_assign)
+{
+    compiler->line = name->line;
+    int slot = resolve_local(compiler, identifier);
+    if (slot >= 0)
+    {
+        emit_byte(compiler, is_assign ? OP_SET_LOCAL : OP_GET_LOCAL);
+        emit_byte(compiler, (uint8_t)slot);
+    }
+    else
+    {
+        emit_byte(compiler, is_assign ? OP_SET_GLOBAL : OP_GET_GLOBAL);
+        emit_short(compiler, resolve_global(compiler, identifier));
+    }
+    if (!is_assign)
+    {
+        adjust_stack(compiler, 1);
+    }
+}
+
+static void compile_literal(Compiler *compiler, Expression *expr)
+{
+    // Literals are the only nodes a constant is made for
+    if (expr->as.line > 0)
+    {
+        compiler->line = expr->as.line;
+    }
+    Value value = expr->as.value;
+    if (IS_NIL(value))
+    {
+        emit_byte(compiler, OP_NIL);
+        adjust_stack(compiler, 1);
+    }
+    else if (IS_BOOL(value))
+    {
+        emit_byte(compiler, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+        adjust_stack(compiler, 1);
+    }
+    else
+    {
+        emit_constant(compiler, value);
+    }
+}
+
+static void compile_logical(Compiler *compiler, Expression *expr)
+{
+    compile_expression(compiler, expr->as.binary.left);
+    if (expr->as.binary.operator->type == OR)
+    {
+        size_t else_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+        size_t end_jump = emit_jump(compiler, OP_JUMP);
+        patch_jump(compiler, else_jump);
+        emit_byte(compiler, OP_POP);
+        adjust_stack(compiler, -1);
+        compile_expression(compiler, expr->as.binary.right);
+        patch_jump(compiler, end_jump);
+    }
+    else
+    {
+        size_t end_jump = emit_jump(compiler, OP_JUMP_IF_FALSE);
+        emit_byte(compiler, OP_POP);
+        adjust_stack(compiler, -1);
+        compile_expression(compiler, expr->as.binary.right);
+        patch_jump(compiler, end_jump);
+    }
+}
+
+static void compile_binary(Compiler *compiler, Expression *expr)
+{
+    TokenType operator = expr->as.binary.operator->type;
+    if (operator == OR || operator == AND)
+    {
+        compile_logical(compiler, expr);
+        return;
+    }
+    compile_expression(compiler, expr->as.binary.left);
+    compile_expression(compiler, expr->as.binary.right);
+    compiler->line = expr->as.binary.operator->line;
+    switch (operator)
+    {
+    case EQUAL_EQUAL:
+        emit_byte(compiler, OP_EQUAL);
+        break;
+    case BANG_EQUAL:
+        emit_byte(compiler, OP_NOT_EQUAL);
+        break;
+    case GREATER:
+        emit_byte(compiler, OP_GREATER);
+        break;
+    case GREATER_EQUAL:
+        emit_byte(compiler, OP_GREATER_EQUAL);
+        break;
+    case LESS:
+        emit_byte(compiler, OP_LESS);
+        break;
+    case LESS_EQUAL:
+        emit_byte(compiler, OP_LESS_EQUAL);
+        break;
+    case PLUS:
+        emit_byte(compiler, OP_ADD);
+        break;
+    case MINUS:
+        emit_byte(compiler, OP_SUBTRACT);
+        break;
+    case STAR:
+        emit_byte(compiler, OP_MULTIPLY);
+        break;
+    case SLASH:
+        emit_byte(compiler, OP_DIVIDE);
+        break;
+    default:
+        compile_error(compiler, "Unknown binary operator.");
+        break;
+    }
+    adjust_stack(compiler, -1);
+}
+
+// The value is cached in a hidden local declared in front of the loop, which
+// holds undefined until the expression first runs
+static void compile_invariant(Compiler *compiler, Expression *expr)
+{
+    int slot = resolve_local(compiler, expr->as.invariant.identifier);
+    if (slot < 0)
+    {
+        compile_error(compiler, "Invariant outside of its loop.");
+        return;
+    }
+    emit_byte(compiler, OP_GET_LOCAL);
+    emit_byte(compiler, (uint8_t)slot);
+    adjust_stack(compiler, 1);
+    size_t cached = emit_jump(compiler, OP_JUMP_IF_DEFINED);
+    emit_byte(compiler, OP_POP);
+    adjust_stack(compiler, -1);
+    compile_expression(compiler, expr->as.invariant.expr);
+    emit_byte(compiler, OP_SET_LOCAL);
+    emit_byte(compiler, (uint8_t)slot);
+    patch_jump(compiler, cached);
+}
+
+static void compile_expression(Compiler *compiler, Expression *expr)
+{
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        compile_literal(compiler, expr);
+        break;
+    case EXPR_BINARY:
+        compile_binary(compiler, expr);
+        break;
+    case EXPR_GROUPING:
+        compile_expression(compiler, expr->as.binary.left);
+        break;
+    case EXPR_UNARY:
+        compile_expression(compiler, expr->as.binary.right);
+        compiler->line = expr->as.binary.operator->line;
+        emit_byte(compiler, expr->as.binary.operator->type == BANG ? OP_NOT : OP_NEGATE);
+        break;
+    case EXPR_VARIABLE:
+        compile_variable(compiler, expr->as.variable.name, expr->as.variable.identifier, 0);
+        break;
+    case EXPR_ASSIGN:
+        compile_expression(compiler, expr->as.assign.value);
+        compile_variable(compiler, expr->as.assign.name, expr->as.assign.identifier, 1);
+        break;
+    case EXPR_INVARIANT:
+        compile_invariant(compiler, expr);
+        break;
+    default:
+        compile_error(compiler, "Unknown expression.");
+        break;
+    }
+}
+
+static void compile_var_statement(Compiler *compiler, Statement *stmt)
+{
+    Token *name = stmt->data.var.name;
+    ObjString *identifier = stmt->data.var.identifier;
+    // The initializer is compiled before the name is declared, so it still
+    // sees any outer variable of the same name like the tree walker does.
+    if (stmt->data.var.initializer != NULL)
+    {
+        compile_expression(compiler, stmt->data.var.initializer);
+    }
+    else
+    {
+        emit_byte(compiler, OP_NIL);
+        adjust_stack(compiler, 1);
+    }
+    compiler->line = name->line;
+    if (compiler->scope_depth == 0)
+    {
+        emit_byte(compiler, OP_DEFINE_GLOBAL);
+        emit_short(compiler, resolve_global(compiler, identifier));
+        adjust_stack(compiler, -1);
+        return;
+    }
+    for (int i = compiler->len_locals - 1; i >= 0 && compiler->locals[i].depth == compiler->scope_depth; i--)
+    {
+        if (compiler->locals[i].name == identifier)
+        {
+            // Redeclaring in the same block overwrites, as define_environment does
+            emit_byte(compiler, OP_SET_LOCAL);
+            emit_byte(compiler, (uint8_t)i);
+            emit_byte(compiler, OP_POP);
+            adjust_stack(compiler, -1);
+            return;
+        }
+    }
+    if (compiler->len_locals >= LOCALS_MAX)
+    {
+        compile_error(compiler, "Too many local variables in scope at once.");
+        return;
+    }
+    // The initializer's value is already sitting in the new local's stack slot
+    compiler->locals[compiler->len_locals].name = identifier;
+    compiler->locals[compiler->len_locals].depth = compiler->scope_depth;
+    compiler->len_locals++;
+}
+
+static void compile_block(Compiler *compiler, Block *blk)
+{
+    begin_scope(compiler);
+    for (size_t i = 0; i < blk->len_statements; i++)
+    {
+        compile_statement(compiler, blk->statements[i]);
+    }
+    end_scope(compiler);
+}
+
+static void compile_if_statement(Compiler *compiler, Statement *stmt)
+{
+    compile_expression(compiler, stmt->data.if_stmt.condition);
+    size_t then_jump = emit_jump(compiler, OP_POP_JUMP_IF_FALSE);
+    adjust_stack(compiler, -1);
+    compile_statement(compiler, stmt->data.if_stmt.thenBranch);
+    if (stmt->data.if_stmt.elseBranch != NULL)
+    {
+        size_t else_jump = emit_jump(compiler, OP_JUMP);
+        patch_jump(compiler, then_jump);
+        compile_statement(compiler, stmt->data.if_stmt.elseBranch);
+        patch_jump(compiler, else_jump);
+    }
+    else
+    {
+        patch_jump(compiler, then_jump);
+    }
+}
+
+static void compile_while_statement(Compiler *compiler, Statement *stmt)
+{
+    size_t loop_start = compiler->chunk->len_code;
+    compile_expression(compiler, stmt->data.while_stmt.condition);
+    size_t exit_jump = emit_jump(compiler, OP_POP_JUMP_IF_FALSE);
+    adjust_stack(compiler, -1);
+    compile_statement(compiler, stmt->data.while_stmt.body);
+    emit_loop(compiler, loop_start);
+    patch_jump(compiler, exit_jump);
+}
+
+// Compiled as the while loop it stands for, inside a scope holding the
+// initializer's variable
+static void compile_for_statement(Compiler *compiler, Statement *stmt)
+{
+    begin_scope(compiler);
+    if (stmt->data.for_stmt.initializer != NULL)
+    {
+        compile_statement(compiler, stmt->data.for_stmt.initializer);
+    }
+    size_t loop_start = compiler->chunk->len_code;
+    size_t exit_jump = 0;
+    if (stmt->data.for_stmt.condition != NULL)
+    {
+        compile_expression(compiler, stmt->data.for_stmt.condition);
+        exit_jump = emit_jump(compiler, OP_POP_JUMP_IF_FALSE);
+        adjust_stack(compiler, -1);
+    }
+    compile_statement(compiler, stmt->data.for_stmt.body);
+    if (stmt->data.for_stmt.increment != NULL)
+    {
+        compile_expression(compiler, stmt->data.for_stmt.increment);
+        emit_byte(compiler, OP_POP);
+        adjust_stack(compiler, -1);
+    }
+    emit_loop(compiler, loop_start);
+    if (stmt->data.for_stmt.condition != NULL)
+    {
+        patch_jump(compiler, exit_jump);
+    }
+    end_scope(compiler);
+}
+
+static void compile_statement(Compiler *compiler, Statement *stmt)
+{
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        compile_expression(compiler, stmt->data.expr.expression);
+        emit_byte(compiler, OP_POP);
+        adjust_stack(compiler, -1);
+        break;
+    case STMT_PRINT:
+        compile_expression(compiler, stmt->data.print.expression);
+        emit_byte(compiler, OP_PRINT);
+        adjust_stack(compiler, -1);
+        break;
+    case STMT_VAR:
+        compile_var_statement(compiler, stmt);
+        break;
+    case STMT_BLOCK:
+        compile_block(compiler, stmt->data.block);
+        break;
+    case STMT_IF:
+        compile_if_statement(compiler, stmt);
+        break;
+    case STMT_WHILE:
+        compile_while_statement(compiler, stmt);
+        break;
+    case STMT_FOR:
+        compile_for_statement(compiler, stmt);
+        break;
+    default:
+        compile_error(compiler, "Unknown statement.");
+        break;
+    }
+}
+
+Chunk *compile(Statement **statements, size_t len_statements, int *error_code)
+{
+    Compiler *compiler = init_compiler();
+    for (size_t i = 0; i < len_statements && !compiler->had_error; i++)
+    {
+        compile_statement(compiler, statements[i]);
+    }
+    emit_byte(compiler, OP_RETURN);
+
+    Chunk *chunk = compiler->chunk;
+    if (compiler->had_error)
+    {
+        *error_code = 65;
+        free_chunk(chunk);
+        chunk = NULL;
+    }
+    compiler->chunk = NULL;
+    free_compiler(compiler);
+    return chunk;
+}
+
+// Compiles one top-level statement into the compiler's chunk, replacing the
+// code of the previous one. Global slots are kept across calls so a VM can
+// run the chunks one after the other. The chunk stays owned by the compiler.
+Chunk *compile_declaration(Compiler *compiler, Statement *stmt, int *error_code)
+{
+    reset_chunk(compiler->chunk);
+    compiler->stack_depth = 0;
+    compile_statement(compiler, stmt);
+    emit_byte(compiler, OP_RETURN);
+    if (compiler->had_error)
+    {
+        *error_code = 65;
+        return NULL;
+    }
+    return compiler->chunk;
+}
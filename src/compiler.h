@@ -0,0 +1,14 @@
+#ifndef __COMPILER__
+#define __COMPILER__
+
+#include "parser.h"
+#include "chunk.h"
+
+typedef struct Compiler_ Compiler;
+
+Chunk *compile(Statement **statements, size_t len_statements, int *error_code);
+Compiler *init_compiler();
+void free_compiler(Compiler *compiler);
+Chunk *compile_declaration(Compiler *compiler, Statement *stmt, int *error_code);
+
+#endif //__COMPILER__
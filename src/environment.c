@@ -2,131 +2,165 @@
 
 #include "environment.h"
 
-EnvironmentNode *init_environment_node(char *name, Literal *value)
+#define ENVIRONMENT_MIN_SIZE 8
+
+// Released block environments, chained through enclosing
+static Environment *environment_pool = NULL;
+
+Environment *init_environment(Environment *enclosing, size_t len_slots)
 {
-    EnvironmentNode *new = calloc(1, sizeof(EnvironmentNode));
-    new->key = name;
-    new->value = value;
-    new->next = NULL;
-    return new;
+    Environment *env = calloc(1, sizeof(Environment));
+    env->enclosing = enclosing;
+    env->len_slots = env->size_slots = len_slots;
+    if (len_slots > 0)
+    {
+        env->slots = malloc(len_slots * sizeof(Value));
+        for (size_t i = 0; i < len_slots; i++)
+        {
+            env->slots[i] = NIL_VAL;
+        }
+    }
+    return env;
 }
 
-void free_environment_node(EnvironmentNode *node)
+void free_environment(Environment *env)
 {
-    // free(node->key);
-    // node->key = NULL;
-    Literal *lit = node->value;
-    if (lit->token_type == STRING)
+    free(env->slots);
+    env->slots = NULL;
+    free(env->entries);
+    env->entries = NULL;
+    free(env);
+}
+
+// Block environments never outlive their block, so instead of being freed
+// they go back to a pool and the next block reuses them, slots included.
+Environment *acquire_environment(Environment *enclosing, size_t len_slots)
+{
+    Environment *env = environment_pool;
+    if (env == NULL)
+    {
+        return init_environment(enclosing, len_slots);
+    }
+    environment_pool = env->enclosing;
+    if (env->size_slots < len_slots)
     {
-        free(lit->data.string);
-        lit->data.string = NULL;
+        env->slots = realloc(env->slots, len_slots * sizeof(Value));
+        env->size_slots = len_slots;
     }
-    if (lit->token_type == NUMBER)
+    env->enclosing = enclosing;
+    env->len_slots = len_slots;
+    for (size_t i = 0; i < len_slots; i++)
     {
-        free(lit->data.number);
-        lit->data.number = NULL;
+        env->slots[i] = NIL_VAL;
     }
-    free(node);
-    node = NULL;
+    return env;
 }
 
-Environment *init_environment(Environment *enclosing)
+void release_environment(Environment *env)
 {
-    Environment *env = calloc(1, sizeof(Environment));
-    env->nodes = calloc(ENVIRONMENT_SIZE, sizeof(EnvironmentNode *));
-    env->enclosing = enclosing;
-    return env;
+    env->enclosing = environment_pool;
+    environment_pool = env;
 }
 
-void free_environment(Environment *env)
+void free_environment_pool()
 {
-    for (size_t i = 0; i < ENVIRONMENT_SIZE; i++)
+    while (environment_pool != NULL)
     {
-        if (env->nodes[i] != NULL)
-        {
-            EnvironmentNode *tmp, *head = env->nodes[i];
-            while (head != NULL)
-            {
-                tmp = head;
-                head = head->next;
-                free_environment_node(tmp);
-                tmp = NULL;
-            }
-        }
+        Environment *next = environment_pool->enclosing;
+        free_environment(environment_pool);
+        environment_pool = next;
     }
-    free(env->nodes);
-    env->nodes = NULL;
-    free(env);
-    env = NULL;
 }
 
-size_t hash(char *str)
+// Returns the entry holding name, or the empty one where it would go
+static inline EnvironmentEntry *find_entry(EnvironmentEntry *entries, size_t size, ObjString *name, uint32_t hash)
 {
-    size_t hash = 5381;
-    int c;
-
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-
-    return hash;
+    size_t mask = size - 1;
+    size_t index = hash & mask;
+    while (entries[index].key != name && entries[index].key != NULL)
+    {
+        index = (index + 1) & mask;
+    }
+    return &entries[index];
 }
 
-EnvironmentNode *get_node_environment(Environment *env, size_t idx)
+static void grow_environment(Environment *env)
 {
-    return env->nodes[idx];
+    size_t size = env->size_entries == 0 ? ENVIRONMENT_MIN_SIZE : env->size_entries * 2;
+    EnvironmentEntry *entries = calloc(size, sizeof(EnvironmentEntry));
+    for (size_t i = 0; i < env->size_entries; i++)
+    {
+        EnvironmentEntry *entry = &env->entries[i];
+        if (entry->key != NULL)
+        {
+            *find_entry(entries, size, entry->key, entry->hash) = *entry;
+        }
+    }
+    free(env->entries);
+    env->entries = entries;
+    env->size_entries = size;
 }
 
-void put_environment(Environment *env, char *name, Literal *value)
+static inline EnvironmentEntry *lookup_environment(Environment *env, ObjString *name)
 {
-    size_t idx = hash(name) % ENVIRONMENT_SIZE;
-    EnvironmentNode *current = env->nodes[idx];
-    while (current != NULL)
+    if (env->len_entries == 0)
     {
-        if (strcmp(current->key, name) == 0)
-        {
-            current->value = value;
-            return;
-        }
-        current = current->next;
+        return NULL;
     }
-    // append at the end
-    EnvironmentNode *new = init_environment_node(name, value);
-    new->next = env->nodes[idx];
-    env->nodes[idx] = new;
+    EnvironmentEntry *entry = find_entry(env->entries, env->size_entries, name, name->hash);
+    return entry->key == NULL ? NULL : entry;
 }
 
-Literal *get_environment(Environment *env, char *name, int *error_code)
+Value get_environment(Environment *env, ObjString *name, int *error_code)
 {
-    size_t idx = hash(name) % ENVIRONMENT_SIZE;
-    EnvironmentNode *current = env->nodes[idx];
-    while (current != NULL)
+    EnvironmentEntry *entry = lookup_environment(env, name);
+    if (entry != NULL)
     {
-        if (strcmp(current->key, name) == 0)
-        {
-            return current->value;
-        }
-        current = current->next;
+        return entry->value;
     }
     if (env->enclosing != NULL)
     {
         return get_environment(env->enclosing, name, error_code);
     }
     *error_code = 70;
-    fprintf(stderr, "Undefined variable '%s'.\n", name);
-    return NULL;
+    fprintf(stderr, "Undefined variable '%s'.\n", name->chars);
+    return NIL_VAL;
 }
 
-void assign_environment(Environment *env, Token *name, Literal *value, int *error_code)
+// Globals table only. *hint is the index name was found at last time. Entries
+// only move when the table grows, and keys are interned, so the key at the
+// hinted index being name is enough to know the hint still holds.
+Value get_hinted_environment(Environment *env, ObjString *name, int *hint, int *error_code)
 {
-    size_t idx = hash(name->lexeme) % ENVIRONMENT_SIZE;
-    EnvironmentNode *current = env->nodes[idx];
-    while (current != NULL)
+    size_t index = (size_t)*hint;
+    if (index < env->size_entries && env->entries[index].key == name)
     {
-        if (strcmp(current->key, name->lexeme) == 0)
-        {
-            current->value = value;
-            return;
-        }
+        return env->entries[index].value;
+    }
+    EnvironmentEntry *entry = lookup_environment(env, name);
+    if (entry == NULL)
+    {
+        return get_environment(env, name, error_code);
+    }
+    *hint = (int)(entry - env->entries);
+    return entry->value;
+}
+
+// Globals table only. Where name's value is stored, or NULL when it is not
+// defined. The address holds until the next definition grows the table.
+Value *address_environment(Environment *env, ObjString *name)
+{
+    EnvironmentEntry *entry = lookup_environment(env, name);
+    return entry == NULL ? NULL : &entry->value;
+}
+
+void assign_environment(Environment *env, ObjString *name, Value value, int *error_code)
+{
+    EnvironmentEntry *entry = lookup_environment(env, name);
+    if (entry != NULL)
+    {
+        entry->value = value;
+        return;
     }
     if (env->enclosing != NULL)
     {
@@ -134,10 +168,33 @@ void assign_environment(Environment *env, Token *name, Literal *value, int *erro
         return;
     }
     *error_code = 70;
-    fprintf(stderr, "Undefined variable '%s'.\n", name->lexeme);
+    fprintf(stderr, "Undefined variable '%s'.\n", name->chars);
 }
 
-void define_environment(Environment *env, char *name, Literal *value)
+// Redefining a global only overwrites its value, the table grows for new
+// names only
+void define_environment(Environment *env, ObjString *name, Value value)
 {
-    put_environment(env, name, value);
+    EnvironmentEntry *entry = lookup_environment(env, name);
+    if (entry == NULL)
+    {
+        if ((env->len_entries + 1) * 4 > env->size_entries * 3)
+        {
+            grow_environment(env);
+        }
+        entry = find_entry(env->entries, env->size_entries, name, name->hash);
+        entry->key = name;
+        entry->hash = name->hash;
+        env->len_entries++;
+    }
+    entry->value = value;
+}
+
+Environment *ancestor_environment(Environment *env, int depth)
+{
+    for (int i = 0; i < depth; i++)
+    {
+        env = env->enclosing;
+    }
+    return env;
 }
\ No newline at end of file
@@ -3,25 +3,50 @@
 
 #include "parser.h"
 
-#define ENVIRONMENT_SIZE 128
-
-typedef struct EnvironmentNode_
+// Globals live in an open addressing table. Keys are interned, so they are
+// compared by pointer, and each entry keeps a copy of its key's hash so that
+// growing the table never has to touch the strings.
+typedef struct
 {
-    char *key;
-    Literal *value;
-    struct EnvironmentNode_ *next;
-} EnvironmentNode;
+    ObjString *key; // NULL for an empty entry
+    uint32_t hash;
+    Value value;
+} EnvironmentEntry;
 
+// Block scopes keep their variables in a flat array indexed by the slots the
+// resolver assigned. Only the global scope is keyed by name, its table is
+// allocated small on the first definition and doubles past 3/4 full.
 typedef struct Environment_
 {
     struct Environment_ *enclosing;
-    EnvironmentNode **nodes; // array of EnvironmentNode*
+    EnvironmentEntry *entries;
+    size_t len_entries;
+    size_t size_entries; // a power of two
+    Value *slots;
+    size_t len_slots;
+    size_t size_slots;
 } Environment;
 
-Environment *init_environment(Environment *enclosing);
-void define_environment(Environment *env, char *name, Literal *value);
-Literal *get_environment(Environment *env, char *name, int *error_code);
+Environment *init_environment(Environment *enclosing, size_t len_slots);
+void define_environment(Environment *env, ObjString *name, Value value);
+Value get_environment(Environment *env, ObjString *name, int *error_code);
+Value get_hinted_environment(Environment *env, ObjString *name, int *hint, int *error_code);
+Value *address_environment(Environment *env, ObjString *name);
 void free_environment(Environment *env);
-void assign_environment(Environment *env, Token *name, Literal *value, int *error_code);
+Environment *acquire_environment(Environment *enclosing, size_t len_slots);
+void release_environment(Environment *env);
+void free_environment_pool();
+void assign_environment(Environment *env, ObjString *name, Value value, int *error_code);
+Environment *ancestor_environment(Environment *env, int depth);
+
+static inline Value get_at_environment(Environment *env, int depth, int slot)
+{
+    return ancestor_environment(env, depth)->slots[slot];
+}
+
+static inline void assign_at_environment(Environment *env, int depth, int slot, Value value)
+{
+    ancestor_environment(env, depth)->slots[slot] = value;
+}
 
 #endif //__ENVIRONMENT__
\ No newline at end of file
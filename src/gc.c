@@ -0,0 +1,411 @@
+#include <time.h>
+
+#include "gc.h"
+
+// The mature space is collected no more often than once per this many bytes
+#define GC_MIN_MATURE_THRESHOLD (1024 * 1024)
+
+typedef struct
+{
+    size_t minor_collections;
+    size_t major_collections;
+    double total_pause; // seconds
+    double max_pause;
+    size_t bytes_allocated; // by collected strings, wherever they went
+    size_t bytes_collected;
+    size_t bytes_promoted; // copied from the nursery to the mature space
+} GcStats;
+
+int gc_requested = 0;
+
+static size_t nursery_size = GC_DEFAULT_NURSERY_SIZE;
+static double heap_growth = GC_DEFAULT_HEAP_GROWTH;
+
+static char *nursery = NULL; // allocated on the first young string
+static size_t nursery_used = 0;
+
+// Mature objects, including the ones made permanent since they got there
+static Obj *mature_objects = NULL;
+static Obj *permanent_objects = NULL;
+static size_t mature_bytes = 0; // the collectable part
+static size_t mature_threshold = GC_MIN_MATURE_THRESHOLD;
+
+static GcStats stats;
+
+// Objects whose fields still have to be visited: ropes copied out of the
+// nursery, or marked, and mature ropes pointing into the nursery
+static Obj **gray = NULL;
+static size_t len_gray = 0;
+static size_t size_gray = 0;
+static Obj **remembered = NULL;
+static size_t len_remembered = 0;
+static size_t size_remembered = 0;
+
+void configure_gc(size_t nursery, double growth)
+{
+    nursery_size = nursery;
+    heap_growth = growth;
+}
+
+static void push_object(Obj ***objects, size_t *len, size_t *size, Obj *object)
+{
+    if (*len == *size)
+    {
+        *size = *size == 0 ? 256 : *size * 2;
+        *objects = realloc(*objects, *size * sizeof(Obj *));
+    }
+    (*objects)[(*len)++] = object;
+}
+
+static int is_rope(ObjString *string)
+{
+    return string->chars == NULL;
+}
+
+// Header and chars, rounded so the next nursery object stays aligned
+static size_t string_size(size_t length)
+{
+    return (sizeof(ObjString) + length + 1 + 7) & ~(size_t)7;
+}
+
+static size_t object_size(ObjString *string)
+{
+    return is_rope(string) ? sizeof(ObjString) : string_size(string->length);
+}
+
+// Bumps the object into the nursery when space asks for it and it fits,
+// otherwise links it into its space's list. Sets space to where it went.
+static ObjString *allocate_object(size_t size, ObjSpace *space)
+{
+    if (*space == SPACE_NURSERY)
+    {
+        stats.bytes_allocated += size;
+        // A big string would fill the nursery for little gain
+        if (size <= nursery_size / 4)
+        {
+            if (nursery == NULL)
+            {
+                nursery = malloc(nursery_size);
+            }
+            if (nursery_used + size <= nursery_size)
+            {
+                ObjString *string = (ObjString *)(nursery + nursery_used);
+                nursery_used += size;
+                string->obj.next = NULL;
+                return string;
+            }
+            // Full: the object goes straight to the mature space until the
+            // next safepoint empties the nursery
+            gc_requested = 1;
+        }
+        *space = SPACE_MATURE;
+    }
+
+    ObjString *string = malloc(size);
+    if (*space == SPACE_PERMANENT)
+    {
+        string->obj.next = permanent_objects;
+        permanent_objects = (Obj *)string;
+        return string;
+    }
+    string->obj.next = mature_objects;
+    mature_objects = (Obj *)string;
+    mature_bytes += size;
+    if (mature_bytes > mature_threshold)
+    {
+        gc_requested = 1;
+    }
+    return string;
+}
+
+static void init_object(ObjString *string, ObjSpace space, size_t length)
+{
+    string->obj.type = OBJ_STRING;
+    string->obj.space = space;
+    string->obj.marked = 0;
+    string->obj.remembered = 0;
+    string->length = length;
+    string->hash = 0;
+    string->left = string->right = NULL;
+}
+
+ObjString *allocate_string_object(size_t length, ObjSpace space)
+{
+    ObjString *string = allocate_object(string_size(length), &space);
+    init_object(string, space, length);
+    string->chars = (char *)(string + 1);
+    return string;
+}
+
+ObjString *allocate_rope_object(ObjString *left, ObjString *right)
+{
+    ObjSpace space = SPACE_NURSERY;
+    ObjString *rope = allocate_object(sizeof(ObjString), &space);
+    init_object(rope, space, left->length + right->length);
+    rope->chars = NULL;
+    rope->left = left;
+    rope->right = right;
+    write_barrier(rope, left);
+    write_barrier(rope, right);
+    return rope;
+}
+
+void write_barrier(ObjString *holder, ObjString *target)
+{
+    if (holder->obj.space != SPACE_NURSERY && target->obj.space == SPACE_NURSERY && !holder->obj.remembered)
+    {
+        holder->obj.remembered = 1;
+        push_object(&remembered, &len_remembered, &size_remembered, (Obj *)holder);
+    }
+}
+
+ObjString *make_permanent(ObjString *string)
+{
+    if (is_rope(string))
+    {
+        return make_permanent(flatten_string(string));
+    }
+    if (string->obj.space == SPACE_MATURE)
+    {
+        string->obj.space = SPACE_PERMANENT;
+        mature_bytes -= string_size(string->length);
+    }
+    else if (string->obj.space == SPACE_NURSERY)
+    {
+        // The values still pointing at the nursery string are redirected by
+        // the collection, which has to happen before they are compared
+        ObjString *copy = allocate_string_object(string->length, SPACE_PERMANENT);
+        memcpy(copy->chars, string->chars, string->length + 1);
+        copy->hash = string->hash;
+        string->obj.next = (Obj *)copy;
+        replace_interned_string(string, copy);
+        gc_requested = 1;
+        return copy;
+    }
+    return string;
+}
+
+static void visit_roots(const GcRoots *roots, void (*visit)(ObjString **string))
+{
+    for (Environment *env = roots->env; env != NULL; env = env->enclosing)
+    {
+        for (size_t i = 0; i < env->len_slots; i++)
+        {
+            if (IS_OBJ(env->slots[i]))
+            {
+                ObjString *string = AS_STRING(env->slots[i]);
+                visit(&string);
+                env->slots[i] = OBJ_VAL(string);
+            }
+        }
+        for (size_t i = 0; env->entries != NULL && i < env->size_entries; i++)
+        {
+            if (env->entries[i].key != NULL && IS_OBJ(env->entries[i].value))
+            {
+                ObjString *string = AS_STRING(env->entries[i].value);
+                visit(&string);
+                env->entries[i].value = OBJ_VAL(string);
+            }
+        }
+    }
+    Value *ranges[] = {roots->stack, roots->globals};
+    size_t lengths[] = {roots->len_stack, roots->len_globals};
+    for (int range = 0; range < 2; range++)
+    {
+        for (size_t i = 0; i < lengths[range]; i++)
+        {
+            if (IS_OBJ(ranges[range][i]))
+            {
+                ObjString *string = AS_STRING(ranges[range][i]);
+                visit(&string);
+                ranges[range][i] = OBJ_VAL(string);
+            }
+        }
+    }
+}
+
+// Visits the halves of every gray rope, which may make more ropes gray
+static void drain_gray(void (*visit)(ObjString **string))
+{
+    while (len_gray > 0)
+    {
+        ObjString *rope = (ObjString *)gray[--len_gray];
+        visit(&rope->left);
+        if (rope->right != NULL)
+        {
+            visit(&rope->right);
+        }
+    }
+}
+
+// Copies a reachable nursery object out, once, and points the reference at
+// the copy
+static void evacuate(ObjString **reference)
+{
+    ObjString *string = *reference;
+    if (string->obj.space != SPACE_NURSERY)
+    {
+        return;
+    }
+    if (string->obj.next == NULL)
+    {
+        size_t size = object_size(string);
+        ObjSpace space = SPACE_MATURE;
+        ObjString *copy = allocate_object(size, &space);
+        Obj *next = copy->obj.next;
+        memcpy(copy, string, size);
+        copy->obj.space = SPACE_MATURE;
+        copy->obj.next = next;
+        if (is_rope(copy))
+        {
+            push_object(&gray, &len_gray, &size_gray, (Obj *)copy);
+        }
+        else
+        {
+            copy->chars = (char *)(copy + 1);
+        }
+        string->obj.next = (Obj *)copy;
+        stats.bytes_promoted += size;
+    }
+    *reference = (ObjString *)string->obj.next;
+}
+
+static void collect_nursery(const GcRoots *roots)
+{
+    for (size_t i = 0; i < len_remembered; i++)
+    {
+        ObjString *rope = (ObjString *)remembered[i];
+        rope->obj.remembered = 0;
+        push_object(&gray, &len_gray, &size_gray, (Obj *)rope);
+    }
+    len_remembered = 0;
+    visit_roots(roots, evacuate);
+    drain_gray(evacuate);
+
+    // Every nursery string is interned, under its old address
+    size_t offset = 0;
+    while (offset < nursery_used)
+    {
+        ObjString *string = (ObjString *)(nursery + offset);
+        size_t size = object_size(string);
+        if (!is_rope(string))
+        {
+            replace_interned_string(string, (ObjString *)string->obj.next);
+        }
+        if (string->obj.next == NULL)
+        {
+            stats.bytes_collected += size;
+        }
+        offset += size;
+    }
+    nursery_used = 0;
+    stats.minor_collections++;
+}
+
+static void mark(ObjString **reference)
+{
+    ObjString *string = *reference;
+    if (string->obj.space == SPACE_MATURE && !string->obj.marked)
+    {
+        string->obj.marked = 1;
+        if (is_rope(string))
+        {
+            push_object(&gray, &len_gray, &size_gray, (Obj *)string);
+        }
+    }
+}
+
+static void collect_mature(const GcRoots *roots)
+{
+    visit_roots(roots, mark);
+    drain_gray(mark);
+    Obj **link = &mature_objects;
+    while (*link != NULL)
+    {
+        Obj *object = *link;
+        if (object->space == SPACE_MATURE && !object->marked)
+        {
+            ObjString *string = (ObjString *)object;
+            size_t size = object_size(string);
+            *link = object->next;
+            if (!is_rope(string))
+            {
+                replace_interned_string(string, NULL);
+            }
+            mature_bytes -= size;
+            stats.bytes_collected += size;
+            free(object);
+            continue;
+        }
+        object->marked = 0;
+        link = &object->next;
+    }
+    mature_threshold = (size_t)(mature_bytes * heap_growth);
+    if (mature_threshold < GC_MIN_MATURE_THRESHOLD)
+    {
+        mature_threshold = GC_MIN_MATURE_THRESHOLD;
+    }
+    stats.major_collections++;
+}
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void collect_garbage(const GcRoots *roots)
+{
+    double start = now();
+    if (nursery_used > 0)
+    {
+        collect_nursery(roots);
+    }
+    if (mature_bytes > mature_threshold)
+    {
+        collect_mature(roots);
+    }
+    gc_requested = 0;
+    double pause = now() - start;
+    stats.total_pause += pause;
+    if (pause > stats.max_pause)
+    {
+        stats.max_pause = pause;
+    }
+}
+
+void print_gc_stats(FILE *out)
+{
+    double mb = 1024.0 * 1024.0;
+    fprintf(out, "gc: %zu minor, %zu major collections, %.3f ms paused (longest %.3f ms)\n",
+            stats.minor_collections, stats.major_collections, stats.total_pause * 1e3, stats.max_pause * 1e3);
+    fprintf(out, "gc: %.2f MB allocated, %.2f MB collected, %.2f MB promoted, %.2f MB in the mature space\n",
+            stats.bytes_allocated / mb, stats.bytes_collected / mb, stats.bytes_promoted / mb, mature_bytes / mb);
+}
+
+static void free_object_list(Obj *object)
+{
+    while (object != NULL)
+    {
+        Obj *next = object->next;
+        free(object);
+        object = next;
+    }
+}
+
+void free_heap()
+{
+    free_object_list(mature_objects);
+    free_object_list(permanent_objects);
+    mature_objects = permanent_objects = NULL;
+    free(nursery);
+    nursery = NULL;
+    free(gray);
+    free(remembered);
+    gray = remembered = NULL;
+    len_gray = size_gray = len_remembered = size_remembered = 0;
+    nursery_used = mature_bytes = 0;
+    mature_threshold = GC_MIN_MATURE_THRESHOLD;
+    gc_requested = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef __GC__
+#define __GC__
+
+#include "environment.h"
+
+#define GC_DEFAULT_NURSERY_SIZE (1024 * 1024)
+#define GC_DEFAULT_HEAP_GROWTH 2.0
+
+// Strings made while a program runs (by concatenation, ropes included) are
+// garbage collected, the ones the scanner and parser make live until exit.
+// New strings are bumped into a fixed nursery. When it is full the engines
+// collect at their next safepoint: the nursery strings still reachable from
+// the roots are copied to the mature space, the rest are dropped all at
+// once. The mature space is marked and swept once it outgrows what survived
+// its last collection by the heap growth factor.
+typedef enum
+{
+    SPACE_PERMANENT, // scanned and parsed strings, never collected
+    SPACE_MATURE,
+    SPACE_NURSERY,
+    SPACE_SCRATCH, // partial results in a scratch arena, never interned or collected
+} ObjSpace;
+
+// Every value a program can still reach. Engines collect only where no value
+// is held anywhere else, between statements and at loop back edges.
+typedef struct
+{
+    Environment *env; // innermost scope, followed up to the globals
+    Value *stack;     // the VM's stack and globals
+    size_t len_stack;
+    Value *globals;
+    size_t len_globals;
+} GcRoots;
+
+extern int gc_requested; // set by allocation, checked at the safepoints
+
+// Before the first allocation. nursery_size is in bytes.
+void configure_gc(size_t nursery_size, double heap_growth);
+// The string's chars are left for the caller to fill in, space is where it
+// may go (a young string too big for the nursery goes to the mature space)
+ObjString *allocate_string_object(size_t length, ObjSpace space);
+// Ropes are always young
+ObjString *allocate_rope_object(ObjString *left, ObjString *right);
+// Called when a rope is made to point at target. Ropes out of the nursery
+// pointing into it are remembered, minor collections treat them as roots.
+void write_barrier(ObjString *holder, ObjString *target);
+// Strings the tree refers to must never be collected. A nursery string is
+// copied out first, the copy is returned and replaces it in the intern table.
+ObjString *make_permanent(ObjString *string);
+void collect_garbage(const GcRoots *roots);
+void print_gc_stats(FILE *out);
+void free_heap();
+
+static inline void safepoint_environment(Environment *env)
+{
+    if (gc_requested)
+    {
+        GcRoots roots = {env, NULL, 0, NULL, 0};
+        collect_garbage(&roots);
+    }
+}
+
+#endif //__GC__
@@ -1,24 +1,41 @@
 #include <string.h>
 
 #include "interpreter.h"
+#include "jit.h"
+#include "gc.h"
+
+// Nodes are specialized for the operand types they keep seeing: a binary
+// node that got numbers on its first QUICKEN_THRESHOLD runs rewrites itself
+// into, say, EXPR_ADD_NUMBERS, which adds without looking at the operator.
+// The specialized form still checks its operands and turns back into the
+// generic node when they do not match. After QUICKEN_MAX_DEOPTS of those it
+// stays generic for good.
+#define QUICKEN_THRESHOLD 2
+#define QUICKEN_MAX_DEOPTS 4
 
 int *error_code;
 
-Literal *evaluate(Interpreter *interpreter, Expression *expr, int *error_code);
+Value evaluate(Interpreter *interpreter, Expression *expr, int *error_code);
 void executeBlock(Interpreter *interpreter, Block *blk, Environment *environment);
 void execute(Interpreter *interpreter, Statement *statement, int *error_code_param);
-int isTruthy(Literal *object);
 
 Interpreter *init_interpreter()
 {
     Interpreter *new = calloc(1, sizeof(Interpreter));
-    new->env = init_environment(NULL);
+    new->globals = init_environment(NULL, 0);
+    new->env = new->globals;
+    new->use_jit = 1;
+    new->scratch = init_arena();
     return new;
 }
 
 void free_interpreter(Interpreter *interpreter)
 {
-    free_environment(interpreter->env);
+    free_environment(interpreter->globals);
+    interpreter->globals = NULL;
+    free_environment_pool();
+    free_jit_loops(interpreter->jit_loops);
+    free_arena(interpreter->scratch);
     interpreter->env = NULL;
     free(interpreter);
 }
@@ -30,7 +47,12 @@ void visitExpressionStatement(Interpreter *interpreter, Statement *stmt)
 
 void visitIfStatement(Interpreter *interpreter, Statement *stmt)
 {
-    if (isTruthy(evaluate(interpreter, stmt->data.if_stmt.condition, error_code)))
+    Value condition = evaluate(interpreter, stmt->data.if_stmt.condition, error_code);
+    if (*error_code != 0)
+    {
+        return;
+    }
+    if (is_truthy(condition))
     {
         execute(interpreter, stmt->data.if_stmt.thenBranch, error_code);
     }
@@ -42,272 +64,377 @@ void visitIfStatement(Interpreter *interpreter, Statement *stmt)
 
 void visitPrintStatement(Interpreter *interpreter, Statement *stmt)
 {
-    Literal *value = evaluate(interpreter, stmt->data.print.expression, error_code);
-    print_literal(value);
+    Value value = evaluate(interpreter, stmt->data.print.expression, error_code);
+    if (*error_code != 0)
+    {
+        return;
+    }
+    print_value(value);
 }
 
 void visitVarStatement(Interpreter *interpreter, Statement *stmt)
 {
-    Literal *value = init_literal(NIL, NULL, 1);
+    Value value = NIL_VAL;
     if (stmt->data.var.initializer != NULL)
     {
-        free_literal(value);
         value = evaluate(interpreter, stmt->data.var.initializer, error_code);
     }
-    define_environment(interpreter->env, stmt->data.var.name->lexeme, value);
+    if (stmt->data.var.slot >= 0)
+    {
+        interpreter->env->slots[stmt->data.var.slot] = value;
+        return;
+    }
+    define_environment(interpreter->globals, stmt->data.var.identifier, value);
     return;
 }
 
-void visitWhileStatement(Interpreter *interpreter, Statement *stmt)
+// Once a loop has run JIT_THRESHOLD iterations, the JIT gets one chance per
+// run of the loop to take over the remaining iterations
+static int jit_takes_over(Interpreter *interpreter, Statement *stmt, int *try_jit)
 {
-    while (isTruthy(evaluate(interpreter, stmt->data.while_stmt.condition, error_code)))
+    if (!*try_jit || *error_code != 0 || ++stmt->iterations < JIT_THRESHOLD)
     {
-        execute(interpreter, stmt->data.while_stmt.body, error_code);
+        return 0;
     }
+    *try_jit = 0;
+    return jit_run_loop(interpreter, stmt);
 }
 
-void visitBlockStatement(Interpreter *interpreter, Statement *stmt)
+void visitWhileStatement(Interpreter *interpreter, Statement *stmt)
 {
-    executeBlock(interpreter, stmt->data.block, init_environment(interpreter->env));
+    int try_jit = interpreter->use_jit;
+    while (is_truthy(evaluate(interpreter, stmt->data.while_stmt.condition, error_code)) && *error_code == 0)
+    {
+        execute(interpreter, stmt->data.while_stmt.body, error_code);
+        if (jit_takes_over(interpreter, stmt, &try_jit))
+        {
+            break;
+        }
+    }
 }
 
-Literal *visitAssignExpr(Interpreter *interpreter, Expression *expr)
+// The loop's scope is set up once for all iterations, and the condition and
+// increment are evaluated directly instead of through nested statements.
+void visitForStatement(Interpreter *interpreter, Statement *stmt)
 {
-    Literal *value = evaluate(interpreter, expr->as.assign.value, error_code);
-    assign_environment(interpreter->env, expr->as.assign.name, value, error_code);
-    return value;
+    Environment *previous = interpreter->env;
+    if (stmt->data.for_stmt.len_locals > 0)
+    {
+        interpreter->env = acquire_environment(previous, stmt->data.for_stmt.len_locals);
+    }
+    if (stmt->data.for_stmt.initializer != NULL)
+    {
+        execute(interpreter, stmt->data.for_stmt.initializer, error_code);
+    }
+    Expression *condition = stmt->data.for_stmt.condition;
+    Expression *increment = stmt->data.for_stmt.increment;
+    Statement *body = stmt->data.for_stmt.body;
+    int try_jit = interpreter->use_jit;
+    while (*error_code == 0)
+    {
+        if (condition != NULL && !is_truthy(evaluate(interpreter, condition, error_code)))
+        {
+            break;
+        }
+        execute(interpreter, body, error_code);
+        if (increment != NULL)
+        {
+            evaluate(interpreter, increment, error_code);
+        }
+        if (jit_takes_over(interpreter, stmt, &try_jit))
+        {
+            break;
+        }
+    }
+    if (interpreter->env != previous)
+    {
+        release_environment(interpreter->env);
+        interpreter->env = previous;
+    }
 }
 
-Literal *visitVariableExpression(Interpreter *interpreter, Expression *var_expr)
+void visitBlockStatement(Interpreter *interpreter, Statement *stmt)
 {
-    return get_environment(interpreter->env, var_expr->as.variable.name->lexeme, error_code);
+    Block *blk = stmt->data.block;
+    if (blk->len_locals == 0)
+    {
+        // Declares nothing, so the resolver did not count it as a scope
+        for (size_t i = 0; i < blk->len_statements; i++)
+        {
+            execute(interpreter, blk->statements[i], error_code);
+        }
+        return;
+    }
+    executeBlock(interpreter, blk, acquire_environment(interpreter->env, blk->len_locals));
 }
 
-Literal *visitLiteralExpr(Interpreter *interpreter, Expression *expr)
+Value visitAssignExpr(Interpreter *interpreter, Expression *expr)
 {
-    return expr->as.literal;
+    Value value = evaluate(interpreter, expr->as.assign.value, error_code);
+    if (*error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    if (expr->as.assign.depth >= 0)
+    {
+        assign_at_environment(interpreter->env, expr->as.assign.depth, expr->as.assign.slot, value);
+        return value;
+    }
+    assign_environment(interpreter->globals, expr->as.assign.identifier, value, error_code);
+    return value;
 }
 
-Literal *visitGroupingExpr(Interpreter *interpreter, Expression *expr)
+// Where a variable lives never changes, so it is specialized right away
+Value visitVariableExpression(Interpreter *interpreter, Expression *var_expr)
 {
-    return evaluate(interpreter, expr, error_code);
+    if (var_expr->as.variable.depth >= 0)
+    {
+        var_expr->type = EXPR_LOCAL;
+        return get_at_environment(interpreter->env, var_expr->as.variable.depth, var_expr->as.variable.slot);
+    }
+    var_expr->type = EXPR_GLOBAL;
+    var_expr->as.variable.slot = 0;
+    return get_hinted_environment(interpreter->globals, var_expr->as.variable.identifier, &var_expr->as.variable.slot, error_code);
 }
 
-int isTruthy(Literal *object)
+// Loop-invariant expression, computed on first use and then read from its
+// hidden local
+Value visitInvariantExpr(Interpreter *interpreter, Expression *expr)
 {
-    if (!object)
+    Value value = get_at_environment(interpreter->env, expr->as.invariant.depth, expr->as.invariant.slot);
+    if (!IS_UNDEFINED(value))
     {
-        return 0;
+        return value;
     }
-    if (object->token_type == NIL && object->data.null == 1)
+    value = evaluate(interpreter, expr->as.invariant.expr, error_code);
+    if (*error_code == 0)
     {
-        return 0;
-    }
-    if (object->token_type == TRUE || object->token_type == FALSE)
-    {
-        return object->data.bool_val;
+        assign_at_environment(interpreter->env, expr->as.invariant.depth, expr->as.invariant.slot, value);
     }
-    return 1;
+    return value;
+}
+
+Value visitLiteralExpr(Interpreter *interpreter, Expression *expr)
+{
+    (void)interpreter;
+    return expr->as.value;
+}
+
+Value visitGroupingExpr(Interpreter *interpreter, Expression *expr)
+{
+    return evaluate(interpreter, expr, error_code);
 }
 
-Literal *visitUnaryExpr(Interpreter *interpreter, Expression *expr)
+Value visitUnaryExpr(Interpreter *interpreter, Expression *expr)
 {
-    Literal *right = evaluate(interpreter, expr->as.binary.right, error_code);
-    switch (expr->as.binary.operator->literal->token_type)
+    Value right = evaluate(interpreter, expr->as.binary.right, error_code);
+    if (*error_code != 0)
+    {
+        return NIL_VAL;
+    }
+    switch (expr->as.binary.operator->type)
     {
     case BANG:
-        Literal *ret = calloc(1, sizeof(Literal));
-        ret->data.bool_val = !isTruthy(right);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
-        break;
+        return BOOL_VAL(!is_truthy(right));
     case MINUS:
-        if (right->token_type != NUMBER)
+        if (!IS_NUMBER(right))
         {
             fprintf(stderr, "Operand must be a number.\n");
             *error_code = 70;
             break;
         }
-        *right->data.number *= -1;
-        return right;
-        break;
+        return NUMBER_VAL(-AS_NUMBER(right));
     }
-    // Unreachable
-    return NULL;
+    return NIL_VAL;
 }
 
-int isEqual(Literal *a, Literal *b)
+int checkNumberOperands(Value left, Value right)
 {
-    if (a->token_type == NIL && b->token_type == NIL)
-    {
-        return 1;
-    }
-    if (a->token_type == STRING && b->token_type == STRING)
-    {
-        return strcmp(a->data.string, b->data.string) == 0;
-    }
-    if (a->token_type == NUMBER && b->token_type == NUMBER)
-    {
-        return *(a->data.number) == *(b->data.number);
-    }
-    if ((a->token_type == TRUE && b->token_type == TRUE) || (a->token_type == FALSE && b->token_type == FALSE))
-    {
-        return 1;
-    }
-    if ((a->token_type == FALSE && b->token_type == TRUE) || (a->token_type == TRUE && b->token_type == FALSE))
-    {
-        return 0;
-    }
-    fprintf(stderr, "Trying to check if %s == %s\n", token_type_to_str(a->token_type), token_type_to_str(b->token_type));
-    return 0;
-}
-
-void checkNumberOperands(Literal *left, Literal *right)
-{
-    // fprintf(stderr, "checkNumberOperands(%s, %s)\n",
-    //         token_type_to_str(left->token_type),
-    //         token_type_to_str(right->token_type));
     // Check if either operand is NOT a number
-    if (left->token_type != NUMBER ||
-        right->token_type != NUMBER)
+    if (!IS_NUMBER(left) || !IS_NUMBER(right))
     {
         fprintf(stderr, "Operands must be numbers.\n");
         *error_code = 70;
+        return 0;
     }
-    // Else, both are numbers (valid case), do nothing
+    // Else, both are numbers (valid case)
+    return 1;
 }
 
-Literal *visitBinaryExpr(Interpreter *interpreter, Expression *expr)
+// Applies a binary node's operator to operands that are already evaluated
+Value binaryValues(Interpreter *interpreter, Expression *expr, Value left, Value right)
 {
-    Literal *left = evaluate(interpreter, expr->as.binary.left, error_code);
-    Literal *right = evaluate(interpreter, expr->as.binary.right, error_code);
-    if (left == NULL || right == NULL)
+    (void)interpreter;
+    if (*error_code != 0)
     {
-        return NULL;
+        return NIL_VAL;
     }
-    Literal *ret = calloc(1, sizeof(Literal));
-    switch (expr->as.binary.operator->literal->token_type)
+    switch (expr->as.binary.operator->type)
     {
     case GREATER:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->data.bool_val = *(left->data.number) > *(right->data.number);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
+        return BOOL_VAL(AS_NUMBER(left) > AS_NUMBER(right));
     case GREATER_EQUAL:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->data.bool_val = *(left->data.number) >= *(right->data.number);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
+        return BOOL_VAL(AS_NUMBER(left) >= AS_NUMBER(right));
     case LESS:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->data.bool_val = *(left->data.number) < *(right->data.number);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
+        return BOOL_VAL(AS_NUMBER(left) < AS_NUMBER(right));
     case LESS_EQUAL:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->data.bool_val = *(left->data.number) <= *(right->data.number);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
+        return BOOL_VAL(AS_NUMBER(left) <= AS_NUMBER(right));
     case EQUAL_EQUAL:
-        ret->data.bool_val = isEqual(left, right);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
-        break;
+        return BOOL_VAL(values_equal(left, right));
     case BANG_EQUAL:
-        ret->data.bool_val = !isEqual(left, right);
-        ret->token_type = ret->data.bool_val == 1 ? TRUE : FALSE;
-        return ret;
-        break;
+        return BOOL_VAL(!values_equal(left, right));
     case MINUS:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->token_type = NUMBER;
-        ret->data.number = calloc(1, sizeof(double));
-        *(ret->data.number) = *(left->data.number) - *(right->data.number);
-        return ret;
-        break;
+        return NUMBER_VAL(AS_NUMBER(left) - AS_NUMBER(right));
     case PLUS:
-        if (left->token_type == NUMBER && right->token_type == NUMBER)
+        if (IS_NUMBER(left) && IS_NUMBER(right))
         {
-            ret->token_type = NUMBER;
-            ret->data.number = calloc(1, sizeof(double));
-            *(ret->data.number) = *(left->data.number) + *(right->data.number);
-            return ret;
+            return NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
         }
-        if (left->token_type == STRING && right->token_type == STRING)
+        if (IS_STRING(left) && IS_STRING(right))
         {
-            ret->token_type = STRING;
-            ret->data.string = calloc(strlen(left->data.string) + strlen(right->data.string) + 1, sizeof(char));
-            strcpy(ret->data.string, left->data.string);
-            strcpy(ret->data.string + strlen(left->data.string), right->data.string);
-            return ret;
+            return concatenate_strings(left, right);
         }
+        fprintf(stderr, "Operands must be two numbers or two strings.\n");
+        *error_code = 70;
         break;
     case SLASH:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->token_type = NUMBER;
-        ret->data.number = calloc(1, sizeof(double));
-        *(ret->data.number) = *(left->data.number) / *(right->data.number);
-        return ret;
-        break;
+        return NUMBER_VAL(AS_NUMBER(left) / AS_NUMBER(right));
     case STAR:
-        checkNumberOperands(left, right);
-        if (*error_code == 70)
+        if (!checkNumberOperands(left, right))
         {
-            return NULL;
+            return NIL_VAL;
         }
-        ret->token_type = NUMBER;
-        ret->data.number = calloc(1, sizeof(double));
-        *(ret->data.number) = *(left->data.number) * *(right->data.number);
-        return ret;
-        break;
+        return NUMBER_VAL(AS_NUMBER(left) * AS_NUMBER(right));
     default:
-        return NULL;
         break;
     }
-    return NULL;
+    return NIL_VAL;
 }
 
-Literal *visitLogicalExpr(Interpreter *interpreter, Expression *expr)
+static ExpressionType specialize_binary(TokenType operator, Value left, Value right)
 {
-    Literal *left = evaluate(interpreter, expr->as.binary.left, error_code);
+    if (IS_STRING(left) && IS_STRING(right) && operator == PLUS)
+    {
+        return EXPR_CONCAT_STRINGS;
+    }
+    if (!IS_NUMBER(left) || !IS_NUMBER(right))
+    {
+        return EXPR_BINARY;
+    }
+    switch (operator)
+    {
+    case PLUS:
+        return EXPR_ADD_NUMBERS;
+    case MINUS:
+        return EXPR_SUBTRACT_NUMBERS;
+    case STAR:
+        return EXPR_MULTIPLY_NUMBERS;
+    case SLASH:
+        return EXPR_DIVIDE_NUMBERS;
+    case LESS:
+        return EXPR_LESS_NUMBERS;
+    case LESS_EQUAL:
+        return EXPR_LESS_EQUAL_NUMBERS;
+    case GREATER:
+        return EXPR_GREATER_NUMBERS;
+    case GREATER_EQUAL:
+        return EXPR_GREATER_EQUAL_NUMBERS;
+    default:
+        return EXPR_BINARY;
+    }
+}
+
+Value visitBinaryExpr(Interpreter *interpreter, Expression *expr)
+{
+    Value left = evaluate(interpreter, expr->as.binary.left, error_code);
+    Value right = evaluate(interpreter, expr->as.binary.right, error_code);
+    if (*error_code == 0 && expr->deopts < QUICKEN_MAX_DEOPTS && ++expr->hits >= QUICKEN_THRESHOLD)
+    {
+        expr->type = specialize_binary(expr->as.binary.operator->type, left, right);
+        expr->hits = 0;
+    }
+    return binaryValues(interpreter, expr, left, right);
+}
+
+// A specialized node got operands it was not made for
+static Value deoptimizeBinary(Interpreter *interpreter, Expression *expr, Value left, Value right)
+{
+    expr->type = EXPR_BINARY;
+    expr->deopts++;
+    return binaryValues(interpreter, expr, left, right);
+}
+
+// Operand of a string concatenation. When it is a concatenation itself, only
+// the enclosing one ever sees its result, so that is built in the scratch
+// arena and not interned: in a + b + c, only the final string is.
+static Value evaluateConcatOperand(Interpreter *interpreter, Expression *expr)
+{
+    if (expr->type != EXPR_CONCAT_STRINGS)
+    {
+        return evaluate(interpreter, expr, error_code);
+    }
+    Value left = evaluateConcatOperand(interpreter, expr->as.binary.left);
+    Value right = evaluateConcatOperand(interpreter, expr->as.binary.right);
+    if (IS_STRING(left) && IS_STRING(right))
+    {
+        return concatenate_scratch(interpreter->scratch, left, right);
+    }
+    return deoptimizeBinary(interpreter, expr, left, right);
+}
+
+// Body of the EXPR_*_NUMBERS cases of evaluate
+#define NUMBER_BINARY(value_type, op)                                                    \
+    {                                                                                    \
+        Value left = evaluate(interpreter, expr->as.binary.left, error_code_param);      \
+        Value right = evaluate(interpreter, expr->as.binary.right, error_code_param);    \
+        if (IS_NUMBER(left) && IS_NUMBER(right))                                         \
+        {                                                                                \
+            return value_type(AS_NUMBER(left) op AS_NUMBER(right));                      \
+        }                                                                                \
+        return deoptimizeBinary(interpreter, expr, left, right);                         \
+    }
+
+Value visitLogicalExpr(Interpreter *interpreter, Expression *expr)
+{
+    Value left = evaluate(interpreter, expr->as.binary.left, error_code);
     if (*error_code != 0)
     {
-        return NULL;
+        return NIL_VAL;
     }
-    if (expr->as.binary.operator->literal->token_type == OR)
+    if (expr->as.binary.operator->type == OR)
     {
-        if (isTruthy(left))
+        if (is_truthy(left))
         {
             return left;
         }
     }
     else
     {
-        if (!isTruthy(left))
+        if (!is_truthy(left))
         {
             return left;
         }
@@ -323,16 +450,16 @@ void executeBlock(Interpreter *interpreter, Block *blk, Environment *environment
     {
         execute(interpreter, blk->statements[i], error_code);
     }
-    free_environment(environment);
+    release_environment(environment);
     environment = NULL;
     interpreter->env = previous;
 }
 
-Literal *evaluate(Interpreter *interpreter, Expression *expr, int *error_code_param)
+Value evaluate(Interpreter *interpreter, Expression *expr, int *error_code_param)
 {
     if (*error_code_param != 0)
     {
-        return NULL;
+        return NIL_VAL;
     }
     error_code = error_code_param;
     switch (expr->type)
@@ -341,7 +468,7 @@ Literal *evaluate(Interpreter *interpreter, Expression *expr, int *error_code_pa
         return visitLiteralExpr(interpreter, expr);
         break;
     case EXPR_BINARY:
-        if (expr->as.binary.operator->literal->token_type == OR || expr->as.binary.operator->literal->token_type == AND)
+        if (expr->as.binary.operator->type == OR || expr->as.binary.operator->type == AND)
         {
             return visitLogicalExpr(interpreter, expr);
         }
@@ -358,11 +485,43 @@ Literal *evaluate(Interpreter *interpreter, Expression *expr, int *error_code_pa
         break;
     case EXPR_ASSIGN:
         return visitAssignExpr(interpreter, expr);
+    case EXPR_INVARIANT:
+        return visitInvariantExpr(interpreter, expr);
+    case EXPR_LOCAL:
+        return get_at_environment(interpreter->env, expr->as.variable.depth, expr->as.variable.slot);
+    case EXPR_GLOBAL:
+        return get_hinted_environment(interpreter->globals, expr->as.variable.identifier, &expr->as.variable.slot, error_code);
+    case EXPR_ADD_NUMBERS:
+        NUMBER_BINARY(NUMBER_VAL, +)
+    case EXPR_SUBTRACT_NUMBERS:
+        NUMBER_BINARY(NUMBER_VAL, -)
+    case EXPR_MULTIPLY_NUMBERS:
+        NUMBER_BINARY(NUMBER_VAL, *)
+    case EXPR_DIVIDE_NUMBERS:
+        NUMBER_BINARY(NUMBER_VAL, /)
+    case EXPR_LESS_NUMBERS:
+        NUMBER_BINARY(BOOL_VAL, <)
+    case EXPR_LESS_EQUAL_NUMBERS:
+        NUMBER_BINARY(BOOL_VAL, <=)
+    case EXPR_GREATER_NUMBERS:
+        NUMBER_BINARY(BOOL_VAL, >)
+    case EXPR_GREATER_EQUAL_NUMBERS:
+        NUMBER_BINARY(BOOL_VAL, >=)
+    case EXPR_CONCAT_STRINGS:
+    {
+        Value left = evaluateConcatOperand(interpreter, expr->as.binary.left);
+        Value right = evaluateConcatOperand(interpreter, expr->as.binary.right);
+        if (IS_STRING(left) && IS_STRING(right))
+        {
+            return concatenate_strings(left, right);
+        }
+        return deoptimizeBinary(interpreter, expr, left, right);
+    }
     default:
         break;
     }
     printf("HOW THE FUCK DID YOU GET HERE evaluate\n");
-    return NULL;
+    return NIL_VAL;
 }
 
 void execute(Interpreter *interpreter, Statement *statement, int *error_code_param)
@@ -372,6 +531,8 @@ void execute(Interpreter *interpreter, Statement *statement, int *error_code_par
         return;
     }
     error_code = error_code_param;
+    // Loop bodies are statements too, so this also runs once per iteration
+    safepoint_environment(interpreter->env);
     switch (statement->type)
     {
     case STMT_PRINT:
@@ -392,18 +553,24 @@ void execute(Interpreter *interpreter, Statement *statement, int *error_code_par
     case STMT_WHILE:
         visitWhileStatement(interpreter, statement);
         break;
+    case STMT_FOR:
+        visitForStatement(interpreter, statement);
+        break;
     default:
         fprintf(stderr, "Visiting statement type %d not implemented\n", statement->type);
         break;
     }
+    // Whatever the statement stored was interned, its temporaries are dead
+    reset_arena(interpreter->scratch);
 }
 
-void interpret(Statement **statements, size_t len_statements, int *error_code_param)
+void interpret(Statement **statements, size_t len_statements, int use_jit, int *error_code_param)
 {
     Interpreter *interpreter = init_interpreter();
+    interpreter->use_jit = use_jit;
     for (size_t i = 0; i < len_statements; i++)
     {
         execute(interpreter, statements[i], error_code_param);
     }
     free_interpreter(interpreter);
-}
\ No newline at end of file
+}
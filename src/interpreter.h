@@ -7,9 +7,16 @@
 typedef struct
 {
     Environment *env;
+    Environment *globals;
+    int use_jit;                  // compile hot loops to machine code, on by default
+    struct JitLoop_ *jit_loops;   // every loop compiled so far, freed with the interpreter
+    Arena *scratch;               // temporaries of the statement being run, emptied after each one
 } Interpreter;
 
-Literal *evaluate(Interpreter *interpreter, Expression *expr, int *error_code);
-void interpret(Statement **statements, size_t len_statements, int *error_code_param);
+Interpreter *init_interpreter();
+void free_interpreter(Interpreter *interpreter);
+Value evaluate(Interpreter *interpreter, Expression *expr, int *error_code);
+void execute(Interpreter *interpreter, Statement *statement, int *error_code_param);
+void interpret(Statement **statements, size_t len_statements, int use_jit, int *error_code_param);
 
 #endif //__INTERPRETER__
\ No newline at end of file
@@ -0,0 +1,638 @@
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Nested scopes a compiled loop may declare
+#define JIT_MAX_SCOPES 64
+// Frames up to this many variables live on the C stack
+#define JIT_STACK_FRAME 64
+
+// Generated code is a void function taking the frame in rdi. rbx keeps the
+// frame for the whole run; expressions leave their result in xmm0 and push
+// the left operand of a binary onto the machine stack while the right one
+// runs, so operands are evaluated left to right like in the interpreter.
+typedef void (*JitFunction)(double *frame);
+
+// A variable declared outside the loop. Its value is copied into
+// frame[index] when the native code is entered and back out when it returns.
+typedef struct
+{
+    ObjString *identifier; // global, NULL for a local
+    int depth;             // locals: scopes between the loop and the declaration
+    int slot;
+    size_t index;
+} JitBinding;
+
+struct JitLoop_
+{
+    void *code; // NULL when the loop cannot be compiled
+    size_t size_code;
+    JitBinding *bindings;
+    size_t len_bindings;
+    size_t size_bindings;
+    size_t len_frame; // bindings and the locals the loop declares itself
+    struct JitLoop_ *next;
+};
+
+// Jump to a label that may not be bound yet, patched once the code is done
+typedef struct
+{
+    size_t at; // offset of the rel32 operand
+    size_t label;
+} JitFixup;
+
+typedef struct
+{
+    JitLoop *loop;
+    uint8_t *code;
+    size_t len_code;
+    size_t size_code;
+    size_t *labels; // code offset of each label, SIZE_MAX until bound
+    size_t len_labels;
+    size_t size_labels;
+    JitFixup *fixups;
+    size_t len_fixups;
+    size_t size_fixups;
+    // First frame index of each scope opened inside the loop, innermost last
+    size_t scopes[JIT_MAX_SCOPES];
+    int len_scopes;
+    int failed;
+} JitCompiler;
+
+// Condition codes for jcc after ucomisd
+#define JCC_ALWAYS 0x00
+#define JCC_B 0x82
+#define JCC_AE 0x83
+#define JCC_E 0x84
+#define JCC_NE 0x85
+#define JCC_BE 0x86
+#define JCC_A 0x87
+#define JCC_P 0x8A
+
+static void emit_bytes(JitCompiler *c, const uint8_t *bytes, size_t len)
+{
+    if (c->len_code + len > c->size_code)
+    {
+        c->size_code = c->size_code == 0 ? 256 : c->size_code * 2;
+        if (c->size_code < c->len_code + len)
+        {
+            c->size_code = c->len_code + len;
+        }
+        c->code = realloc(c->code, c->size_code);
+    }
+    memcpy(c->code + c->len_code, bytes, len);
+    c->len_code += len;
+}
+
+#define EMIT(c, ...)                                 \
+    do                                               \
+    {                                                \
+        const uint8_t bytes_[] = {__VA_ARGS__};      \
+        emit_bytes((c), bytes_, sizeof(bytes_));     \
+    } while (0)
+
+static void emit_u32(JitCompiler *c, uint32_t value)
+{
+    emit_bytes(c, (const uint8_t *)&value, sizeof(value));
+}
+
+static void emit_u64(JitCompiler *c, uint64_t value)
+{
+    emit_bytes(c, (const uint8_t *)&value, sizeof(value));
+}
+
+static size_t new_label(JitCompiler *c)
+{
+    if (c->len_labels == c->size_labels)
+    {
+        c->size_labels = c->size_labels == 0 ? 16 : c->size_labels * 2;
+        c->labels = realloc(c->labels, c->size_labels * sizeof(size_t));
+    }
+    c->labels[c->len_labels] = SIZE_MAX;
+    return c->len_labels++;
+}
+
+static void bind_label(JitCompiler *c, size_t label)
+{
+    c->labels[label] = c->len_code;
+}
+
+// jmp or jcc with a 32 bit displacement to label
+static void emit_jump(JitCompiler *c, uint8_t condition, size_t label)
+{
+    if (condition == JCC_ALWAYS)
+    {
+        EMIT(c, 0xE9);
+    }
+    else
+    {
+        EMIT(c, 0x0F, condition);
+    }
+    if (c->len_fixups == c->size_fixups)
+    {
+        c->size_fixups = c->size_fixups == 0 ? 16 : c->size_fixups * 2;
+        c->fixups = realloc(c->fixups, c->size_fixups * sizeof(JitFixup));
+    }
+    c->fixups[c->len_fixups++] = (JitFixup){c->len_code, label};
+    emit_u32(c, 0);
+}
+
+// movsd xmm<reg>, [rbx + index * 8]
+static void emit_load(JitCompiler *c, int reg, size_t index)
+{
+    EMIT(c, 0xF2, 0x0F, 0x10, (uint8_t)(0x83 | (reg << 3)));
+    emit_u32(c, (uint32_t)(index * sizeof(double)));
+}
+
+// movsd [rbx + index * 8], xmm0
+static void emit_store(JitCompiler *c, size_t index)
+{
+    EMIT(c, 0xF2, 0x0F, 0x11, 0x83);
+    emit_u32(c, (uint32_t)(index * sizeof(double)));
+}
+
+// mov rax, bits; movq xmm<reg>, rax
+static void emit_constant(JitCompiler *c, int reg, uint64_t bits)
+{
+    EMIT(c, 0x48, 0xB8);
+    emit_u64(c, bits);
+    EMIT(c, 0x66, 0x48, 0x0F, 0x6E, (uint8_t)(0xC0 | (reg << 3)));
+}
+
+// Runs both operands of a binary, leaving the left one in xmm0 and the right
+// one in xmm1
+static void compile_number(JitCompiler *c, Expression *expr);
+
+static void compile_operands(JitCompiler *c, Expression *expr)
+{
+    compile_number(c, expr->as.binary.left);
+    EMIT(c, 0x48, 0x83, 0xEC, 0x08);       // sub rsp, 8
+    EMIT(c, 0xF2, 0x0F, 0x11, 0x04, 0x24); // movsd [rsp], xmm0
+    compile_number(c, expr->as.binary.right);
+    EMIT(c, 0x66, 0x0F, 0x28, 0xC8);       // movapd xmm1, xmm0
+    EMIT(c, 0xF2, 0x0F, 0x10, 0x04, 0x24); // movsd xmm0, [rsp]
+    EMIT(c, 0x48, 0x83, 0xC4, 0x08);       // add rsp, 8
+}
+
+// Frame index of a variable. Scopes the loop opened itself are in the frame
+// already, anything further out gets a binding.
+static size_t frame_index(JitCompiler *c, ObjString *identifier, int depth, int slot)
+{
+    if (depth >= 0 && depth < c->len_scopes)
+    {
+        return c->scopes[c->len_scopes - 1 - depth] + (size_t)slot;
+    }
+    JitLoop *loop = c->loop;
+    if (depth >= 0)
+    {
+        identifier = NULL;
+        depth -= c->len_scopes;
+    }
+    else
+    {
+        depth = slot = -1;
+    }
+    for (size_t i = 0; i < loop->len_bindings; i++)
+    {
+        JitBinding *binding = &loop->bindings[i];
+        if (binding->identifier == identifier && binding->depth == depth && binding->slot == slot)
+        {
+            return binding->index;
+        }
+    }
+    if (loop->len_bindings == loop->size_bindings)
+    {
+        loop->size_bindings = loop->size_bindings == 0 ? 8 : loop->size_bindings * 2;
+        loop->bindings = realloc(loop->bindings, loop->size_bindings * sizeof(JitBinding));
+    }
+    loop->bindings[loop->len_bindings++] = (JitBinding){identifier, depth, slot, loop->len_frame};
+    return loop->len_frame++;
+}
+
+static int is_binary(Expression *expr)
+{
+    return expr->type == EXPR_BINARY || (expr->type >= EXPR_ADD_NUMBERS && expr->type <= EXPR_CONCAT_STRINGS);
+}
+
+// Expression whose value is a number, into xmm0
+static void compile_number(JitCompiler *c, Expression *expr)
+{
+    if (c->failed)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        if (!IS_NUMBER(expr->as.value))
+        {
+            break;
+        }
+        emit_constant(c, 0, expr->as.value);
+        return;
+    case EXPR_GROUPING:
+        compile_number(c, expr->as.binary.left);
+        return;
+    case EXPR_INVARIANT:
+        compile_number(c, expr->as.invariant.expr);
+        return;
+    case EXPR_VARIABLE:
+    case EXPR_LOCAL:
+        emit_load(c, 0, frame_index(c, expr->as.variable.identifier, expr->as.variable.depth, expr->as.variable.slot));
+        return;
+    case EXPR_GLOBAL:
+        emit_load(c, 0, frame_index(c, expr->as.variable.identifier, -1, -1));
+        return;
+    case EXPR_ASSIGN:
+        compile_number(c, expr->as.assign.value);
+        emit_store(c, frame_index(c, expr->as.assign.identifier, expr->as.assign.depth, expr->as.assign.slot));
+        return;
+    case EXPR_UNARY:
+        if (expr->as.binary.operator->type != MINUS)
+        {
+            break;
+        }
+        compile_number(c, expr->as.binary.right);
+        emit_constant(c, 1, SIGN_BIT);
+        EMIT(c, 0x66, 0x0F, 0x57, 0xC1); // xorpd xmm0, xmm1
+        return;
+    default:
+        if (!is_binary(expr))
+        {
+            break;
+        }
+        uint8_t opcode;
+        switch (expr->as.binary.operator->type)
+        {
+        case PLUS:
+            opcode = 0x58;
+            break;
+        case MINUS:
+            opcode = 0x5C;
+            break;
+        case STAR:
+            opcode = 0x59;
+            break;
+        case SLASH:
+            opcode = 0x5E;
+            break;
+        default:
+            c->failed = 1;
+            return;
+        }
+        compile_operands(c, expr);
+        EMIT(c, 0xF2, 0x0F, opcode, 0xC1); // addsd/subsd/mulsd/divsd xmm0, xmm1
+        return;
+    }
+    c->failed = 1;
+}
+
+// Jumps to label when the truthiness of expr is jump_if, falls through
+// otherwise. Comparisons compare the registers so that a NaN operand makes
+// them false, as in C.
+static void compile_branch(JitCompiler *c, Expression *expr, int jump_if, size_t label)
+{
+    if (c->failed)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        if (is_truthy(expr->as.value) == jump_if)
+        {
+            emit_jump(c, JCC_ALWAYS, label);
+        }
+        return;
+    case EXPR_GROUPING:
+        compile_branch(c, expr->as.binary.left, jump_if, label);
+        return;
+    case EXPR_UNARY:
+        if (expr->as.binary.operator->type == BANG)
+        {
+            compile_branch(c, expr->as.binary.right, !jump_if, label);
+            return;
+        }
+        break;
+    default:
+        if (!is_binary(expr))
+        {
+            break;
+        }
+        TokenType operator = expr->as.binary.operator->type;
+        if (operator == AND || operator == OR)
+        {
+            // The right operand decides when the left one does not short-circuit
+            int short_circuit = operator == OR;
+            if (jump_if == short_circuit)
+            {
+                compile_branch(c, expr->as.binary.left, jump_if, label);
+            }
+            else
+            {
+                size_t skip = new_label(c);
+                compile_branch(c, expr->as.binary.left, short_circuit, skip);
+                compile_branch(c, expr->as.binary.right, jump_if, label);
+                bind_label(c, skip);
+                return;
+            }
+            compile_branch(c, expr->as.binary.right, jump_if, label);
+            return;
+        }
+        if (operator != LESS && operator != LESS_EQUAL && operator != GREATER && operator != GREATER_EQUAL &&
+            operator != EQUAL_EQUAL && operator != BANG_EQUAL)
+        {
+            break;
+        }
+        compile_operands(c, expr);
+        if (operator == LESS || operator == LESS_EQUAL)
+        {
+            EMIT(c, 0x66, 0x0F, 0x2E, 0xC8); // ucomisd xmm1, xmm0
+        }
+        else
+        {
+            EMIT(c, 0x66, 0x0F, 0x2E, 0xC1); // ucomisd xmm0, xmm1
+        }
+        // Equal means ZF set with PF clear, PF is set for unordered operands
+        int equal_when = operator == EQUAL_EQUAL ? jump_if : !jump_if;
+        switch (operator)
+        {
+        case LESS:
+        case GREATER:
+            emit_jump(c, jump_if ? JCC_A : JCC_BE, label);
+            return;
+        case LESS_EQUAL:
+        case GREATER_EQUAL:
+            emit_jump(c, jump_if ? JCC_AE : JCC_B, label);
+            return;
+        default:
+            if (equal_when)
+            {
+                size_t skip = new_label(c);
+                emit_jump(c, JCC_P, skip);
+                emit_jump(c, JCC_E, label);
+                bind_label(c, skip);
+            }
+            else
+            {
+                emit_jump(c, JCC_P, label);
+                emit_jump(c, JCC_NE, label);
+            }
+            return;
+        }
+    }
+    // Anything else must be a number, which is always truthy
+    compile_number(c, expr);
+    if (jump_if)
+    {
+        emit_jump(c, JCC_ALWAYS, label);
+    }
+}
+
+static void open_scope(JitCompiler *c, size_t len_locals)
+{
+    if (c->len_scopes == JIT_MAX_SCOPES)
+    {
+        c->failed = 1;
+        return;
+    }
+    c->scopes[c->len_scopes++] = c->loop->len_frame;
+    c->loop->len_frame += len_locals;
+}
+
+static void compile_statement(JitCompiler *c, Statement *stmt);
+
+// Condition, body and increment of a loop, increment is NULL for while
+static void compile_iterations(JitCompiler *c, Expression *condition, Statement *body, Expression *increment)
+{
+    size_t start = new_label(c);
+    size_t exit = new_label(c);
+    bind_label(c, start);
+    if (condition != NULL)
+    {
+        compile_branch(c, condition, 0, exit);
+    }
+    compile_statement(c, body);
+    if (increment != NULL)
+    {
+        compile_number(c, increment);
+    }
+    emit_jump(c, JCC_ALWAYS, start);
+    bind_label(c, exit);
+}
+
+static void compile_statement(JitCompiler *c, Statement *stmt)
+{
+    if (c->failed)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        compile_number(c, stmt->data.expr.expression);
+        return;
+    case STMT_PRINT:
+        compile_number(c, stmt->data.print.expression);
+        EMIT(c, 0x66, 0x48, 0x0F, 0x7E, 0xC7); // movq rdi, xmm0
+        EMIT(c, 0x48, 0xB8);                   // mov rax, print_value
+        emit_u64(c, (uint64_t)(uintptr_t)&print_value);
+        EMIT(c, 0xFF, 0xD0); // call rax
+        return;
+    case STMT_VAR:
+        if (stmt->data.var.slot < 0 || stmt->data.var.initializer == NULL || c->len_scopes == 0)
+        {
+            break;
+        }
+        compile_number(c, stmt->data.var.initializer);
+        emit_store(c, c->scopes[c->len_scopes - 1] + (size_t)stmt->data.var.slot);
+        return;
+    case STMT_BLOCK:
+    {
+        Block *block = stmt->data.block;
+        if (block->len_locals > 0)
+        {
+            open_scope(c, block->len_locals);
+        }
+        for (size_t i = 0; i < block->len_statements; i++)
+        {
+            compile_statement(c, block->statements[i]);
+        }
+        if (block->len_locals > 0)
+        {
+            c->len_scopes--;
+        }
+        return;
+    }
+    case STMT_IF:
+    {
+        size_t otherwise = new_label(c);
+        size_t done = new_label(c);
+        compile_branch(c, stmt->data.if_stmt.condition, 0, otherwise);
+        compile_statement(c, stmt->data.if_stmt.thenBranch);
+        emit_jump(c, JCC_ALWAYS, done);
+        bind_label(c, otherwise);
+        if (stmt->data.if_stmt.elseBranch != NULL)
+        {
+            compile_statement(c, stmt->data.if_stmt.elseBranch);
+        }
+        bind_label(c, done);
+        return;
+    }
+    case STMT_WHILE:
+        compile_iterations(c, stmt->data.while_stmt.condition, stmt->data.while_stmt.body, NULL);
+        return;
+    case STMT_FOR:
+        if (stmt->data.for_stmt.len_locals > 0)
+        {
+            open_scope(c, stmt->data.for_stmt.len_locals);
+        }
+        if (stmt->data.for_stmt.initializer != NULL)
+        {
+            compile_statement(c, stmt->data.for_stmt.initializer);
+        }
+        compile_iterations(c, stmt->data.for_stmt.condition, stmt->data.for_stmt.body, stmt->data.for_stmt.increment);
+        if (stmt->data.for_stmt.len_locals > 0)
+        {
+            c->len_scopes--;
+        }
+        return;
+    }
+    c->failed = 1;
+}
+
+// Machine code for the rest of a loop, starting at its condition: the for
+// loop's scope and initializer are already set up by the interpreter.
+static JitLoop *compile_loop(Statement *stmt)
+{
+    JitLoop *loop = calloc(1, sizeof(JitLoop));
+    JitCompiler c = {0};
+    c.loop = loop;
+
+    EMIT(&c, 0x53);             // push rbx
+    EMIT(&c, 0x48, 0x89, 0xFB); // mov rbx, rdi
+    if (stmt->type == STMT_WHILE)
+    {
+        compile_iterations(&c, stmt->data.while_stmt.condition, stmt->data.while_stmt.body, NULL);
+    }
+    else
+    {
+        compile_iterations(&c, stmt->data.for_stmt.condition, stmt->data.for_stmt.body, stmt->data.for_stmt.increment);
+    }
+    EMIT(&c, 0x5B); // pop rbx
+    EMIT(&c, 0xC3); // ret
+
+    if (!c.failed)
+    {
+        for (size_t i = 0; i < c.len_fixups; i++)
+        {
+            JitFixup *fixup = &c.fixups[i];
+            int32_t offset = (int32_t)(c.labels[fixup->label] - (fixup->at + 4));
+            memcpy(c.code + fixup->at, &offset, sizeof(offset));
+        }
+        // Written while writable, then made executable and read-only
+        void *code = mmap(NULL, c.len_code, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code != MAP_FAILED)
+        {
+            memcpy(code, c.code, c.len_code);
+            if (mprotect(code, c.len_code, PROT_READ | PROT_EXEC) == 0)
+            {
+                loop->code = code;
+                loop->size_code = c.len_code;
+            }
+            else
+            {
+                munmap(code, c.len_code);
+            }
+        }
+    }
+    free(c.code);
+    free(c.labels);
+    free(c.fixups);
+    return loop;
+}
+
+static Value *binding_address(Interpreter *interpreter, JitBinding *binding)
+{
+    if (binding->identifier != NULL)
+    {
+        return address_environment(interpreter->globals, binding->identifier);
+    }
+    return &ancestor_environment(interpreter->env, binding->depth)->slots[binding->slot];
+}
+
+int jit_run_loop(Interpreter *interpreter, Statement *stmt)
+{
+    if (stmt->jit == NULL)
+    {
+        stmt->jit = compile_loop(stmt);
+        stmt->jit->next = interpreter->jit_loops;
+        interpreter->jit_loops = stmt->jit;
+    }
+    JitLoop *loop = stmt->jit;
+    if (loop->code == NULL)
+    {
+        return 0;
+    }
+
+    double stack_frame[JIT_STACK_FRAME];
+    double *frame = loop->len_frame <= JIT_STACK_FRAME ? stack_frame : malloc(loop->len_frame * sizeof(double));
+    for (size_t i = 0; i < loop->len_bindings; i++)
+    {
+        Value *address = binding_address(interpreter, &loop->bindings[i]);
+        if (address == NULL || !IS_NUMBER(*address))
+        {
+            if (frame != stack_frame)
+            {
+                free(frame);
+            }
+            return 0;
+        }
+        frame[loop->bindings[i].index] = AS_NUMBER(*address);
+    }
+    ((JitFunction)loop->code)(frame);
+    // Nothing the loop does can define a global, so the addresses still hold
+    for (size_t i = 0; i < loop->len_bindings; i++)
+    {
+        *binding_address(interpreter, &loop->bindings[i]) = NUMBER_VAL(frame[loop->bindings[i].index]);
+    }
+    if (frame != stack_frame)
+    {
+        free(frame);
+    }
+    return 1;
+}
+
+void free_jit_loops(JitLoop *loops)
+{
+    while (loops != NULL)
+    {
+        JitLoop *next = loops->next;
+        if (loops->code != NULL)
+        {
+            munmap(loops->code, loops->size_code);
+        }
+        free(loops->bindings);
+        free(loops);
+        loops = next;
+    }
+}
+
+#else
+
+int jit_run_loop(Interpreter *interpreter, Statement *stmt)
+{
+    (void)interpreter;
+    (void)stmt;
+    return 0;
+}
+
+void free_jit_loops(JitLoop *loops)
+{
+    (void)loops;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __JIT__
+#define __JIT__
+
+#include "interpreter.h"
+
+// Iterations the tree walker runs a loop for before compiling it
+#define JIT_THRESHOLD 100
+
+// Template JIT for the tree walker, x86-64 only. A while or for loop that
+// gets hot is translated node by node into machine code, as long as it only
+// does arithmetic, comparisons and assignments on numbers, prints numbers
+// and declares number locals; anything else keeps the loop interpreted.
+// Variables the loop uses from outside are copied into a frame of doubles
+// when the native code is entered and copied back when it returns.
+typedef struct JitLoop_ JitLoop;
+
+// Called by the tree walker between two iterations of stmt, with the loop's
+// scope current. Returns 1 when the rest of the loop ran as native code,
+// 0 when the interpreter has to carry on: the loop cannot be compiled, or
+// a variable it uses does not hold a number right now.
+int jit_run_loop(Interpreter *interpreter, Statement *stmt);
+void free_jit_loops(JitLoop *loops);
+
+#endif //__JIT__
@@ -3,46 +3,119 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "scanner.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "resolver.h"
+#include "vm.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "closure.h"
+#include "cgen.h"
+#include "astcache.h"
+#include "gc.h"
 
-char *read_file_contents(const char *filename)
+// Source text of a script. Regular files are mapped read-only and scanned in
+// place, so the text is never copied; stdin ("-") and pipes cannot be mapped
+// and are read into a buffer instead. chars is not NUL terminated.
+typedef struct
 {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL)
+    const char *chars;
+    size_t length;
+    void *mapping;
+    char *buffer;
+} SourceFile;
+
+static char *read_stream(int fd, size_t *length)
+{
+    size_t size = 4096;
+    size_t len = 0;
+    char *buffer = malloc(size);
+    for (;;)
+    {
+        if (len == size)
+        {
+            size *= 2;
+            buffer = realloc(buffer, size);
+        }
+        ssize_t bytes_read = read(fd, buffer + len, size - len);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            free(buffer);
+            return NULL;
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        len += (size_t)bytes_read;
+    }
+    *length = len;
+    return buffer;
+}
+
+SourceFile read_file_contents(const char *filename)
+{
+    SourceFile file = {"", 0, NULL, NULL};
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (fd < 0)
     {
         fprintf(stderr, "Error reading file %s: %s\n", filename, strerror(errno));
         exit(1);
-        return NULL;
     }
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-
-    char *file_contents = malloc(file_size + 1);
-    if (file_contents == NULL)
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
     {
-        fprintf(stderr, "Memory allocation failed\n");
-        fclose(file);
-        return NULL;
+        if (st.st_size == 0)
+        {
+            close(fd);
+            return file;
+        }
+        void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+            file.chars = file.mapping = mapping;
+            file.length = (size_t)st.st_size;
+            close(fd);
+            return file;
+        }
+        // Not mappable after all (some special file systems), read it instead
     }
 
-    size_t bytes_read = fread(file_contents, 1, file_size, file);
-    if (bytes_read < (size_t)file_size)
+    file.buffer = read_stream(fd, &file.length);
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+    if (file.buffer == NULL)
     {
         fprintf(stderr, "Error reading file contents\n");
-        free(file_contents);
-        fclose(file);
-        return NULL;
+        exit(1);
     }
+    file.chars = file.buffer;
+    return file;
+}
 
-    file_contents[file_size] = '\0';
-    fclose(file);
-
-    return file_contents;
+void free_file_contents(SourceFile *file)
+{
+    if (file->mapping != NULL)
+    {
+        munmap(file->mapping, file->length);
+    }
+    free(file->buffer);
+    file->mapping = NULL;
+    file->buffer = NULL;
 }
 
 void print_tokens(Scanner *scanner)
@@ -50,27 +123,133 @@ void print_tokens(Scanner *scanner)
     fprintf(stderr, "Number of tokens = %zu\n", scanner->number_tokens);
     for (size_t i = 0; i < scanner->number_tokens; i++)
     {
-        Token *token = scanner->tokens[i];
-        if (token->literal->token_type == STRING)
+        Token *token = &scanner->tokens[i];
+        const char *lexeme = scanner->source + token->start;
+        int length = (int)token->length;
+        if (token->type == STRING)
         {
-            printf("%s %s %s\n", token_type_to_str(token->literal->token_type), token->lexeme, (char *)token->literal->data.string);
+            printf("%s %.*s %.*s\n", token_type_to_str(token->type), length, lexeme, length - 2, lexeme + 1);
         }
-        else if (token->literal->token_type == NUMBER)
+        else if (token->type == NUMBER)
         {
-            double number = *(double *)token->literal->data.number;
+            double number = token->number;
             if (floor(number) == number)
             { // integer
-                printf("%s %s %.1lf\n", token_type_to_str(token->literal->token_type), token->lexeme, number);
+                printf("%s %.*s %.1lf\n", token_type_to_str(token->type), length, lexeme, number);
             }
             else
             { // float
-                printf("%s %s %.15g\n", token_type_to_str(token->literal->token_type), token->lexeme, number);
+                printf("%s %.*s %.15g\n", token_type_to_str(token->type), length, lexeme, number);
+            }
+        }
+        else
+        {
+            printf("%s %.*s null\n", token_type_to_str(token->type), length, lexeme);
+        }
+    }
+}
+
+// Runs each top-level declaration as soon as it is parsed, then releases its
+// tokens and tree, so output starts right away and memory stays bounded by
+// the largest declaration. Declarations before a syntax error have already
+// run by the time it is reported.
+void run_stream(SourceFile *file, const char *engine, int debug, int use_jit, int *error_code)
+{
+    Scanner *scanner = init_scanner_stream(file->chars, file->length);
+    Parser *parser = init_parser_stream(scanner);
+    int use_vm = strcmp(engine, "vm") == 0;
+    int use_closures = strcmp(engine, "closure") == 0;
+    Compiler *compiler = use_vm ? init_compiler() : NULL;
+    VM *vm = use_vm ? init_vm() : NULL;
+    ClosureEngine *closures = use_closures ? init_closure_engine() : NULL;
+    Interpreter *interpreter = use_vm || use_closures ? NULL : init_interpreter();
+    if (interpreter != NULL)
+    {
+        interpreter->use_jit = use_jit;
+    }
+
+    Statement *stmt;
+    while (*error_code == 0 && (stmt = parse_next(parser, error_code)) != NULL)
+    {
+        if (use_vm)
+        {
+            Chunk *chunk = compile_declaration(compiler, stmt, error_code);
+            if (chunk != NULL)
+            {
+                if (debug)
+                {
+                    disassemble_chunk(chunk, "declaration");
+                }
+                run_chunk(vm, chunk, error_code);
             }
         }
+        else if (use_closures)
+        {
+            resolve(&stmt, 1);
+            run_closures(closures, &stmt, 1, error_code);
+        }
         else
         {
-            printf("%s %s null\n", token_type_to_str(token->literal->token_type), token->lexeme);
+            resolve(&stmt, 1);
+            execute(interpreter, stmt, error_code);
+        }
+        release_parsed(parser);
+    }
+
+    if (use_vm)
+    {
+        free_vm(vm);
+        free_compiler(compiler);
+    }
+    else if (use_closures)
+    {
+        free_closure_engine(closures);
+    }
+    else
+    {
+        free_interpreter(interpreter);
+    }
+    free_parser(parser);
+    free_scanner(scanner);
+}
+
+// How a whole program is run, from the command line
+typedef struct
+{
+    const char *engine;
+    int debug;
+    int use_jit;
+    int dump_ast;
+} RunOptions;
+
+// Runs a program that went through the optimizer already (or not, when it is
+// turned off). Streaming runs declarations before the rest of the program is
+// known, so only this whole-program path is optimized.
+static void run_program(Statement **statements, size_t len_statements, const OptimizerStats *stats,
+                        const RunOptions *options, int *error_code)
+{
+    if (options->dump_ast)
+    {
+        for (size_t i = 0; i < len_statements; i++)
+        {
+            print_statement(statements[i]);
         }
+        printf("Hoisted %zu loop-invariant expressions, strength reduced %zu multiplications\n", stats->hoisted,
+               stats->strength_reduced);
+    }
+    if (strcmp(options->engine, "vm") == 0)
+    {
+        interpret_vm(statements, len_statements, options->debug, error_code);
+    }
+    else if (strcmp(options->engine, "closure") == 0)
+    {
+        resolve(statements, len_statements);
+        interpret_closure(statements, len_statements, error_code);
+    }
+    else
+    {
+        resolve(statements, len_statements);
+        interpret(statements, len_statements, options->use_jit, error_code);
     }
 }
 
@@ -83,19 +262,104 @@ int main(int argc, char *argv[])
 
     if (argc < 3)
     {
-        fprintf(stderr, "Usage: ./your_program tokenize <filename>\n");
+        fprintf(stderr, "Usage: ./clox {tokenize | parse | run | compile} [--engine=tree|vm|closure] [--jobs=N] [--stream | --pipeline] [--no-optimize] [--no-jit] [--no-cache] [--dump-ast] [--gc-stats] [--gc-nursery=KB] [--gc-growth=F] [-d] [-o out.c] <filename | ->\n");
         return 1;
     }
 
     const char *command = argv[1];
-
-    char *file_contents = read_file_contents(argv[2]);
+    const char *filename = NULL;
+    const char *engine = "tree";
     int debug = 0;
+    int jobs = 1;
+    int stream = 0;
+    int pipeline = 0;
+    int optimize_ast = 1;
+    int dump_ast = 0;
+    int use_jit = 1;
+    int use_cache = 1;
+    int gc_stats = 0;
+    long gc_nursery = GC_DEFAULT_NURSERY_SIZE / 1024;
+    double gc_growth = GC_DEFAULT_HEAP_GROWTH;
+    const char *output = NULL;
 
-    if (argc >= 4)
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0)
+        {
+            debug = 1;
+        }
+        else if (strncmp(argv[i], "--engine=", 9) == 0)
+        {
+            engine = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipeline = 1;
+        }
+        else if (strcmp(argv[i], "--no-optimize") == 0)
+        {
+            optimize_ast = 0;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+        {
+            use_cache = 0;
+        }
+        else if (strcmp(argv[i], "--no-jit") == 0)
+        {
+            use_jit = 0;
+        }
+        else if (strcmp(argv[i], "--dump-ast") == 0)
+        {
+            dump_ast = 1;
+        }
+        else if (strcmp(argv[i], "--gc-stats") == 0)
+        {
+            gc_stats = 1;
+        }
+        else if (strncmp(argv[i], "--gc-nursery=", 13) == 0)
+        {
+            gc_nursery = atol(argv[i] + 13);
+        }
+        else if (strncmp(argv[i], "--gc-growth=", 12) == 0)
+        {
+            gc_growth = atof(argv[i] + 12);
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            stream = 1;
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            jobs = atoi(argv[i] + 7);
+        }
+        else
+        {
+            filename = argv[i];
+        }
+    }
+    if (filename == NULL)
+    {
+        fprintf(stderr, "No input file given\n");
+        return 1;
+    }
+    if (strcmp(engine, "tree") != 0 && strcmp(engine, "vm") != 0 && strcmp(engine, "closure") != 0)
     {
-        debug = strcmp(argv[3], "-d") == 0;
+        fprintf(stderr, "Unknown engine: %s\n", engine);
+        return 1;
     }
+    if (gc_nursery <= 0 || gc_growth < 1)
+    {
+        fprintf(stderr, "The nursery needs at least 1 KB and the heap growth must be at least 1\n");
+        return 1;
+    }
+    configure_gc((size_t)gc_nursery * 1024, gc_growth);
+
+    SourceFile file = read_file_contents(filename);
+    RunOptions options = {engine, debug, use_jit, dump_ast};
     if (debug)
     {
         printf("COMMAND: %s\n", command);
@@ -103,71 +367,138 @@ int main(int argc, char *argv[])
     if (strcmp(command, "tokenize") == 0)
     {
 
-        Scanner *scanner = scanToken(file_contents);
+        Scanner *scanner = scanTokenParallel(file.chars, file.length, jobs, 0);
         print_tokens(scanner);
         if (scanner->had_error == 1)
         {
             error_code = 65;
         }
-        free(file_contents);
+        free_file_contents(&file);
         free_scanner(scanner);
     }
     else if (strcmp(command, "parse") == 0)
     {
-        Scanner *scanner = scanToken(file_contents);
+        Scanner *scanner = scanTokenParallel(file.chars, file.length, jobs, 1);
         print_tokens(scanner);
 
         if (scanner->number_tokens > 0)
         {
-            Parser *parser = init_parser(scanner->tokens, scanner->number_tokens);
+            Parser *parser = init_parser(scanner->source, scanner->tokens);
             size_t len_statements = 0;
-            Statement **statements = parse(parser, &len_statements, &error_code);
+            // Only the errors are reported, the tree itself is not printed
+            parse(parser, &len_statements, &error_code);
             if (error_code != 0)
             {
 
-                free_statements(statements, len_statements);
                 free_parser(parser);
                 free_scanner(scanner);
-                free(file_contents);
+                free_file_contents(&file);
                 return error_code;
             }
-            // for (size_t i = 0; i < len_statements; i++)
-            // {
-            //     print_statement(statements[i]);
-            // }
             free_parser(parser);
-            free_statements(statements, len_statements);
         }
-        free(file_contents);
+        free_file_contents(&file);
+        free_scanner(scanner);
+    }
+    else if (strcmp(command, "compile") == 0)
+    {
+        // C to stdout, or to the file given with -o
+        Scanner *scanner = scanTokenParallel(file.chars, file.length, jobs, 1);
+        Parser *parser = init_parser(scanner->source, scanner->tokens);
+        size_t len_statements = 0;
+        Statement **statements = parse(parser, &len_statements, &error_code);
+        if (error_code == 0)
+        {
+            FILE *out = output != NULL ? fopen(output, "w") : stdout;
+            if (out == NULL)
+            {
+                fprintf(stderr, "Cannot write %s: %s\n", output, strerror(errno));
+                error_code = 1;
+            }
+            else
+            {
+                resolve(statements, len_statements);
+                compile_c(statements, len_statements, out);
+                if (out != stdout)
+                {
+                    fclose(out);
+                }
+            }
+        }
+        free_parser(parser);
+        free_file_contents(&file);
         free_scanner(scanner);
     }
+    else if (strcmp(command, "run") == 0 && stream)
+    {
+        run_stream(&file, engine, debug, use_jit, &error_code);
+        free_file_contents(&file);
+    }
     else if (strcmp(command, "run") == 0)
     {
-        Scanner *scanner = scanToken(file_contents);
-        if (debug)
+        // A script run before, and not changed since, is loaded from its
+        // cache instead of being scanned and parsed. -d wants the tokens.
+        char *cache_path = use_cache && !debug && strcmp(filename, "-") != 0 ? ast_cache_path(filename) : NULL;
+        CachedProgram cached = {0};
+        if (cache_path != NULL && load_ast_cache(cache_path, file.chars, file.length, optimize_ast, &cached))
+        {
+            run_program(cached.statements, cached.len_statements, &cached.stats, &options, &error_code);
+            unload_ast_cache(&cached);
+            free(cache_path);
+            free_file_contents(&file);
+            if (gc_stats)
+            {
+                print_gc_stats(stderr);
+            }
+            free_objects();
+            return error_code;
+        }
+
+        // With --pipeline the tokens are scanned on another thread while the
+        // parser consumes them, and are only all there once parsing is done
+        Scanner *scanner = pipeline ? scanTokenPipelined(file.chars, file.length)
+                                    : scanTokenParallel(file.chars, file.length, jobs, 1);
+        if (debug && !pipeline)
         {
             print_tokens(scanner);
         }
-        if (scanner->number_tokens > 0)
+        if (pipeline || scanner->number_tokens > 0)
         {
-            Parser *parser = init_parser(scanner->tokens, scanner->number_tokens);
+            Parser *parser = pipeline ? init_parser_stream(scanner)
+                                      : init_parser(scanner->source, scanner->tokens);
             size_t len_statements = 0;
             Statement **statements = parse(parser, &len_statements, &error_code);
+            finish_scanning(scanner);
+            if (debug && pipeline)
+            {
+                print_tokens(scanner);
+            }
             if (error_code != 0)
             {
 
-                free_statements(statements, len_statements);
+                free(cache_path);
                 free_parser(parser);
                 free_scanner(scanner);
-                free(file_contents);
+                free_file_contents(&file);
                 return error_code;
             }
-            interpret(statements, len_statements, &error_code);
+            OptimizerStats stats = {0, 0};
+            if (optimize_ast)
+            {
+                optimize(statements, &len_statements, parser->arena, &stats);
+            }
+            // Saved before running, which rewrites the tree
+            if (cache_path != NULL)
+            {
+                save_ast_cache(cache_path, file.chars, file.length, statements, len_statements,
+                               optimize_ast ? &stats : NULL);
+            }
+            run_program(statements, len_statements, &stats, &options, &error_code);
 
             free_parser(parser);
-            free_statements(statements, len_statements);
         }
-        free(file_contents);
+        free(cache_path);
+        free_file_contents(&file);
         free_scanner(scanner);
     }
     else
@@ -176,6 +507,11 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (gc_stats)
+    {
+        print_gc_stats(stderr);
+    }
+    free_objects();
     // fprintf(stderr, "Exit code: %d\n", error_code);
     return error_code;
 }
@@ -0,0 +1,1382 @@
+#include <math.h>
+
+#include "optimizer.h"
+#include "gc.h"
+
+// Integers up to 2^53 add and multiply exactly as doubles
+#define EXACT_INTEGER_MAX 9007199254740992.0
+
+#define NO_BINDING ((size_t)-1)
+
+// A declared variable. It is constant once its initializer has folded to a
+// literal, as long as no assignment or second declaration of it is left in
+// the program.
+typedef struct
+{
+    ObjString *name;
+    Value value;
+    int is_constant;
+    size_t writes;   // assignments and redeclarations not pruned so far
+    size_t scope;    // how many blocks deep it was declared
+    size_t shadowed; // binding the name meant before this one, or NO_BINDING
+} Binding;
+
+// What a name means at this point of the walk
+typedef struct
+{
+    ObjString *name;
+    size_t binding; // innermost visible binding, or NO_BINDING
+} Name;
+
+typedef struct
+{
+    Arena *arena;
+    // Bindings in the order their declarations appear. Every walk declares
+    // them in that same order, so the n-th declaration is always binding n.
+    Binding *bindings;
+    size_t len_bindings;
+    size_t size_bindings;
+    size_t next_binding;
+    // Open addressing table of the names seen, keyed by their hash
+    Name *names;
+    size_t len_names;
+    size_t size_names;
+    // Bindings currently in scope, innermost last, and how many blocks deep
+    // the walk is
+    size_t *visible;
+    size_t len_visible;
+    size_t size_visible;
+    size_t scope;
+    size_t len_temporaries; // hidden locals created for loops, named $0, $1, ...
+    OptimizerStats stats;
+} Optimizer;
+
+// Names a loop declares or assigns anywhere inside it, including nested
+// loops, and how many places do. Open addressing, keyed by the name's hash.
+typedef struct
+{
+    ObjString **names;
+    size_t *counts;
+    size_t len_names;
+    size_t size_names;
+} LoopWrites;
+
+static void simplify_statement(Optimizer *optimizer, Statement *stmt);
+
+static int is_literal(Expression *expr)
+{
+    return expr != NULL && expr->type == EXPR_LITERAL;
+}
+
+// Line of the source expr was parsed from, 0 when it has none
+static int expression_line(Expression *expr)
+{
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+        return expr->as.line;
+    case EXPR_VARIABLE:
+    case EXPR_LOCAL:
+    case EXPR_GLOBAL:
+        return expr->as.variable.name->line;
+    case EXPR_ASSIGN:
+        return expr->as.assign.name->line;
+    case EXPR_INVARIANT:
+        return expression_line(expr->as.invariant.expr);
+    default:
+        if (expr->as.binary.operator != NULL)
+        {
+            return expr->as.binary.operator->line;
+        }
+        return expr->as.binary.left != NULL ? expression_line(expr->as.binary.left) : 0;
+    }
+}
+
+// The literal keeps the line of the expression it replaces
+static void make_literal(Expression *expr, Value value)
+{
+    int line = expression_line(expr);
+    expr->type = EXPR_LITERAL;
+    expr->as.value = value;
+    expr->as.line = line;
+}
+
+// Turns stmt into an empty block, which blocks then drop
+static void make_empty(Optimizer *optimizer, Statement *stmt)
+{
+    Block *blk = arena_alloc(optimizer->arena, sizeof(Block));
+    blk->statements = NULL;
+    blk->len_statements = 0;
+    blk->len_locals = 0;
+    stmt->type = STMT_BLOCK;
+    stmt->data.block = blk;
+}
+
+static int is_empty(Statement *stmt)
+{
+    return stmt->type == STMT_BLOCK && stmt->data.block->len_statements == 0;
+}
+
+// Computes the value of an operator applied to two literals, the way
+// visitBinaryExpr does. Returns 0 when it would be a runtime error, which is
+// then left for the interpreter to report.
+static int fold_binary(TokenType operator, Value left, Value right, Value *result)
+{
+    int numbers = IS_NUMBER(left) && IS_NUMBER(right);
+    switch (operator)
+    {
+    case EQUAL_EQUAL:
+        *result = BOOL_VAL(values_equal(left, right));
+        return 1;
+    case BANG_EQUAL:
+        *result = BOOL_VAL(!values_equal(left, right));
+        return 1;
+    case PLUS:
+        if (IS_STRING(left) && IS_STRING(right))
+        {
+            // The tree keeps the result, so it must not be collected
+            *result = concatenate_strings(left, right);
+            if (IS_OBJ(*result))
+            {
+                *result = OBJ_VAL(make_permanent(AS_STRING(*result)));
+            }
+            return 1;
+        }
+        if (numbers)
+        {
+            *result = NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+        }
+        return numbers;
+    default:
+        break;
+    }
+    if (!numbers)
+    {
+        return 0;
+    }
+    double a = AS_NUMBER(left), b = AS_NUMBER(right);
+    switch (operator)
+    {
+    case GREATER:
+        *result = BOOL_VAL(a > b);
+        return 1;
+    case GREATER_EQUAL:
+        *result = BOOL_VAL(a >= b);
+        return 1;
+    case LESS:
+        *result = BOOL_VAL(a < b);
+        return 1;
+    case LESS_EQUAL:
+        *result = BOOL_VAL(a <= b);
+        return 1;
+    case MINUS:
+        *result = NUMBER_VAL(a - b);
+        return 1;
+    case STAR:
+        *result = NUMBER_VAL(a * b);
+        return 1;
+    case SLASH:
+        *result = NUMBER_VAL(a / b);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Finds the entry of a name, adding it when missing. Names are interned, so
+// they are compared by address.
+static Name *find_name(Optimizer *optimizer, ObjString *name)
+{
+    if ((optimizer->len_names + 1) * 2 > optimizer->size_names)
+    {
+        size_t size = optimizer->size_names == 0 ? 64 : optimizer->size_names * 2;
+        Name *names = calloc(size, sizeof(Name));
+        for (size_t i = 0; i < optimizer->size_names; i++)
+        {
+            if (optimizer->names[i].name == NULL)
+            {
+                continue;
+            }
+            size_t bucket = optimizer->names[i].name->hash & (size - 1);
+            while (names[bucket].name != NULL)
+            {
+                bucket = (bucket + 1) & (size - 1);
+            }
+            names[bucket] = optimizer->names[i];
+        }
+        free(optimizer->names);
+        optimizer->names = names;
+        optimizer->size_names = size;
+    }
+    size_t bucket = name->hash & (optimizer->size_names - 1);
+    while (optimizer->names[bucket].name != name)
+    {
+        if (optimizer->names[bucket].name == NULL)
+        {
+            optimizer->names[bucket].name = name;
+            optimizer->names[bucket].binding = NO_BINDING;
+            optimizer->len_names++;
+            break;
+        }
+        bucket = (bucket + 1) & (optimizer->size_names - 1);
+    }
+    return &optimizer->names[bucket];
+}
+
+// Finds the binding a name refers to, the same way the resolver will
+static Binding *lookup_binding(Optimizer *optimizer, ObjString *name)
+{
+    size_t binding = find_name(optimizer, name)->binding;
+    return binding == NO_BINDING ? NULL : &optimizer->bindings[binding];
+}
+
+// Declaring a name again in the same block reuses the variable, and sets
+// *redeclared
+static Binding *declare_binding(Optimizer *optimizer, ObjString *name, int *redeclared)
+{
+    Name *entry = find_name(optimizer, name);
+    *redeclared = entry->binding != NO_BINDING && optimizer->bindings[entry->binding].scope == optimizer->scope;
+    if (*redeclared)
+    {
+        return &optimizer->bindings[entry->binding];
+    }
+    if (optimizer->next_binding == optimizer->len_bindings)
+    {
+        if (optimizer->len_bindings >= optimizer->size_bindings)
+        {
+            optimizer->size_bindings = optimizer->size_bindings == 0 ? 64 : optimizer->size_bindings * 2;
+            optimizer->bindings = realloc(optimizer->bindings, optimizer->size_bindings * sizeof(Binding));
+        }
+        Binding *binding = &optimizer->bindings[optimizer->len_bindings++];
+        binding->name = name;
+        binding->value = NIL_VAL;
+        binding->is_constant = 0;
+        binding->writes = 0;
+    }
+    if (optimizer->len_visible >= optimizer->size_visible)
+    {
+        optimizer->size_visible = optimizer->size_visible == 0 ? 64 : optimizer->size_visible * 2;
+        optimizer->visible = realloc(optimizer->visible, optimizer->size_visible * sizeof(size_t));
+    }
+    Binding *binding = &optimizer->bindings[optimizer->next_binding];
+    binding->scope = optimizer->scope;
+    binding->shadowed = entry->binding;
+    entry->binding = optimizer->next_binding;
+    optimizer->visible[optimizer->len_visible++] = optimizer->next_binding++;
+    return binding;
+}
+
+static void begin_binding_scope(Optimizer *optimizer)
+{
+    optimizer->scope++;
+}
+
+// Gives the names declared in the block back their outer meaning
+static void end_binding_scope(Optimizer *optimizer)
+{
+    while (optimizer->len_visible > 0)
+    {
+        Binding *binding = &optimizer->bindings[optimizer->visible[optimizer->len_visible - 1]];
+        if (binding->scope != optimizer->scope)
+        {
+            break;
+        }
+        find_name(optimizer, binding->name)->binding = binding->shadowed;
+        optimizer->len_visible--;
+    }
+    optimizer->scope--;
+}
+
+// Adds delta to the writes of every variable expr assigns
+static void count_expression(Optimizer *optimizer, Expression *expr, int delta)
+{
+    if (expr == NULL)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_BINARY:
+    case EXPR_GROUPING:
+    case EXPR_UNARY:
+        count_expression(optimizer, expr->as.binary.left, delta);
+        count_expression(optimizer, expr->as.binary.right, delta);
+        break;
+    case EXPR_ASSIGN:
+    {
+        count_expression(optimizer, expr->as.assign.value, delta);
+        Binding *binding = lookup_binding(optimizer, expr->as.assign.identifier);
+        if (binding != NULL)
+        {
+            binding->writes += delta;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Declares the bindings of stmt, and adds delta to the writes of every
+// variable it assigns or declares again. Counting up before simplifying
+// finds the writes of the whole program, counting down takes back those of
+// code simplifying drops.
+static void count_statement(Optimizer *optimizer, Statement *stmt, int delta)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        count_expression(optimizer, stmt->data.expr.expression, delta);
+        break;
+    case STMT_PRINT:
+        count_expression(optimizer, stmt->data.print.expression, delta);
+        break;
+    case STMT_VAR:
+    {
+        count_expression(optimizer, stmt->data.var.initializer, delta);
+        int redeclared;
+        Binding *binding = declare_binding(optimizer, stmt->data.var.identifier, &redeclared);
+        if (redeclared)
+        {
+            binding->writes += delta;
+        }
+        break;
+    }
+    case STMT_BLOCK:
+        begin_binding_scope(optimizer);
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            count_statement(optimizer, stmt->data.block->statements[i], delta);
+        }
+        end_binding_scope(optimizer);
+        break;
+    case STMT_IF:
+        count_expression(optimizer, stmt->data.if_stmt.condition, delta);
+        count_statement(optimizer, stmt->data.if_stmt.thenBranch, delta);
+        count_statement(optimizer, stmt->data.if_stmt.elseBranch, delta);
+        break;
+    case STMT_WHILE:
+        count_expression(optimizer, stmt->data.while_stmt.condition, delta);
+        count_statement(optimizer, stmt->data.while_stmt.body, delta);
+        break;
+    case STMT_FOR:
+        begin_binding_scope(optimizer);
+        count_statement(optimizer, stmt->data.for_stmt.initializer, delta);
+        count_expression(optimizer, stmt->data.for_stmt.condition, delta);
+        count_expression(optimizer, stmt->data.for_stmt.increment, delta);
+        count_statement(optimizer, stmt->data.for_stmt.body, delta);
+        end_binding_scope(optimizer);
+        break;
+    default:
+        break;
+    }
+}
+
+// Folds expressions made only of literals, and replaces reads of constant
+// variables by their value on the way
+static void fold_expression(Optimizer *optimizer, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_VARIABLE:
+    {
+        Binding *binding = lookup_binding(optimizer, expr->as.variable.identifier);
+        if (binding != NULL && binding->is_constant && binding->writes == 0)
+        {
+            make_literal(expr, binding->value);
+        }
+        break;
+    }
+    case EXPR_GROUPING:
+        fold_expression(optimizer, expr->as.binary.left);
+        if (is_literal(expr->as.binary.left))
+        {
+            make_literal(expr, expr->as.binary.left->as.value);
+        }
+        break;
+    case EXPR_UNARY:
+    {
+        Expression *right = expr->as.binary.right;
+        fold_expression(optimizer, right);
+        if (!is_literal(right))
+        {
+            break;
+        }
+        if (expr->as.binary.operator->type == BANG)
+        {
+            make_literal(expr, BOOL_VAL(!is_truthy(right->as.value)));
+        }
+        else if (IS_NUMBER(right->as.value))
+        {
+            make_literal(expr, NUMBER_VAL(-AS_NUMBER(right->as.value)));
+        }
+        break;
+    }
+    case EXPR_BINARY:
+    {
+        Expression *left = expr->as.binary.left;
+        Expression *right = expr->as.binary.right;
+        TokenType operator = expr->as.binary.operator->type;
+        fold_expression(optimizer, left);
+        if ((operator == OR || operator == AND) && is_literal(left))
+        {
+            // A literal left operand decides whether the right one runs
+            if (is_truthy(left->as.value) == (operator == OR))
+            {
+                count_expression(optimizer, right, -1);
+                make_literal(expr, left->as.value);
+            }
+            else
+            {
+                fold_expression(optimizer, right);
+                *expr = *right;
+            }
+            break;
+        }
+        fold_expression(optimizer, right);
+        Value result;
+        if (is_literal(left) && is_literal(right) && fold_binary(operator, left->as.value, right->as.value, &result))
+        {
+            make_literal(expr, result);
+        }
+        break;
+    }
+    case EXPR_ASSIGN:
+        fold_expression(optimizer, expr->as.assign.value);
+        break;
+    default:
+        break;
+    }
+}
+
+// Simplifies every statement and drops the ones left empty
+static void simplify_statements(Optimizer *optimizer, Statement **statements, size_t *len_statements)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < *len_statements; i++)
+    {
+        simplify_statement(optimizer, statements[i]);
+        if (!is_empty(statements[i]))
+        {
+            statements[len++] = statements[i];
+        }
+    }
+    *len_statements = len;
+}
+
+// Walks the program in source order, so a variable's initializer has folded
+// by the time the reads after it are reached. Only those reads are bound to
+// it, earlier ones are runtime errors or refer to an outer variable.
+static void simplify_statement(Optimizer *optimizer, Statement *stmt)
+{
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        fold_expression(optimizer, stmt->data.expr.expression);
+        break;
+    case STMT_PRINT:
+        fold_expression(optimizer, stmt->data.print.expression);
+        break;
+    case STMT_VAR:
+    {
+        Expression *initializer = stmt->data.var.initializer;
+        fold_expression(optimizer, initializer);
+        int redeclared;
+        Binding *binding = declare_binding(optimizer, stmt->data.var.identifier, &redeclared);
+        if (!redeclared && is_literal(initializer))
+        {
+            binding->is_constant = 1;
+            binding->value = initializer->as.value;
+        }
+        break;
+    }
+    case STMT_BLOCK:
+        begin_binding_scope(optimizer);
+        simplify_statements(optimizer, stmt->data.block->statements, &stmt->data.block->len_statements);
+        end_binding_scope(optimizer);
+        break;
+    case STMT_IF:
+    {
+        Expression *condition = stmt->data.if_stmt.condition;
+        Statement *thenBranch = stmt->data.if_stmt.thenBranch;
+        Statement *elseBranch = stmt->data.if_stmt.elseBranch;
+        fold_expression(optimizer, condition);
+        if (!is_literal(condition))
+        {
+            simplify_statement(optimizer, thenBranch);
+            if (elseBranch != NULL)
+            {
+                simplify_statement(optimizer, elseBranch);
+            }
+        }
+        else if (is_truthy(condition->as.value))
+        {
+            simplify_statement(optimizer, thenBranch);
+            count_statement(optimizer, elseBranch, -1);
+            *stmt = *thenBranch;
+        }
+        else
+        {
+            count_statement(optimizer, thenBranch, -1);
+            if (elseBranch != NULL)
+            {
+                simplify_statement(optimizer, elseBranch);
+                *stmt = *elseBranch;
+            }
+            else
+            {
+                make_empty(optimizer, stmt);
+            }
+        }
+        break;
+    }
+    case STMT_WHILE:
+        fold_expression(optimizer, stmt->data.while_stmt.condition);
+        if (is_literal(stmt->data.while_stmt.condition) && !is_truthy(stmt->data.while_stmt.condition->as.value))
+        {
+            count_statement(optimizer, stmt->data.while_stmt.body, -1);
+            make_empty(optimizer, stmt);
+        }
+        else
+        {
+            simplify_statement(optimizer, stmt->data.while_stmt.body);
+        }
+        break;
+    case STMT_FOR:
+    {
+        begin_binding_scope(optimizer);
+        // The initializer runs even when the loop body never does
+        if (stmt->data.for_stmt.initializer != NULL)
+        {
+            simplify_statement(optimizer, stmt->data.for_stmt.initializer);
+        }
+        Expression *condition = stmt->data.for_stmt.condition;
+        fold_expression(optimizer, condition);
+        if (is_literal(condition) && !is_truthy(condition->as.value))
+        {
+            count_expression(optimizer, stmt->data.for_stmt.increment, -1);
+            count_statement(optimizer, stmt->data.for_stmt.body, -1);
+            make_empty(optimizer, stmt->data.for_stmt.body);
+            stmt->data.for_stmt.increment = NULL;
+        }
+        else
+        {
+            fold_expression(optimizer, stmt->data.for_stmt.increment);
+            simplify_statement(optimizer, stmt->data.for_stmt.body);
+            if (is_literal(condition))
+            {
+                stmt->data.for_stmt.condition = NULL;
+            }
+        }
+        end_binding_scope(optimizer);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void add_loop_write(LoopWrites *writes, ObjString *name)
+{
+    if ((writes->len_names + 1) * 2 > writes->size_names)
+    {
+        size_t size = writes->size_names == 0 ? 16 : writes->size_names * 2;
+        ObjString **names = calloc(size, sizeof(ObjString *));
+        size_t *counts = calloc(size, sizeof(size_t));
+        for (size_t i = 0; i < writes->size_names; i++)
+        {
+            if (writes->names[i] == NULL)
+            {
+                continue;
+            }
+            size_t bucket = writes->names[i]->hash & (size - 1);
+            while (names[bucket] != NULL)
+            {
+                bucket = (bucket + 1) & (size - 1);
+            }
+            names[bucket] = writes->names[i];
+            counts[bucket] = writes->counts[i];
+        }
+        free(writes->names);
+        free(writes->counts);
+        writes->names = names;
+        writes->counts = counts;
+        writes->size_names = size;
+    }
+    size_t bucket = name->hash & (writes->size_names - 1);
+    while (writes->names[bucket] != NULL && writes->names[bucket] != name)
+    {
+        bucket = (bucket + 1) & (writes->size_names - 1);
+    }
+    if (writes->names[bucket] == NULL)
+    {
+        writes->names[bucket] = name;
+        writes->len_names++;
+    }
+    writes->counts[bucket]++;
+}
+
+static size_t count_loop_writes(LoopWrites *writes, ObjString *name)
+{
+    if (writes->size_names == 0)
+    {
+        return 0;
+    }
+    size_t bucket = name->hash & (writes->size_names - 1);
+    while (writes->names[bucket] != NULL)
+    {
+        if (writes->names[bucket] == name)
+        {
+            return writes->counts[bucket];
+        }
+        bucket = (bucket + 1) & (writes->size_names - 1);
+    }
+    return 0;
+}
+
+static void free_loop_writes(LoopWrites *writes)
+{
+    free(writes->names);
+    free(writes->counts);
+    writes->names = NULL;
+    writes->counts = NULL;
+}
+
+static void collect_writes_expression(LoopWrites *writes, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_BINARY:
+    case EXPR_GROUPING:
+    case EXPR_UNARY:
+        collect_writes_expression(writes, expr->as.binary.left);
+        collect_writes_expression(writes, expr->as.binary.right);
+        break;
+    case EXPR_ASSIGN:
+        collect_writes_expression(writes, expr->as.assign.value);
+        add_loop_write(writes, expr->as.assign.identifier);
+        break;
+    case EXPR_INVARIANT:
+        collect_writes_expression(writes, expr->as.invariant.expr);
+        break;
+    default:
+        break;
+    }
+}
+
+static void collect_writes_statement(LoopWrites *writes, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        collect_writes_expression(writes, stmt->data.expr.expression);
+        break;
+    case STMT_PRINT:
+        collect_writes_expression(writes, stmt->data.print.expression);
+        break;
+    case STMT_VAR:
+        collect_writes_expression(writes, stmt->data.var.initializer);
+        add_loop_write(writes, stmt->data.var.identifier);
+        break;
+    case STMT_BLOCK:
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            collect_writes_statement(writes, stmt->data.block->statements[i]);
+        }
+        break;
+    case STMT_IF:
+        collect_writes_expression(writes, stmt->data.if_stmt.condition);
+        collect_writes_statement(writes, stmt->data.if_stmt.thenBranch);
+        collect_writes_statement(writes, stmt->data.if_stmt.elseBranch);
+        break;
+    case STMT_WHILE:
+        collect_writes_expression(writes, stmt->data.while_stmt.condition);
+        collect_writes_statement(writes, stmt->data.while_stmt.body);
+        break;
+    case STMT_FOR:
+        collect_writes_statement(writes, stmt->data.for_stmt.initializer);
+        collect_writes_expression(writes, stmt->data.for_stmt.condition);
+        collect_writes_expression(writes, stmt->data.for_stmt.increment);
+        collect_writes_statement(writes, stmt->data.for_stmt.body);
+        break;
+    default:
+        break;
+    }
+}
+
+static LoopWrites collect_loop_writes(Statement *loop)
+{
+    LoopWrites writes = {NULL, NULL, 0, 0};
+    collect_writes_statement(&writes, loop);
+    return writes;
+}
+
+static ObjString *new_temporary(Optimizer *optimizer)
+{
+    char name[32];
+    int length = snprintf(name, sizeof(name), "$%zu", optimizer->len_temporaries++);
+    return copy_string(name, (size_t)length);
+}
+
+// Tokens for the nodes the loop passes create, which have no source text
+static Token *make_token(Optimizer *optimizer, TokenType type, int line, ObjString *symbol)
+{
+    Token *token = arena_alloc(optimizer->arena, sizeof(Token));
+    token->type = type;
+    token->line = line;
+    token->start = 0;
+    token->length = 0;
+    token->symbol = symbol;
+    return token;
+}
+
+static Expression *new_expression(Optimizer *optimizer, ExpressionType type)
+{
+    Expression *expr = arena_alloc(optimizer->arena, sizeof(Expression));
+    expr->type = type;
+    return expr;
+}
+
+static Expression *new_literal(Optimizer *optimizer, Value value, int line)
+{
+    Expression *expr = new_expression(optimizer, EXPR_LITERAL);
+    expr->as.value = value;
+    expr->as.line = line;
+    return expr;
+}
+
+static void make_variable(Expression *expr, Token *name)
+{
+    expr->type = EXPR_VARIABLE;
+    expr->as.variable.name = name;
+    expr->as.variable.identifier = name->symbol;
+    expr->as.variable.depth = -1;
+    expr->as.variable.slot = -1;
+}
+
+static Statement *new_var(Optimizer *optimizer, Token *name, Value value)
+{
+    Statement *stmt = arena_alloc(optimizer->arena, sizeof(Statement));
+    stmt->type = STMT_VAR;
+    stmt->data.var.name = name;
+    stmt->data.var.identifier = name->symbol;
+    stmt->data.var.initializer = new_literal(optimizer, value, name->line);
+    stmt->data.var.slot = -1;
+    return stmt;
+}
+
+// Moves loop into a new block that first declares the given hidden locals,
+// so they are set up again every time the loop statement runs
+static void wrap_loop(Optimizer *optimizer, Statement *loop, Statement **declarations, size_t len_declarations)
+{
+    Statement *moved = arena_alloc(optimizer->arena, sizeof(Statement));
+    *moved = *loop;
+    Statement **statements = arena_alloc(optimizer->arena, (len_declarations + 1) * sizeof(Statement *));
+    memcpy(statements, declarations, len_declarations * sizeof(Statement *));
+    statements[len_declarations] = moved;
+    Block *blk = arena_alloc(optimizer->arena, sizeof(Block));
+    blk->statements = statements;
+    blk->len_statements = len_declarations + 1;
+    blk->len_locals = 0;
+    loop->type = STMT_BLOCK;
+    loop->data.block = blk;
+}
+
+static int integer_literal(Expression *expr, double *number)
+{
+    if (!is_literal(expr) || !IS_NUMBER(expr->as.value))
+    {
+        return 0;
+    }
+    *number = AS_NUMBER(expr->as.value);
+    return floor(*number) == *number && fabs(*number) < EXACT_INTEGER_MAX;
+}
+
+// Matches `name + step` or `name - step` with an integer step
+static int expression_induction_step(Expression *value, ObjString *name, double *step)
+{
+    if (value->type != EXPR_BINARY || value->as.binary.left->type != EXPR_VARIABLE ||
+        value->as.binary.left->as.variable.identifier != name || !integer_literal(value->as.binary.right, step))
+    {
+        return 0;
+    }
+    TokenType operator = value->as.binary.operator->type;
+    if (operator == MINUS)
+    {
+        *step = -*step;
+    }
+    return operator == PLUS || operator == MINUS;
+}
+
+// Matches `name = name + step` (or `- step`) with an integer step
+static int induction_step(Statement *stmt, ObjString *name, double *step)
+{
+    if (stmt == NULL || stmt->type != STMT_EXPR)
+    {
+        return 0;
+    }
+    Expression *expr = stmt->data.expr.expression;
+    if (expr->type != EXPR_ASSIGN || expr->as.assign.identifier != name)
+    {
+        return 0;
+    }
+    return expression_induction_step(expr->as.assign.value, name, step);
+}
+
+// Matches `name = start` or `var name = start` with an integer start
+static ObjString *induction_start(Statement *stmt, double *start)
+{
+    if (stmt == NULL)
+    {
+        return NULL;
+    }
+    if (stmt->type == STMT_VAR)
+    {
+        return integer_literal(stmt->data.var.initializer, start) ? stmt->data.var.identifier : NULL;
+    }
+    if (stmt->type == STMT_EXPR && stmt->data.expr.expression->type == EXPR_ASSIGN)
+    {
+        Expression *assign = stmt->data.expr.expression;
+        return integer_literal(assign->as.assign.value, start) ? assign->as.assign.identifier : NULL;
+    }
+    return NULL;
+}
+
+// Matches a condition that ends the loop once the counter, moving by step,
+// gets past a number literal: `counter < bound` or `counter <= bound` when it
+// counts up, `>` or `>=` when it counts down, either way round
+static int loop_bound(Expression *condition, ObjString *counter, double step, double *bound)
+{
+    if (condition == NULL || condition->type != EXPR_BINARY)
+    {
+        return 0;
+    }
+    Expression *variable = condition->as.binary.left, *literal = condition->as.binary.right;
+    TokenType operator = condition->as.binary.operator->type;
+    if (is_literal(variable))
+    {
+        // `bound > counter` is `counter < bound`
+        variable = condition->as.binary.right;
+        literal = condition->as.binary.left;
+        operator = operator == LESS ? GREATER : operator == LESS_EQUAL ? GREATER_EQUAL
+                 : operator == GREATER ? LESS : operator == GREATER_EQUAL ? LESS_EQUAL : operator;
+    }
+    if (variable->type != EXPR_VARIABLE || variable->as.variable.identifier != counter || !is_literal(literal) ||
+        !IS_NUMBER(literal->as.value))
+    {
+        return 0;
+    }
+    *bound = AS_NUMBER(literal->as.value);
+    int upper = operator == LESS || operator == LESS_EQUAL;
+    int lower = operator == GREATER || operator == GREATER_EQUAL;
+    return step > 0 ? upper : step < 0 ? lower : upper || lower;
+}
+
+// A product of the counter and a positive integer. A negative factor could
+// make the product -0 where the running sum is 0. Products are only reduced
+// when factor * limit is exact, limit bounding the counter.
+typedef struct
+{
+    ObjString *counter;
+    double limit;
+    double factors[8];
+    Token *names[8];
+    size_t len_factors;
+    size_t reduced;
+} Reduction;
+
+static Token *reduction_for(Optimizer *optimizer, Reduction *reduction, double factor, int line)
+{
+    for (size_t i = 0; i < reduction->len_factors; i++)
+    {
+        if (reduction->factors[i] == factor)
+        {
+            return reduction->names[i];
+        }
+    }
+    if (reduction->len_factors == sizeof(reduction->factors) / sizeof(reduction->factors[0]))
+    {
+        return NULL;
+    }
+    reduction->factors[reduction->len_factors] = factor;
+    reduction->names[reduction->len_factors] = make_token(optimizer, IDENTIFIER, line, new_temporary(optimizer));
+    return reduction->names[reduction->len_factors++];
+}
+
+static void reduce_expression(Optimizer *optimizer, Reduction *reduction, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_BINARY:
+    {
+        Expression *left = expr->as.binary.left, *right = expr->as.binary.right;
+        double factor;
+        if (expr->as.binary.operator->type == STAR)
+        {
+            Expression *counter = left->type == EXPR_VARIABLE ? left : right;
+            Expression *other = counter == left ? right : left;
+            if (counter->type == EXPR_VARIABLE && counter->as.variable.identifier == reduction->counter &&
+                integer_literal(other, &factor) && factor > 0 && factor * reduction->limit < EXACT_INTEGER_MAX)
+            {
+                Token *name = reduction_for(optimizer, reduction, factor, expr->as.binary.operator->line);
+                if (name != NULL)
+                {
+                    make_variable(expr, name);
+                    reduction->reduced++;
+                    return;
+                }
+            }
+        }
+        reduce_expression(optimizer, reduction, left);
+        reduce_expression(optimizer, reduction, right);
+        break;
+    }
+    case EXPR_GROUPING:
+    case EXPR_UNARY:
+        reduce_expression(optimizer, reduction, expr->as.binary.left);
+        reduce_expression(optimizer, reduction, expr->as.binary.right);
+        break;
+    case EXPR_ASSIGN:
+        reduce_expression(optimizer, reduction, expr->as.assign.value);
+        break;
+    default:
+        break;
+    }
+}
+
+static void reduce_statement(Optimizer *optimizer, Reduction *reduction, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        reduce_expression(optimizer, reduction, stmt->data.expr.expression);
+        break;
+    case STMT_PRINT:
+        reduce_expression(optimizer, reduction, stmt->data.print.expression);
+        break;
+    case STMT_VAR:
+        reduce_expression(optimizer, reduction, stmt->data.var.initializer);
+        break;
+    case STMT_BLOCK:
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            reduce_statement(optimizer, reduction, stmt->data.block->statements[i]);
+        }
+        break;
+    case STMT_IF:
+        reduce_expression(optimizer, reduction, stmt->data.if_stmt.condition);
+        reduce_statement(optimizer, reduction, stmt->data.if_stmt.thenBranch);
+        reduce_statement(optimizer, reduction, stmt->data.if_stmt.elseBranch);
+        break;
+    case STMT_WHILE:
+        reduce_expression(optimizer, reduction, stmt->data.while_stmt.condition);
+        reduce_statement(optimizer, reduction, stmt->data.while_stmt.body);
+        break;
+    case STMT_FOR:
+        reduce_statement(optimizer, reduction, stmt->data.for_stmt.initializer);
+        reduce_expression(optimizer, reduction, stmt->data.for_stmt.condition);
+        reduce_expression(optimizer, reduction, stmt->data.for_stmt.increment);
+        reduce_statement(optimizer, reduction, stmt->data.for_stmt.body);
+        break;
+    default:
+        break;
+    }
+}
+
+static Expression *init_sum(Optimizer *optimizer, Expression *left, Expression *right, int line)
+{
+    Expression *sum = new_expression(optimizer, EXPR_BINARY);
+    sum->as.binary.left = left;
+    sum->as.binary.operator = make_token(optimizer, PLUS, line, NULL);
+    sum->as.binary.right = right;
+    return sum;
+}
+
+// `$k = $k + step * factor` for every reduced product
+static void add_reduction_updates(Optimizer *optimizer, Reduction *reduction, double step, Statement **updates)
+{
+    for (size_t i = 0; i < reduction->len_factors; i++)
+    {
+        Token *name = reduction->names[i];
+        Expression *sum = new_expression(optimizer, EXPR_VARIABLE);
+        make_variable(sum, name);
+        Expression *increment = new_literal(optimizer, NUMBER_VAL(step * reduction->factors[i]), name->line);
+        sum = init_sum(optimizer, sum, increment, name->line);
+        Expression *assign = new_expression(optimizer, EXPR_ASSIGN);
+        assign->as.assign.name = name;
+        assign->as.assign.identifier = name->symbol;
+        assign->as.assign.value = sum;
+        assign->as.assign.depth = -1;
+        assign->as.assign.slot = -1;
+        Statement *stmt = arena_alloc(optimizer->arena, sizeof(Statement));
+        stmt->type = STMT_EXPR;
+        stmt->data.expr.expression = assign;
+        updates[i] = stmt;
+    }
+}
+
+// Keeps every product of a counter and a constant in a hidden local that
+// grows by a constant each time the counter does. The counter must start
+// from an integer set right before the loop (or in a for initializer),
+// change only by an integer step, once per iteration, and be compared with a
+// literal bound by the loop condition. It then never gets further from 0
+// than the start, or the bound plus one step, and a product is only reduced
+// when that times its factor is below 2^53, so that every value both forms
+// compute is an exact integer and they agree. Returns whether loop was
+// rewritten.
+static int reduce_loop(Optimizer *optimizer, Statement *loop, Statement *previous)
+{
+    double start = 0, step = 0;
+    ObjString *counter;
+    Statement *body;
+    size_t step_index = 0;
+    LoopWrites writes = collect_loop_writes(loop);
+    if (loop->type == STMT_FOR)
+    {
+        counter = induction_start(loop->data.for_stmt.initializer, &start);
+        Expression *increment = loop->data.for_stmt.increment;
+        if (counter == NULL || increment == NULL || increment->type != EXPR_ASSIGN ||
+            increment->as.assign.identifier != counter ||
+            !expression_induction_step(increment->as.assign.value, counter, &step) ||
+            count_loop_writes(&writes, counter) != 2)
+        {
+            free_loop_writes(&writes);
+            return 0;
+        }
+        body = loop->data.for_stmt.body;
+    }
+    else
+    {
+        counter = induction_start(previous, &start);
+        body = loop->data.while_stmt.body;
+        if (counter == NULL || body->type != STMT_BLOCK || count_loop_writes(&writes, counter) != 1)
+        {
+            free_loop_writes(&writes);
+            return 0;
+        }
+        // The single write has to be the step, made on every iteration
+        Block *blk = body->data.block;
+        while (step_index < blk->len_statements && !induction_step(blk->statements[step_index], counter, &step))
+        {
+            step_index++;
+        }
+        if (step_index == blk->len_statements)
+        {
+            free_loop_writes(&writes);
+            return 0;
+        }
+    }
+    free_loop_writes(&writes);
+
+    // The condition is then only the comparison, with no product to reduce
+    double bound;
+    if (!loop_bound(loop->type == STMT_FOR ? loop->data.for_stmt.condition : loop->data.while_stmt.condition,
+                    counter, step, &bound))
+    {
+        return 0;
+    }
+    Reduction reduction = {counter, fmax(fabs(start), fabs(bound) + fabs(step)), {0}, {NULL}, 0, 0};
+    reduce_statement(optimizer, &reduction, body);
+    if (reduction.reduced == 0)
+    {
+        return 0;
+    }
+
+    Statement *updates[8], *declarations[8];
+    add_reduction_updates(optimizer, &reduction, step, updates);
+    for (size_t i = 0; i < reduction.len_factors; i++)
+    {
+        declarations[i] = new_var(optimizer, reduction.names[i], NUMBER_VAL(start * reduction.factors[i]));
+    }
+    if (loop->type == STMT_FOR)
+    {
+        // There is no continue, so the end of the body always runs right
+        // before the increment
+        Statement **statements = arena_alloc(optimizer->arena, (reduction.len_factors + 1) * sizeof(Statement *));
+        statements[0] = body;
+        memcpy(statements + 1, updates, reduction.len_factors * sizeof(Statement *));
+        Block *blk = arena_alloc(optimizer->arena, sizeof(Block));
+        blk->statements = statements;
+        blk->len_statements = reduction.len_factors + 1;
+        blk->len_locals = 0;
+        Statement *new_body = arena_alloc(optimizer->arena, sizeof(Statement));
+        new_body->type = STMT_BLOCK;
+        new_body->data.block = blk;
+        loop->data.for_stmt.body = new_body;
+    }
+    else
+    {
+        // Right after the step, so the products follow the counter
+        Block *blk = body->data.block;
+        size_t len = blk->len_statements + reduction.len_factors;
+        Statement **statements = arena_alloc(optimizer->arena, len * sizeof(Statement *));
+        memcpy(statements, blk->statements, (step_index + 1) * sizeof(Statement *));
+        memcpy(statements + step_index + 1, updates, reduction.len_factors * sizeof(Statement *));
+        memcpy(statements + step_index + 1 + reduction.len_factors, blk->statements + step_index + 1,
+               (blk->len_statements - step_index - 1) * sizeof(Statement *));
+        blk->statements = statements;
+        blk->len_statements = len;
+    }
+    wrap_loop(optimizer, loop, declarations, reduction.len_factors);
+    optimizer->stats.strength_reduced += reduction.reduced;
+    return 1;
+}
+
+// Hidden locals declared for the loop being hoisted from
+typedef struct
+{
+    LoopWrites writes;
+    Statement **declarations;
+    size_t len_declarations;
+    size_t size_declarations;
+} Hoisting;
+
+// Only operators are worth a cache lookup, a bare variable or literal is not
+static int worth_hoisting(Expression *expr)
+{
+    if (expr->type == EXPR_GROUPING)
+    {
+        return worth_hoisting(expr->as.binary.left);
+    }
+    return expr->type == EXPR_BINARY || expr->type == EXPR_UNARY;
+}
+
+static void hoist(Optimizer *optimizer, Hoisting *hoisting, Expression *expr)
+{
+    if (!worth_hoisting(expr))
+    {
+        return;
+    }
+    Token *name = make_token(optimizer, IDENTIFIER, expression_line(expr), new_temporary(optimizer));
+    Expression *moved = new_expression(optimizer, expr->type);
+    *moved = *expr;
+    expr->type = EXPR_INVARIANT;
+    expr->as.invariant.expr = moved;
+    expr->as.invariant.identifier = name->symbol;
+    expr->as.invariant.depth = -1;
+    expr->as.invariant.slot = -1;
+    if (hoisting->len_declarations >= hoisting->size_declarations)
+    {
+        hoisting->size_declarations = hoisting->size_declarations == 0 ? 8 : hoisting->size_declarations * 2;
+        hoisting->declarations = realloc(hoisting->declarations, hoisting->size_declarations * sizeof(Statement *));
+    }
+    hoisting->declarations[hoisting->len_declarations++] = new_var(optimizer, name, UNDEFINED_VAL);
+    optimizer->stats.hoisted++;
+}
+
+// Returns whether expr is invariant in the loop. When it is not, its largest
+// invariant subexpressions are hoisted instead. Nothing in Lox has side
+// effects besides assignment, so an expression is invariant when it reads
+// no variable the loop writes.
+static int hoist_expression(Optimizer *optimizer, Hoisting *hoisting, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return 0;
+    }
+    switch (expr->type)
+    {
+    case EXPR_LITERAL:
+    case EXPR_INVARIANT: // already cached for an enclosing loop
+        return 1;
+    case EXPR_VARIABLE:
+        return count_loop_writes(&hoisting->writes, expr->as.variable.identifier) == 0;
+    case EXPR_GROUPING:
+        return hoist_expression(optimizer, hoisting, expr->as.binary.left);
+    case EXPR_UNARY:
+        return hoist_expression(optimizer, hoisting, expr->as.binary.right);
+    case EXPR_BINARY:
+    {
+        int left = hoist_expression(optimizer, hoisting, expr->as.binary.left);
+        int right = hoist_expression(optimizer, hoisting, expr->as.binary.right);
+        if (left && right)
+        {
+            return 1;
+        }
+        if (left)
+        {
+            hoist(optimizer, hoisting, expr->as.binary.left);
+        }
+        if (right)
+        {
+            hoist(optimizer, hoisting, expr->as.binary.right);
+        }
+        return 0;
+    }
+    case EXPR_ASSIGN:
+        if (hoist_expression(optimizer, hoisting, expr->as.assign.value))
+        {
+            hoist(optimizer, hoisting, expr->as.assign.value);
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static void hoist_root(Optimizer *optimizer, Hoisting *hoisting, Expression *expr)
+{
+    if (hoist_expression(optimizer, hoisting, expr))
+    {
+        hoist(optimizer, hoisting, expr);
+    }
+}
+
+static void hoist_statement(Optimizer *optimizer, Hoisting *hoisting, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        hoist_root(optimizer, hoisting, stmt->data.expr.expression);
+        break;
+    case STMT_PRINT:
+        hoist_root(optimizer, hoisting, stmt->data.print.expression);
+        break;
+    case STMT_VAR:
+        hoist_root(optimizer, hoisting, stmt->data.var.initializer);
+        break;
+    case STMT_BLOCK:
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            hoist_statement(optimizer, hoisting, stmt->data.block->statements[i]);
+        }
+        break;
+    case STMT_IF:
+        hoist_root(optimizer, hoisting, stmt->data.if_stmt.condition);
+        hoist_statement(optimizer, hoisting, stmt->data.if_stmt.thenBranch);
+        hoist_statement(optimizer, hoisting, stmt->data.if_stmt.elseBranch);
+        break;
+    case STMT_WHILE:
+        hoist_root(optimizer, hoisting, stmt->data.while_stmt.condition);
+        hoist_statement(optimizer, hoisting, stmt->data.while_stmt.body);
+        break;
+    case STMT_FOR:
+        hoist_statement(optimizer, hoisting, stmt->data.for_stmt.initializer);
+        hoist_root(optimizer, hoisting, stmt->data.for_stmt.condition);
+        hoist_root(optimizer, hoisting, stmt->data.for_stmt.increment);
+        hoist_statement(optimizer, hoisting, stmt->data.for_stmt.body);
+        break;
+    default:
+        break;
+    }
+}
+
+// Caches the loop's invariant expressions in hidden locals declared in front
+// of it. They are computed on first use rather than before the loop, so an
+// expression that would fail still fails at the same point, and one the loop
+// never reaches is never computed. The cache starts empty every time the loop
+// statement runs. Returns whether loop was rewritten.
+static int hoist_loop(Optimizer *optimizer, Statement *loop)
+{
+    Hoisting hoisting = {collect_loop_writes(loop), NULL, 0, 0};
+    hoist_statement(optimizer, &hoisting, loop);
+    if (hoisting.len_declarations > 0)
+    {
+        wrap_loop(optimizer, loop, hoisting.declarations, hoisting.len_declarations);
+    }
+    free_loop_writes(&hoisting.writes);
+    free(hoisting.declarations);
+    return hoisting.len_declarations > 0;
+}
+
+// The loop that was moved to the end of the block wrap_loop made
+static Statement *unwrap_loop(Statement *stmt, int wrapped)
+{
+    if (!wrapped)
+    {
+        return stmt;
+    }
+    Block *blk = stmt->data.block;
+    return blk->statements[blk->len_statements - 1];
+}
+
+static void optimize_loops(Optimizer *optimizer, Statement *stmt, Statement *previous)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_BLOCK:
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            optimize_loops(optimizer, stmt->data.block->statements[i], i > 0 ? stmt->data.block->statements[i - 1] : NULL);
+        }
+        break;
+    case STMT_IF:
+        optimize_loops(optimizer, stmt->data.if_stmt.thenBranch, NULL);
+        optimize_loops(optimizer, stmt->data.if_stmt.elseBranch, NULL);
+        break;
+    case STMT_WHILE:
+    case STMT_FOR:
+    {
+        // Outer loops go first, so an expression that does not change in
+        // either is cached outside both
+        Statement *loop = unwrap_loop(stmt, reduce_loop(optimizer, stmt, previous));
+        loop = unwrap_loop(loop, hoist_loop(optimizer, loop));
+        optimize_loops(optimizer, loop->type == STMT_FOR ? loop->data.for_stmt.body : loop->data.while_stmt.body, NULL);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void optimize(Statement **statements, size_t *len_statements, Arena *arena, OptimizerStats *stats)
+{
+    Optimizer optimizer = {0};
+    optimizer.arena = arena;
+    // Count every write first, so a variable is only replaced when nothing
+    // that is left assigns to it. Then one walk folds, prunes and replaces,
+    // the program being one more block around the globals.
+    begin_binding_scope(&optimizer);
+    for (size_t i = 0; i < *len_statements; i++)
+    {
+        count_statement(&optimizer, statements[i], 1);
+    }
+    end_binding_scope(&optimizer);
+    optimizer.next_binding = 0;
+    begin_binding_scope(&optimizer);
+    simplify_statements(&optimizer, statements, len_statements);
+    end_binding_scope(&optimizer);
+    for (size_t i = 0; i < *len_statements; i++)
+    {
+        optimize_loops(&optimizer, statements[i], i > 0 ? statements[i - 1] : NULL);
+    }
+    if (stats != NULL)
+    {
+        *stats = optimizer.stats;
+    }
+    free(optimizer.bindings);
+    free(optimizer.names);
+    free(optimizer.visible);
+}
@@ -0,0 +1,22 @@
+#ifndef __OPTIMIZER__
+#define __OPTIMIZER__
+
+#include "parser.h"
+
+// What the loop passes did, for --dump-ast
+typedef struct
+{
+    size_t hoisted;         // loop-invariant expressions now evaluated once per loop
+    size_t strength_reduced; // multiplications by an induction variable turned into additions
+} OptimizerStats;
+
+// Rewrites a whole program in place before it runs: folds expressions made
+// only of literals, replaces variables that are never reassigned by their
+// constant initializer and drops branches and loops that can never run.
+// Then, in loops, multiplications by a counter become running sums and
+// expressions that do not change are computed once. Statements removed from
+// the top level shrink len_statements. New nodes come from the parser's
+// arena. Must run before resolve(). stats may be NULL.
+void optimize(Statement **statements, size_t *len_statements, Arena *arena, OptimizerStats *stats);
+
+#endif //__OPTIMIZER__
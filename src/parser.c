@@ -5,15 +5,15 @@
 
 int error_return_global = 0;
 
-void free_statement(Statement *stmt);
 Expression *expression(Parser *parser);
 Statement *statement(Parser *parser);
 Statement *declaration(Parser *parser);
 Statement *varDeclaration(Parser *parser);
+Token *previous(Parser *parser);
 
-Expression *init_expression_binary(Expression *left, Token *operator, Expression *right, ExpressionType expression_type)
+Expression *init_expression_binary(Parser *parser, Expression *left, Token *operator, Expression *right, ExpressionType expression_type)
 {
-    Expression *expression = calloc(1, sizeof(Expression));
+    Expression *expression = arena_alloc(parser->arena, sizeof(Expression));
 
     expression->as.binary.left = left;
     expression->as.binary.operator = operator;
@@ -22,70 +22,79 @@ Expression *init_expression_binary(Expression *left, Token *operator, Expression
     return expression;
 }
 
-Expression *init_expression_variable(Token *name, ExpressionType type)
+Expression *init_expression_variable(Parser *parser, Token *name, ExpressionType type)
 {
-    Expression *expression = calloc(1, sizeof(Expression));
+    Expression *expression = arena_alloc(parser->arena, sizeof(Expression));
 
     expression->as.variable.name = name;
+    expression->as.variable.identifier = name->symbol;
+    expression->as.variable.depth = -1;
+    expression->as.variable.slot = -1;
     expression->type = type;
     return expression;
 }
 
-Expression *init_expression_literal(Literal *literal, ExpressionType expression_type)
+Expression *init_expression_literal(Parser *parser, Value value, ExpressionType expression_type)
 {
-    Expression *expression = calloc(1, sizeof(Expression));
+    Expression *expression = arena_alloc(parser->arena, sizeof(Expression));
 
-    expression->as.literal = literal;
+    expression->as.value = value;
+    expression->as.line = previous(parser)->line;
     expression->type = expression_type;
     return expression;
 }
 
 Expression *init_expression_assign(Parser *parser, Token *name, Expression *value, ExpressionType type)
 {
-    Expression *expression = calloc(1, sizeof(Expression));
+    Expression *expression = arena_alloc(parser->arena, sizeof(Expression));
 
     expression->as.assign.name = name;
+    expression->as.assign.identifier = name->symbol;
     expression->as.assign.value = value;
+    expression->as.assign.depth = -1;
+    expression->as.assign.slot = -1;
     expression->type = type;
     return expression;
 }
 
-Statement *init_statement_expr(Expression *expr)
+Statement *init_statement_expr(Parser *parser, Expression *expr)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_EXPR;
     new->data.expr.expression = expr;
     return new;
 }
 
-Statement *init_statement_print(Expression *expr)
+Statement *init_statement_print(Parser *parser, Expression *expr)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_PRINT;
     new->data.print.expression = expr;
     return new;
 }
 
-Statement *init_statement_var(Token *name, Expression *initializer)
+Statement *init_statement_var(Parser *parser, Token *name, Expression *initializer)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_VAR;
     new->data.var.name = name;
+    new->data.var.identifier = name == NULL ? NULL : name->symbol;
     new->data.var.initializer = initializer;
+    new->data.var.slot = -1;
     return new;
 }
 
-Statement *init_statement_block(Block *blk)
+Statement *init_statement_block(Parser *parser, Block *blk)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_BLOCK;
     new->data.block = blk;
     return new;
 }
 
-Statement *init_statement_if(Expression *condition, Statement *thenBranch, Statement *elseBranch)
+Statement *init_statement_if(Parser *parser, Expression *condition, Statement *thenBranch, Statement *elseBranch)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_IF;
     new->data.if_stmt.condition = condition;
     new->data.if_stmt.thenBranch = thenBranch;
@@ -93,142 +102,97 @@ Statement *init_statement_if(Expression *condition, Statement *thenBranch, State
     return new;
 }
 
-Statement *init_statement_while(Expression *condition, Statement *body)
+Statement *init_statement_while(Parser *parser, Expression *condition, Statement *body)
 {
-    Statement *new = calloc(1, sizeof(Statement));
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
     new->type = STMT_WHILE;
     new->data.while_stmt.condition = condition;
     new->data.while_stmt.body = body;
     return new;
 }
 
-Parser *init_parser(Token **tokens, size_t len_tokens)
+Statement *init_statement_for(Parser *parser, Statement *initializer, Expression *condition, Expression *increment, Statement *body)
+{
+    Statement *new = arena_alloc(parser->arena, sizeof(Statement));
+    new->type = STMT_FOR;
+    new->data.for_stmt.initializer = initializer;
+    new->data.for_stmt.condition = condition;
+    new->data.for_stmt.increment = increment;
+    new->data.for_stmt.body = body;
+    new->data.for_stmt.len_locals = 0;
+    return new;
+}
+
+// The parser reads the scanner's token array in place, it must outlive the tree
+Parser *init_parser(const char *source, Token *tokens)
 {
     Parser *parser = calloc(1, sizeof(Parser));
-    parser->tokens = calloc(len_tokens, sizeof(Token *));
-    memcpy(parser->tokens, tokens, len_tokens * sizeof(Token *));
+    parser->source = source;
+    parser->tokens = tokens;
     parser->current = 0;
+    parser->arena = init_arena();
+    parser->size_pending = 128;
+    parser->pending = calloc(parser->size_pending, sizeof(Statement *));
     return parser;
 }
 
-void free_parser(Parser *parser)
+// Pulls tokens from a streaming scanner as they are needed, the scanner must
+// outlive the parser. Meant to be driven by parse_next and release_parsed.
+Parser *init_parser_stream(Scanner *scanner)
 {
-    free(parser->tokens);
-    parser->tokens = NULL;
-    free(parser);
+    fill_tokens(scanner, 1);
+    Parser *parser = init_parser(scanner->source, scanner->tokens);
+    parser->scanner = scanner;
+    return parser;
 }
 
-void free_expression(Expression *expr)
+// Releases the parser along with the whole tree it produced
+void free_parser(Parser *parser)
 {
-    if (!expr)
-    {
-        return;
-    }
-    switch (expr->type)
-    {
-    case EXPR_BINARY:
-    case EXPR_GROUPING:
-    case EXPR_UNARY:
-        free_expression(expr->as.binary.left);
-        expr->as.binary.left = NULL;
-        free_expression(expr->as.binary.right);
-        expr->as.binary.right = NULL;
-        // free_token(expr->as.binary.operator);
-        // expr->as.binary.operator = NULL;
-        break;
-    case EXPR_LITERAL:
-        if (expr->as.literal && expr->as.literal->token_type == NIL)
-        {
-            free_literal(expr->as.literal);
-            expr->as.literal = NULL;
-        }
-        break;
-    case EXPR_VARIABLE:
-        // free_token(expr->as.variable.name);
-        // expr->as.variable.name = NULL;
-        break;
-    default:
-        break;
-    }
-    free(expr);
+    parser->tokens = NULL;
+    free(parser->pending);
+    parser->pending = NULL;
+    free_arena(parser->arena);
+    parser->arena = NULL;
+    free(parser);
 }
 
-void free_block(Block *blk)
+void push_pending(Parser *parser, Statement *stmt)
 {
-    for (size_t i = 0; i < blk->len_statements; i++)
+    if (parser->len_pending >= parser->size_pending)
     {
-        free_statement(blk->statements[i]);
-        blk->statements[i] = NULL;
+        parser->size_pending *= 2;
+        parser->pending = realloc(parser->pending, parser->size_pending * sizeof(Statement *));
     }
-    free(blk->statements);
-    blk->statements = NULL;
-    free(blk);
+    parser->pending[parser->len_pending++] = stmt;
 }
 
-void free_statement(Statement *stmt)
+// Moves the statements pushed since `start` into an exactly sized arena array
+Statement **pop_pending(Parser *parser, size_t start, size_t *len_statements)
 {
-    if (!stmt)
-    {
-        return;
-    }
-    switch (stmt->type)
-    {
-    case STMT_EXPR:
-        free_expression(stmt->data.expr.expression);
-        stmt->data.expr.expression = NULL;
-    case STMT_PRINT:
-        free_expression(stmt->data.print.expression);
-        stmt->data.print.expression = NULL;
-        break;
-    case STMT_VAR:
-        // free_token(stmt->data.var.name);
-        // stmt->data.var.name = NULL;
-        free_expression(stmt->data.var.initializer);
-        stmt->data.var.initializer = NULL;
-        break;
-    case STMT_BLOCK:
-        free_block(stmt->data.block);
-        stmt->data.block = NULL;
-        break;
-    case STMT_IF:
-        free_expression(stmt->data.if_stmt.condition);
-        stmt->data.if_stmt.condition = NULL;
-        free_statement(stmt->data.if_stmt.thenBranch);
-        stmt->data.if_stmt.thenBranch = NULL;
-        free_statement(stmt->data.if_stmt.elseBranch);
-        stmt->data.if_stmt.elseBranch = NULL;
-        break;
-    case STMT_WHILE:
-        free_expression(stmt->data.while_stmt.condition);
-        stmt->data.while_stmt.condition = NULL;
-        free_statement(stmt->data.while_stmt.body);
-        stmt->data.while_stmt.body = NULL;
-        break;
-    default:
-        fprintf(stderr, "Free statement unimplememted for this kind of statement: %d\n", stmt->type);
-        break;
-    }
-    free(stmt);
+    *len_statements = parser->len_pending - start;
+    Statement **statements = arena_alloc(parser->arena, *len_statements * sizeof(Statement *));
+    memcpy(statements, parser->pending + start, *len_statements * sizeof(Statement *));
+    parser->len_pending = start;
+    return statements;
 }
 
-void free_statements(Statement **stmts, size_t len_statements)
+Block *init_block(Parser *parser, Statement **statements, size_t len_statements)
 {
-    for (size_t i = 0; i < len_statements; i++)
-    {
-        free_statement(stmts[i]);
-        stmts[i] = NULL;
-    }
-    free(stmts);
+    Block *blk = arena_alloc(parser->arena, sizeof(Block));
+    blk->statements = statements;
+    blk->len_statements = len_statements;
+    return blk;
 }
 
 int isAtEnd_parser(Parser *parser)
 {
-    return parser->tokens[parser->current]->literal->token_type == EOF_LOX;
+    return parser->tokens[parser->current].type == EOF_LOX;
 }
 
 Token *peek_parser(Parser *parser)
 {
-    return parser->tokens[parser->current];
+    return &parser->tokens[parser->current];
 }
 
 Token *previous(Parser *parser)
@@ -238,7 +202,7 @@ Token *previous(Parser *parser)
         return NULL;
     }
 
-    return parser->tokens[parser->current - 1];
+    return &parser->tokens[parser->current - 1];
 }
 
 Token *advance_parser(Parser *parser)
@@ -246,6 +210,10 @@ Token *advance_parser(Parser *parser)
     if (!isAtEnd_parser(parser))
     {
         parser->current++;
+        if (parser->scanner != NULL)
+        {
+            fill_tokens(parser->scanner, parser->current + 1);
+        }
     }
     return previous(parser);
 }
@@ -256,7 +224,7 @@ int check(Parser *parser, TokenType type)
     {
         return 0;
     }
-    return parser->tokens[parser->current]->literal->token_type == type;
+    return parser->tokens[parser->current].type == type;
 }
 
 int match_parser(Parser *parser, TokenType types[], size_t len_types)
@@ -271,6 +239,17 @@ int match_parser(Parser *parser, TokenType types[], size_t len_types)
     return 0;
 }
 
+// A pipelined scanner reports its errors once it is done. Waiting for it
+// before reporting a syntax error keeps them in the same order as when the
+// whole file was scanned upfront.
+static void report_scanner_errors(Parser *parser)
+{
+    if (parser->scanner != NULL)
+    {
+        finish_scanning(parser->scanner);
+    }
+}
+
 Token *consume(Parser *parser, TokenType type, char message[])
 {
     if (check(parser, type))
@@ -279,13 +258,15 @@ Token *consume(Parser *parser, TokenType type, char message[])
     }
     // fprintf(stderr, "[ERROR] consume() triggered: %s\n", message);
     error_return_global = 65;
+    report_scanner_errors(parser);
     if (type == EOF_LOX)
     {
         fprintf(stderr, "Line %d at end. %s", peek_parser(parser)->line, message);
     }
     else
     {
-        fprintf(stderr, "Line %d at '%s'. %s", peek_parser(parser)->line, peek_parser(parser)->lexeme, message);
+        Token *token = peek_parser(parser);
+        fprintf(stderr, "Line %d at '%.*s'. %s", token->line, (int)token->length, parser->source + token->start, message);
     }
     printf("\n");
     advance_parser(parser); // Force advance to next token
@@ -297,11 +278,11 @@ void synchronize(Parser *parser)
     advance_parser(parser);
     while (!isAtEnd_parser(parser))
     {
-        if (previous(parser)->literal->token_type == SEMICOLON)
+        if (previous(parser)->type == SEMICOLON)
         {
             return;
         }
-        switch (peek_parser(parser)->literal->token_type)
+        switch (peek_parser(parser)->type)
         {
         case CLASS:
         case FUN:
@@ -319,51 +300,37 @@ void synchronize(Parser *parser)
 
 Expression *primary(Parser *parser)
 {
-    Expression *expression_literal = NULL;
-    Literal *lit = NULL;
     TokenType allowed_type = FALSE;
     if (match_parser(parser, &allowed_type, 1))
     {
         advance_parser(parser);
-        lit = init_literal(FALSE, NULL, 0);
-        expression_literal = init_expression_literal(lit, EXPR_LITERAL);
-        return expression_literal;
+        return init_expression_literal(parser, BOOL_VAL(0), EXPR_LITERAL);
     }
     allowed_type = TRUE;
     if (match_parser(parser, &allowed_type, 1))
     {
         advance_parser(parser);
-        lit = init_literal(TRUE, NULL, 1);
-        expression_literal = init_expression_literal(lit, EXPR_LITERAL);
-        return expression_literal;
+        return init_expression_literal(parser, BOOL_VAL(1), EXPR_LITERAL);
     }
     allowed_type = NIL;
     if (match_parser(parser, &allowed_type, 1))
     {
         advance_parser(parser);
-        lit = init_literal(NIL, NULL, 1);
-        expression_literal = init_expression_literal(lit, EXPR_LITERAL);
-        return expression_literal;
+        return init_expression_literal(parser, NIL_VAL, EXPR_LITERAL);
     }
     allowed_type = NUMBER;
     if (match_parser(parser, &allowed_type, 1))
     {
         advance_parser(parser);
         Token *prev = previous(parser);
-        // lit = init_literal(NUMBER, prev->literal->data.number, 0);
-        lit = prev->literal;
-        expression_literal = init_expression_literal(lit, EXPR_LITERAL);
-        return expression_literal;
+        return init_expression_literal(parser, NUMBER_VAL(prev->number), EXPR_LITERAL);
     }
     allowed_type = STRING;
     if (match_parser(parser, &allowed_type, 1))
     {
         advance_parser(parser);
         Token *prev = previous(parser); // Get consumed STRING token
-        lit = prev->literal;
-        // lit = init_literal(STRING, prev->literal->data.string, 0);
-        expression_literal = init_expression_literal(lit, EXPR_LITERAL);
-        return expression_literal;
+        return init_expression_literal(parser, string_value(prev->symbol), EXPR_LITERAL);
     }
     allowed_type = LEFT_PAREN;
     if (match_parser(parser, &allowed_type, 1))
@@ -374,13 +341,13 @@ Expression *primary(Parser *parser)
         consume(parser, RIGHT_PAREN, "Expect ')' after expression.");
 
         // fprintf(stderr, "Wrapping in group\n");
-        return init_expression_binary(expr, NULL, NULL, EXPR_GROUPING);
+        return init_expression_binary(parser, expr, NULL, NULL, EXPR_GROUPING);
     }
     allowed_type = IDENTIFIER;
     if (match_parser(parser, &allowed_type, 1))
     {
         Token *name = advance_parser(parser);
-        Expression *var_expr = init_expression_variable(name, EXPR_VARIABLE);
+        Expression *var_expr = init_expression_variable(parser, name, EXPR_VARIABLE);
         return var_expr;
 
         // advance_parser(parser); // consume IDENTIFIER
@@ -397,7 +364,7 @@ Expression *unary(Parser *parser)
     {
         Token *operator = advance_parser(parser);
         Expression *right = unary(parser);
-        return init_expression_binary(NULL, operator, right, EXPR_UNARY);
+        return init_expression_binary(parser, NULL, operator, right, EXPR_UNARY);
     }
     return primary(parser);
 }
@@ -410,7 +377,7 @@ Expression *factor(Parser *parser)
     {
         Token *operator = advance_parser(parser);
         Expression *right = unary(parser);
-        expr = init_expression_binary(expr, operator, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, operator, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -423,7 +390,7 @@ Expression *term(Parser *parser)
     {
         Token *operator = advance_parser(parser);
         Expression *right = factor(parser);
-        expr = init_expression_binary(expr, operator, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, operator, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -436,7 +403,7 @@ Expression *comparison(Parser *parser)
     {
         Token *operator = advance_parser(parser);
         Expression *right = term(parser);
-        expr = init_expression_binary(expr, operator, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, operator, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -449,7 +416,7 @@ Expression *equality(Parser *parser)
     {
         Token *operator = advance_parser(parser);
         Expression *right = comparison(parser);
-        expr = init_expression_binary(expr, operator, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, operator, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -464,7 +431,7 @@ Expression *and(Parser *parser)
         advance_parser(parser); // consume AND token
         Token *op = previous(parser);
         Expression *right = equality(parser);
-        expr = init_expression_binary(expr, op, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, op, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -479,7 +446,7 @@ Expression *or(Parser *parser)
         advance_parser(parser); // consume OR token
         Token *op = previous(parser);
         Expression *right = and(parser);
-        expr = init_expression_binary(expr, op, right, EXPR_BINARY);
+        expr = init_expression_binary(parser, expr, op, right, EXPR_BINARY);
     }
     return expr;
 }
@@ -499,6 +466,7 @@ Expression *assignment(Parser *parser)
             return init_expression_assign(parser, name, value, EXPR_ASSIGN);
         }
         error_return_global = 65;
+        report_scanner_errors(parser);
         fprintf(stderr, "Invalid assignment target.\n");
     }
     return expr;
@@ -514,7 +482,7 @@ Statement *printStatement(Parser *parser)
     Expression *value = expression(parser);
     // advance_parser(parser);
     consume(parser, SEMICOLON, "Expect ';' after value.");
-    Statement *new = init_statement_print(value);
+    Statement *new = init_statement_print(parser, value);
     return new;
 }
 
@@ -522,28 +490,20 @@ Statement *expressionStatement(Parser *parser)
 {
     Expression *expr = expression(parser);
     consume(parser, SEMICOLON, "Expect ';' after expression.");
-    Statement *new = init_statement_expr(expr);
+    Statement *new = init_statement_expr(parser, expr);
     return new;
 }
 
 Block *block(Parser *parser)
 {
-    size_t len_statements = 0, size_statements = 128;
-    Statement **statements = calloc(size_statements, sizeof(Statement *));
+    size_t start = parser->len_pending, len_statements = 0;
 
     while (!check(parser, RIGHT_BRACE) && !isAtEnd_parser(parser))
     {
-        if (len_statements >= size_statements)
-        {
-            size_statements *= 2;
-            statements = realloc(statements, size_statements * sizeof(Statement *));
-        }
-        statements[len_statements++] = declaration(parser);
+        push_pending(parser, declaration(parser));
     }
-    statements = realloc(statements, len_statements * sizeof(Statement *));
-    Block *blk = calloc(1, sizeof(Block));
-    blk->statements = statements;
-    blk->len_statements = len_statements;
+    Statement **statements = pop_pending(parser, start, &len_statements);
+    Block *blk = init_block(parser, statements, len_statements);
     consume(parser, RIGHT_BRACE, "Expect '}' after block.\n");
     return blk;
 }
@@ -561,7 +521,7 @@ Statement *ifStatement(Parser *parser)
         advance_parser(parser); // consume ELSE token
         elseBranch = statement(parser);
     }
-    Statement *ret = init_statement_if(condition, thenBranch, elseBranch);
+    Statement *ret = init_statement_if(parser, condition, thenBranch, elseBranch);
     return ret;
 }
 
@@ -571,7 +531,7 @@ Statement *whileStatement(Parser *parser)
     Expression *condition = expression(parser);
     consume(parser, RIGHT_PAREN, "Expect ')' after condition.\n");
     Statement *body = statement(parser);
-    Statement *ret = init_statement_while(condition, body);
+    Statement *ret = init_statement_while(parser, condition, body);
     return ret;
 }
 
@@ -582,6 +542,7 @@ Statement *forStatement(Parser *parser)
     TokenType semicolon = SEMICOLON, var = VAR;
     if (match_parser(parser, &semicolon, 1))
     {
+        advance_parser(parser); // consume ';'
         initializer = NULL;
     }
     else if (match_parser(parser, &var, 1))
@@ -608,32 +569,7 @@ Statement *forStatement(Parser *parser)
     consume(parser, RIGHT_PAREN, "Expect ')' after for clauses.\n");
 
     Statement *body = statement(parser);
-    if (increment != NULL)
-    {
-        Statement **body_and_increment = calloc(2, sizeof(Statement *));
-        body_and_increment[0] = body;
-        body_and_increment[1] = init_statement_expr(increment);
-        Block *body_inc = calloc(1, sizeof(Block));
-        body_inc->statements = body_and_increment;
-        body_inc->len_statements = 2;
-        body = init_statement_block(body_inc);
-    }
-    if (condition == NULL)
-    {
-        Literal *tru = init_literal(TRUE, NULL, 1);
-        condition = init_expression_literal(tru, EXPR_LITERAL);
-    }
-    body = init_statement_while(condition, body);
-    if(initializer != NULL){
-        Statement **initializer_and_body = calloc(2, sizeof(Statement *));
-        initializer_and_body[0] = initializer;
-        initializer_and_body[1] = body;
-        Block *ini_body = calloc(1, sizeof(Block));
-        ini_body->statements = initializer_and_body;
-        ini_body->len_statements = 2;
-        body = init_statement_block(ini_body);
-    }
-    return body;
+    return init_statement_for(parser, initializer, condition, increment, body);
 }
 
 Statement *statement(Parser *parser)
@@ -656,7 +592,7 @@ Statement *statement(Parser *parser)
         advance_parser(parser); // Consume { token
         size_t len_statements = 0;
         Block *blk = block(parser);
-        Statement *block_stmt = init_statement_block(blk);
+        Statement *block_stmt = init_statement_block(parser, blk);
         return block_stmt;
     }
     allowed = FOR;
@@ -679,12 +615,11 @@ Statement *varDeclaration(Parser *parser)
     advance_parser(parser);
     Token *name = consume(parser, IDENTIFIER, "Expect variable name.");
 
-    Expression *initializer = init_expression_literal(init_literal(NIL, NULL, 1), EXPR_LITERAL);
+    Expression *initializer = NULL;
     TokenType allowed = EQUAL;
     if (match_parser(parser, &allowed, 1))
     {
         advance_parser(parser);
-        free_expression(initializer);
         initializer = expression(parser);
         if (error_return_global != 0)
         {
@@ -692,7 +627,11 @@ Statement *varDeclaration(Parser *parser)
         }
     }
     consume(parser, SEMICOLON, "Expect ';' after variable declaration.");
-    Statement *ret_stmt = init_statement_var(name, initializer);
+    if (initializer == NULL)
+    {
+        initializer = init_expression_literal(parser, NIL_VAL, EXPR_LITERAL);
+    }
+    Statement *ret_stmt = init_statement_var(parser, name, initializer);
     return ret_stmt;
 }
 
@@ -712,64 +651,91 @@ Statement *declaration(Parser *parser)
     return stmt;
 }
 
-// Array of pointers to parse
+// Array of pointers to parse, owned by the parser's arena
 Statement **parse(Parser *parser, size_t *len_statements, int *error_return)
 {
-    size_t size_statements = 128, current_statements = 0;
-    Statement **statements = calloc(size_statements, sizeof(Statement *));
+    size_t start = parser->len_pending;
     while (!isAtEnd_parser(parser))
     {
-        if (current_statements >= size_statements)
-        {
-            size_statements *= 2;
-            statements = realloc(statements, size_statements * (sizeof(Statement *)));
-        }
         if (error_return_global != 0)
         {
             break;
         }
-        Statement *stmt = declaration(parser);
-        statements[current_statements++] = stmt;
+        push_pending(parser, declaration(parser));
     }
     *error_return = error_return_global;
-    *len_statements = current_statements;
-    return statements;
+    return pop_pending(parser, start, len_statements);
 }
 
-void parenthesize(char *name, Expression *expression)
+// Parses a single top-level declaration. Returns NULL at the end of the input
+// or when it had a syntax error, error_return tells the two apart.
+Statement *parse_next(Parser *parser, int *error_return)
 {
-    if (expression->type == EXPR_LITERAL)
+    if (isAtEnd_parser(parser) || error_return_global != 0)
     {
-        TokenType type = expression->as.literal->token_type;
-        switch (type)
-        {
-        case NUMBER:
-            double number = *expression->as.literal->data.number;
-            if (floor(number) == number)
-            { // integer
-                printf("(%s %.1lf)", name, number);
-            }
-            else
-            { // float
-                printf("(%s %.15g)", name, number);
-            }
-            break;
-        case STRING:
-            printf("(%s %s)", name, expression->as.literal->data.string);
-            break;
-        case TRUE:
-            printf("(%s true)", name);
-            break;
-        case FALSE:
-            printf("(%s false)", name);
-            break;
-        case NIL:
-            printf("(%s nil)", name);
-            break;
-        default:
-            printf("(<unknown literal> ");
-            break;
+        *error_return = error_return_global;
+        return NULL;
+    }
+    Statement *stmt = declaration(parser);
+    *error_return = error_return_global;
+    return *error_return != 0 ? NULL : stmt;
+}
+
+// Frees the trees returned by parse_next so far, along with their tokens when
+// streaming
+void release_parsed(Parser *parser)
+{
+    reset_arena(parser->arena);
+    if (parser->scanner != NULL)
+    {
+        release_tokens(parser->scanner, parser->current);
+    }
+}
+
+void print_expression_value(Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        double number = AS_NUMBER(value);
+        if (floor(number) == number)
+        { // integer
+            printf("%.1lf", number);
         }
+        else
+        { // float
+            printf("%.15g", number);
+        }
+    }
+    else if (IS_STRING(value))
+    {
+        ShortString buffer;
+        printf("%s", as_string(value, &buffer)->chars);
+    }
+    else if (IS_BOOL(value))
+    {
+        printf(AS_BOOL(value) ? "true" : "false");
+    }
+    else if (IS_NIL(value))
+    {
+        printf("nil");
+    }
+    else if (IS_UNDEFINED(value))
+    {
+        printf("undefined");
+    }
+    else
+    {
+        printf("<unknown literal> ");
+    }
+}
+
+void parenthesize(const char *name, Expression *expression)
+{
+    if (expression->type == EXPR_LITERAL)
+    {
+        printf("(%s ", name);
+        print_expression_value(expression->as.value);
+        printf(")");
     }
     else if (expression->type == EXPR_GROUPING)
     {
@@ -791,6 +757,12 @@ void parenthesize(char *name, Expression *expression)
         print_expression(expression->as.binary.right);
         printf(")");
     }
+    else
+    {
+        printf("(%s ", name);
+        print_expression(expression);
+        printf(")");
+    }
 }
 
 void print_expression(Expression *expr)
@@ -802,40 +774,11 @@ void print_expression(Expression *expr)
     switch (expr->type)
     {
     case EXPR_BINARY:
-        parenthesize(expr->as.binary.operator->lexeme, expr);
+        parenthesize(token_type_to_lexeme(expr->as.binary.operator->type), expr);
         break;
 
     case EXPR_LITERAL:
-        TokenType type = expr->as.literal->token_type;
-        switch (type)
-        {
-        case NUMBER:
-            double number = *expr->as.literal->data.number;
-            if (floor(number) == number)
-            { // integer
-                printf("%.1lf", number);
-            }
-            else
-            { // floatvoid print_expression(Expression *expr)
-                printf("%.15g", number);
-            }
-            break;
-        case STRING:
-            printf("%s", expr->as.literal->data.string);
-            break;
-        case TRUE:
-            printf("true");
-            break;
-        case FALSE:
-            printf("false");
-            break;
-        case NIL:
-            printf("nil");
-            break;
-        default:
-            printf("<unknown literal> ");
-            break;
-        }
+        print_expression_value(expr->as.value);
         break;
     case EXPR_GROUPING:
         printf("(group ");
@@ -843,7 +786,20 @@ void print_expression(Expression *expr)
         printf(")");
         break;
     case EXPR_UNARY:
-        parenthesize(expr->as.binary.operator->lexeme, expr->as.binary.right);
+        parenthesize(token_type_to_lexeme(expr->as.binary.operator->type), expr->as.binary.right);
+        break;
+    case EXPR_VARIABLE:
+        printf("%s", expr->as.variable.identifier->chars);
+        break;
+    case EXPR_ASSIGN:
+        printf("(= %s ", expr->as.assign.identifier->chars);
+        print_expression(expr->as.assign.value);
+        printf(")");
+        break;
+    case EXPR_INVARIANT:
+        printf("(invariant %s ", expr->as.invariant.identifier->chars);
+        print_expression(expr->as.invariant.expr);
+        printf(")");
         break;
 
     default:
@@ -852,53 +808,80 @@ void print_expression(Expression *expr)
     }
 }
 
-void print_statement(Statement *stmt)
+// One statement per line, nested statements indented under the one they
+// belong to
+static void print_statement_indented(Statement *stmt, int depth)
 {
+    printf("%*s", depth * 2, "");
     switch (stmt->type)
     {
     case STMT_EXPR:
+        printf("(; ");
         print_expression(stmt->data.expr.expression);
+        printf(")\n");
         break;
     case STMT_PRINT:
+        printf("(print ");
         print_expression(stmt->data.print.expression);
+        printf(")\n");
         break;
     case STMT_VAR:
-        printf("%s", stmt->data.var.name->lexeme);
+        printf("(var %s ", stmt->data.var.identifier->chars);
         print_expression(stmt->data.var.initializer);
+        printf(")\n");
         break;
-    default:
-        break;
-    }
-    printf("\n");
-}
-
-void print_literal(Literal *literal)
-{
-    switch (literal->token_type)
-    {
-    case TRUE:
-        printf("true\n");
+    case STMT_BLOCK:
+        printf("(block\n");
+        for (size_t i = 0; i < stmt->data.block->len_statements; i++)
+        {
+            print_statement_indented(stmt->data.block->statements[i], depth + 1);
+        }
+        printf("%*s)\n", depth * 2, "");
         break;
-    case FALSE:
-        printf("false\n");
+    case STMT_IF:
+        printf("(if ");
+        print_expression(stmt->data.if_stmt.condition);
+        printf("\n");
+        print_statement_indented(stmt->data.if_stmt.thenBranch, depth + 1);
+        if (stmt->data.if_stmt.elseBranch != NULL)
+        {
+            print_statement_indented(stmt->data.if_stmt.elseBranch, depth + 1);
+        }
+        printf("%*s)\n", depth * 2, "");
         break;
-    case NIL:
-        printf("nil\n");
+    case STMT_WHILE:
+        printf("(while ");
+        print_expression(stmt->data.while_stmt.condition);
+        printf("\n");
+        print_statement_indented(stmt->data.while_stmt.body, depth + 1);
+        printf("%*s)\n", depth * 2, "");
         break;
-    case NUMBER:
-        if (floor(*literal->data.number) == *literal->data.number)
+    case STMT_FOR:
+        // Missing clauses print as empty
+        printf("(for\n");
+        if (stmt->data.for_stmt.initializer != NULL)
         {
-            printf("%.0lf\n", *literal->data.number);
+            print_statement_indented(stmt->data.for_stmt.initializer, depth + 1);
         }
         else
         {
-            printf("%.15g\n", *literal->data.number);
+            printf("%*s(;)\n", (depth + 1) * 2, "");
         }
-        break;
-    case STRING:
-        printf("%s\n", literal->data.string);
+        printf("%*s(cond ", (depth + 1) * 2, "");
+        print_expression(stmt->data.for_stmt.condition);
+        printf(")\n%*s(step ", (depth + 1) * 2, "");
+        print_expression(stmt->data.for_stmt.increment);
+        printf(")\n");
+        print_statement_indented(stmt->data.for_stmt.body, depth + 1);
+        printf("%*s)\n", depth * 2, "");
         break;
     default:
-        fprintf(stderr, "print_literal for type %s not implemented yet\n", token_type_to_str(literal->token_type));
+        printf("<unknown stmt>\n");
+        break;
     }
-}
\ No newline at end of file
+}
+
+void print_statement(Statement *stmt)
+{
+    print_statement_indented(stmt, 0);
+}
@@ -2,6 +2,8 @@
 #define __PARSER__
 
 #include "scanner.h"
+#include "value.h"
+#include "arena.h"
 
 typedef struct Expression_ Expression;
 
@@ -13,11 +15,27 @@ typedef enum
     EXPR_UNARY,
     EXPR_VARIABLE,
     EXPR_ASSIGN,
+    EXPR_INVARIANT,
+    // Specialized forms the tree walker rewrites nodes into as it runs them,
+    // see interpreter.c. The parser never produces them.
+    EXPR_ADD_NUMBERS,
+    EXPR_SUBTRACT_NUMBERS,
+    EXPR_MULTIPLY_NUMBERS,
+    EXPR_DIVIDE_NUMBERS,
+    EXPR_LESS_NUMBERS,
+    EXPR_LESS_EQUAL_NUMBERS,
+    EXPR_GREATER_NUMBERS,
+    EXPR_GREATER_EQUAL_NUMBERS,
+    EXPR_CONCAT_STRINGS,
+    EXPR_LOCAL,
+    EXPR_GLOBAL, // variable.slot caches the globals table entry
 } ExpressionType;
 
 struct Expression_
 {
     ExpressionType type;
+    uint8_t hits;   // generic runs towards specializing the node
+    uint8_t deopts; // times a specialized form saw other types
     union
     {
         struct
@@ -27,25 +45,61 @@ struct Expression_
             Expression *right;
         } binary;
 
-        Literal *literal;
+        // line is where the literal was written, 0 for one made up by the
+        // optimizer
+        struct
+        {
+            Value value;
+            int line;
+        };
 
+        // depth is the number of blocks between the use and the declaration,
+        // -1 for globals; slot indexes the declaring block's locals. Both are
+        // filled in by the resolver.
         struct
         {
             Token *name;
+            ObjString *identifier;
+            int depth;
+            int slot;
         } variable;
         
         struct
         {
             Token *name;
+            ObjString *identifier;
             Expression *value;
+            int depth;
+            int slot;
         } assign;
+
+        // Loop-invariant subexpression found by the optimizer. expr runs on
+        // first use and its value is kept in the hidden local identifier,
+        // which starts out undefined every time the loop is entered.
+        struct
+        {
+            Expression *expr;
+            ObjString *identifier;
+            int depth;
+            int slot;
+        } invariant;
     } as;
 };
 
+typedef struct Statement_ Statement;
+
 typedef struct
 {
-    Token **tokens; // array of Token*
+    const char *source; // token lexemes are slices of it
+    Token *tokens;
     int current;
+    Scanner *scanner; // set when tokens are pulled from a streaming scanner
+    Arena *arena; // owns every node of the parsed program
+    // Statements of the blocks currently being parsed, copied into the arena
+    // once each block is complete
+    Statement **pending;
+    size_t len_pending;
+    size_t size_pending;
 } Parser;
 
 typedef enum
@@ -56,12 +110,13 @@ typedef enum
     STMT_BLOCK,
     STMT_IF,
     STMT_WHILE,
+    STMT_FOR,
 } StatementType;
 
-typedef struct Statement_ Statement;
 typedef struct {
     Statement **statements;
     size_t len_statements;
+    size_t len_locals; // distinct variables declared directly in this block
 } Block;
 
 typedef struct Statement_
@@ -80,7 +135,9 @@ typedef struct Statement_
         struct
         {
             Token *name;
+            ObjString *identifier;
             Expression *initializer;
+            int slot; // -1 when declaring a global
         } var;
         Block *block; 
         struct {
@@ -92,16 +149,29 @@ typedef struct Statement_
             Expression *condition;
             Statement *body;
         } while_stmt;
+        // The initializer's variable lives in a scope of its own that spans
+        // every iteration. Any of the clauses may be NULL, a missing
+        // condition loops forever.
+        struct {
+            Statement *initializer;
+            Expression *condition;
+            Expression *increment;
+            Statement *body;
+            size_t len_locals; // 1 when the initializer declares a variable
+        } for_stmt;
     } data;
-
+    // Loops only: iterations the tree walker has run and the native code the
+    // JIT made for the loop, see jit.c
+    uint32_t iterations;
+    struct JitLoop_ *jit;
 } Statement;
 
-Parser *init_parser(Token **tokens, size_t len_tokens);
+Parser *init_parser(const char *source, Token *tokens);
+Parser *init_parser_stream(Scanner *scanner);
 Statement **parse(Parser *parser, size_t *len_statements, int *error_return);
+Statement *parse_next(Parser *parser, int *error_return);
+void release_parsed(Parser *parser);
 void print_expression(Expression *expr);
-void print_literal(Literal *literal);
 void print_statement(Statement *stmt);
-Token *init_token(char *lexeme, Literal *literal, int line);
-void free_statements(Statement **stmts, size_t len_statements);
 void free_parser(Parser *parser);
 #endif //__PARSER__
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "resolver.h"
+
+// Every block becomes one scope holding the names declared directly in it, in
+// declaration order, so a name's index is also its slot in the block's
+// environment at runtime. Blocks that declare nothing get no environment, so
+// their scopes are skipped when counting how far up a variable lives.
+typedef struct
+{
+    ObjString **names;
+    size_t len_names;
+    size_t size_names;
+    int has_environment;
+} Scope;
+
+typedef struct
+{
+    Scope *scopes;
+    size_t len_scopes;
+    size_t size_scopes;
+} Resolver;
+
+static void resolve_expression(Resolver *resolver, Expression *expr);
+static void resolve_statement(Resolver *resolver, Statement *stmt);
+
+static void begin_scope(Resolver *resolver, int has_environment)
+{
+    if (resolver->len_scopes >= resolver->size_scopes)
+    {
+        resolver->size_scopes = resolver->size_scopes == 0 ? 16 : resolver->size_scopes * 2;
+        resolver->scopes = realloc(resolver->scopes, resolver->size_scopes * sizeof(Scope));
+    }
+    Scope *scope = &resolver->scopes[resolver->len_scopes++];
+    scope->names = NULL;
+    scope->len_names = scope->size_names = 0;
+    scope->has_environment = has_environment;
+}
+
+static void end_scope(Resolver *resolver)
+{
+    Scope *scope = &resolver->scopes[--resolver->len_scopes];
+    free(scope->names);
+    scope->names = NULL;
+}
+
+static int find_in_scope(Scope *scope, ObjString *name)
+{
+    for (size_t i = 0; i < scope->len_names; i++)
+    {
+        if (scope->names[i] == name)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Redeclaring a name in the same block reuses its slot, the same way
+// define_environment used to overwrite the existing entry.
+static int declare(Resolver *resolver, ObjString *name)
+{
+    Scope *scope = &resolver->scopes[resolver->len_scopes - 1];
+    int slot = find_in_scope(scope, name);
+    if (slot >= 0)
+    {
+        return slot;
+    }
+    if (scope->len_names >= scope->size_names)
+    {
+        scope->size_names = scope->size_names == 0 ? 8 : scope->size_names * 2;
+        scope->names = realloc(scope->names, scope->size_names * sizeof(ObjString *));
+    }
+    scope->names[scope->len_names] = name;
+    return (int)scope->len_names++;
+}
+
+static void resolve_local(Resolver *resolver, ObjString *name, int *depth, int *slot)
+{
+    int hops = 0;
+    for (size_t i = resolver->len_scopes; i > 0; i--)
+    {
+        Scope *scope = &resolver->scopes[i - 1];
+        int found = find_in_scope(scope, name);
+        if (found >= 0)
+        {
+            *depth = hops;
+            *slot = found;
+            return;
+        }
+        hops += scope->has_environment;
+    }
+    // Not declared in any enclosing block, looked up by name in the globals
+    *depth = -1;
+    *slot = -1;
+}
+
+static void resolve_expression(Resolver *resolver, Expression *expr)
+{
+    if (expr == NULL)
+    {
+        return;
+    }
+    switch (expr->type)
+    {
+    case EXPR_BINARY:
+    case EXPR_GROUPING:
+    case EXPR_UNARY:
+        resolve_expression(resolver, expr->as.binary.left);
+        resolve_expression(resolver, expr->as.binary.right);
+        break;
+    case EXPR_VARIABLE:
+        resolve_local(resolver, expr->as.variable.identifier, &expr->as.variable.depth, &expr->as.variable.slot);
+        break;
+    case EXPR_ASSIGN:
+        resolve_expression(resolver, expr->as.assign.value);
+        resolve_local(resolver, expr->as.assign.identifier, &expr->as.assign.depth, &expr->as.assign.slot);
+        break;
+    case EXPR_INVARIANT:
+        resolve_expression(resolver, expr->as.invariant.expr);
+        resolve_local(resolver, expr->as.invariant.identifier, &expr->as.invariant.depth, &expr->as.invariant.slot);
+        break;
+    default:
+        break;
+    }
+}
+
+static void resolve_block(Resolver *resolver, Block *blk)
+{
+    // Only the declarations directly in the block need slots in it, and they
+    // are known before any use inside nested blocks has to be resolved
+    int has_environment = 0;
+    for (size_t i = 0; i < blk->len_statements && !has_environment; i++)
+    {
+        has_environment = blk->statements[i]->type == STMT_VAR;
+    }
+    begin_scope(resolver, has_environment);
+    for (size_t i = 0; i < blk->len_statements; i++)
+    {
+        resolve_statement(resolver, blk->statements[i]);
+    }
+    blk->len_locals = resolver->scopes[resolver->len_scopes - 1].len_names;
+    end_scope(resolver);
+}
+
+static void resolve_statement(Resolver *resolver, Statement *stmt)
+{
+    if (stmt == NULL)
+    {
+        return;
+    }
+    switch (stmt->type)
+    {
+    case STMT_EXPR:
+        resolve_expression(resolver, stmt->data.expr.expression);
+        break;
+    case STMT_PRINT:
+        resolve_expression(resolver, stmt->data.print.expression);
+        break;
+    case STMT_VAR:
+        // The initializer is resolved first so it still sees an outer
+        // variable of the same name
+        resolve_expression(resolver, stmt->data.var.initializer);
+        stmt->data.var.slot = resolver->len_scopes == 0 ? -1 : declare(resolver, stmt->data.var.identifier);
+        break;
+    case STMT_BLOCK:
+        resolve_block(resolver, stmt->data.block);
+        break;
+    case STMT_IF:
+        resolve_expression(resolver, stmt->data.if_stmt.condition);
+        resolve_statement(resolver, stmt->data.if_stmt.thenBranch);
+        resolve_statement(resolver, stmt->data.if_stmt.elseBranch);
+        break;
+    case STMT_WHILE:
+        resolve_expression(resolver, stmt->data.while_stmt.condition);
+        resolve_statement(resolver, stmt->data.while_stmt.body);
+        break;
+    case STMT_FOR:
+    {
+        Statement *initializer = stmt->data.for_stmt.initializer;
+        begin_scope(resolver, initializer != NULL && initializer->type == STMT_VAR);
+        resolve_statement(resolver, initializer);
+        resolve_expression(resolver, stmt->data.for_stmt.condition);
+        resolve_expression(resolver, stmt->data.for_stmt.increment);
+        resolve_statement(resolver, stmt->data.for_stmt.body);
+        stmt->data.for_stmt.len_locals = resolver->scopes[resolver->len_scopes - 1].len_names;
+        end_scope(resolver);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void resolve(Statement **statements, size_t len_statements)
+{
+    Resolver resolver = {NULL, 0, 0};
+    for (size_t i = 0; i < len_statements; i++)
+    {
+        resolve_statement(&resolver, statements[i]);
+    }
+    free(resolver.scopes);
+}
@@ -0,0 +1,8 @@
+#ifndef __RESOLVER__
+#define __RESOLVER__
+
+#include "parser.h"
+
+void resolve(Statement **statements, size_t len_statements);
+
+#endif //__RESOLVER__
@@ -1,153 +1,108 @@
-
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "scanner.h"
 
-Scanner *init_scanner(char *file_contents)
+// The hot loops (whitespace, comments, identifiers and string bodies) look at
+// a whole vector of bytes per step when the target has SSE2 or AVX2. Vector
+// loads only happen while a full vector still fits before scanner->length, the
+// remaining tail goes through the scalar loop, so nothing is read past the end
+// of the source. Build with -DSCANNER_NO_SIMD to force the scalar paths.
+#if defined(__AVX2__) && !defined(SCANNER_NO_SIMD)
+#include <immintrin.h>
+typedef __m256i vec_t;
+#define VEC_WIDTH 32
+#define VEC_ALL_MASK 0xFFFFFFFFu
+#define vec_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define vec_set1(c) _mm256_set1_epi8((char)(c))
+#define vec_eq(a, b) _mm256_cmpeq_epi8((a), (b))
+#define vec_or(a, b) _mm256_or_si256((a), (b))
+#define vec_sub(a, b) _mm256_sub_epi8((a), (b))
+#define vec_min(a, b) _mm256_min_epu8((a), (b))
+#define vec_mask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#elif defined(__SSE2__) && !defined(SCANNER_NO_SIMD)
+#include <emmintrin.h>
+typedef __m128i vec_t;
+#define VEC_WIDTH 16
+#define VEC_ALL_MASK 0xFFFFu
+#define vec_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define vec_set1(c) _mm_set1_epi8((char)(c))
+#define vec_eq(a, b) _mm_cmpeq_epi8((a), (b))
+#define vec_or(a, b) _mm_or_si128((a), (b))
+#define vec_sub(a, b) _mm_sub_epi8((a), (b))
+#define vec_min(a, b) _mm_min_epu8((a), (b))
+#define vec_mask(a) ((uint32_t)_mm_movemask_epi8(a))
+#endif
+
+#ifdef VEC_WIDTH
+// Lanes whose byte is in [lo, hi], compared as unsigned
+static inline vec_t vec_in_range(vec_t chunk, unsigned char lo, unsigned char hi)
+{
+    vec_t offset = vec_sub(chunk, vec_set1(lo));
+    return vec_eq(vec_min(offset, vec_set1(hi - lo)), offset);
+}
+#endif
+
+// The source is borrowed, it must outlive the scanner and its tokens
+Scanner *init_scanner(const char *source, size_t length)
 {
     Scanner *scanner = (Scanner *)calloc(1, sizeof(Scanner));
-    scanner->source = strdup(file_contents);
-    scanner->tokens = (Token **)calloc(128, sizeof(Token *));
+    scanner->source = source;
+    scanner->length = length;
     scanner->size_tokens = 128;
+    scanner->tokens = (Token *)calloc(scanner->size_tokens, sizeof(Token));
     scanner->start = scanner->current = scanner->number_tokens = scanner->had_error = 0;
     scanner->line = 1;
+    scanner->err = stderr;
+    scanner->intern = 1;
     return scanner;
 }
 
-Literal *init_literal(TokenType type, void *string_number, int bool_nil)
-{
-    Literal *lit = calloc(1, sizeof(Literal));
-    lit->token_type = type;
-    switch (type)
-    {
-    case STRING:
-    case IDENTIFIER:
-        lit->data.string = string_number;
-        break;
-    case NUMBER:
-        lit->data.number = string_number;
-        break;
-    case NIL:
-        lit->data.null = bool_nil;
-        break;
-    case TRUE:
-    case FALSE:
-        lit->data.bool_val = bool_nil;
-        break;
-
-    default:
-        break;
-    }
-    return lit;
-}
-
-void free_literal(Literal *lit)
-{
-    switch (lit->token_type)
-    {
-    case STRING:
-        if (lit->data.string)
-        {
-            //fprintf(stderr, "Freeing string literal %s\n", lit->data.string);
-            free(lit->data.string);
-            lit->data.string = NULL;
-        }
-        break;
-    case NUMBER:
-        if (lit->data.number)
-        {
-            //fprintf(stderr, "Freeing number literal %lf\n", *lit->data.number);
-            free(lit->data.number);
-            lit->data.number = NULL;
-        }
-        break;
-
-    default:
-        if (lit->token_type == TRUE || lit->token_type == FALSE)
-        {
-            //fprintf(stderr, "Freeing bool literal %d\n", lit->data.bool_val);
-        }
-        else if(lit->token_type == NIL)
-        {
-            //fprintf(stderr, "Freeing NIL literal %d\n", lit->data.null);
-        }
-        lit->data.bool_val = -1;
-        break;
-    }
-    free(lit);
-}
-
-void free_token(Token *tok)
-{
-    if (tok == NULL)
-    {
-        return;
-    }
-    if (tok->lexeme)
-    {
-        free(tok->lexeme);
-        tok->lexeme = NULL;
-    }
-    if (tok->literal)
-    {
-        free_literal(tok->literal);
-        tok->literal = NULL;
-    }
-    free(tok);
-}
-
 void free_scanner(Scanner *scanner)
 {
-    free(scanner->source);
+    finish_scanning(scanner);
     scanner->source = NULL;
-    for (size_t i = 0; i < scanner->size_tokens; i++)
+    if (scanner->streaming)
     {
-        free_token(scanner->tokens[i]);
-        scanner->tokens[i] = NULL;
+        munmap(scanner->tokens, scanner->size_tokens * sizeof(Token));
+    }
+    else
+    {
+        free(scanner->tokens);
     }
-    free(scanner->tokens);
     scanner->tokens = NULL;
     free(scanner);
 }
 
-Token *init_token(char *lexeme, Literal *literal, int line)
-{
-    Token *token = (Token *)calloc(1, sizeof(Token));
-    token->lexeme = lexeme;
-    token->literal = literal;
-    token->line = line;
-    return token;
-}
-
 char advance(Scanner *scanner)
 {
     return scanner->source[scanner->current++];
 }
 
-void addToken(Scanner *scanner, Literal *literal)
+Token *addToken(Scanner *scanner, TokenType type)
 {
-    char *text;
-    if (literal->token_type != EOF_LOX)
-    {
-        text = calloc(scanner->current - scanner->start + 2, sizeof(char));
-        strncpy(text, scanner->source + scanner->start, scanner->current - scanner->start);
-    }
-    else
-    {
-        text = calloc(1, sizeof(char));
-    }
     if (scanner->number_tokens >= scanner->size_tokens)
     {
         scanner->size_tokens *= 2;
-        scanner->tokens = realloc(scanner->tokens, scanner->size_tokens * sizeof(Token *));
+        scanner->tokens = realloc(scanner->tokens, scanner->size_tokens * sizeof(Token));
     }
-    scanner->tokens[scanner->number_tokens++] = init_token(text, literal, scanner->line);
+    Token *token = &scanner->tokens[scanner->number_tokens++];
+    token->type = type;
+    token->line = scanner->line;
+    token->start = scanner->start;
+    token->length = type == EOF_LOX ? 0 : scanner->current - scanner->start;
+    token->symbol = NULL;
+    token->number = 0;
+    return token;
 }
 
 int match_scanner(Scanner *scanner, char expected)
 {
-    if (scanner->current >= strlen(scanner->source))
+    if (scanner->current >= scanner->length)
         return 0;
     if (scanner->source[scanner->current] != expected)
         return 0;
@@ -157,7 +112,7 @@ int match_scanner(Scanner *scanner, char expected)
 
 int isAtEnd_scanner(Scanner *scanner)
 {
-    return scanner->current >= strlen(scanner->source);
+    return scanner->current >= scanner->length;
 }
 
 char peek_scanner(Scanner *scanner)
@@ -169,38 +124,207 @@ char peek_scanner(Scanner *scanner)
     return scanner->source[scanner->current];
 }
 
-void string(Scanner *scanner)
+char peekNext(Scanner *scanner)
 {
-    while (peek_scanner(scanner) != '"' && !isAtEnd_scanner(scanner))
+    if (scanner->current + 1 >= scanner->length)
+        return '\0';
+    return scanner->source[scanner->current + 1];
+}
+
+int isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int isAlpha(char c)
+{
+    return (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') ||
+           c == '_';
+}
+
+int isAlphanumeric(char c)
+{
+    return isDigit(c) || isAlpha(c);
+}
+
+// Skips spaces, tabs, carriage returns and newlines starting at pos, counting
+// the newlines, and returns the offset of the first other byte.
+static size_t skip_whitespace(Scanner *scanner, size_t pos)
+{
+    const char *source = scanner->source;
+    size_t length = scanner->length;
+#ifdef VEC_WIDTH
+    while (pos + VEC_WIDTH <= length)
+    {
+        vec_t chunk = vec_load(source + pos);
+        vec_t newline = vec_eq(chunk, vec_set1('\n'));
+        vec_t blank = vec_or(vec_or(vec_eq(chunk, vec_set1(' ')), vec_eq(chunk, vec_set1('\t'))),
+                             vec_or(vec_eq(chunk, vec_set1('\r')), newline));
+        uint32_t newlines = vec_mask(newline);
+        uint32_t stop = ~vec_mask(blank) & VEC_ALL_MASK;
+        if (stop != 0)
+        {
+            int offset = __builtin_ctz(stop);
+            scanner->line += __builtin_popcount(newlines & ((1u << offset) - 1));
+            return pos + offset;
+        }
+        scanner->line += __builtin_popcount(newlines);
+        pos += VEC_WIDTH;
+    }
+#endif
+    while (pos < length)
     {
-        if (peek_scanner(scanner) == '\n')
+        char c = source[pos];
+        if (c == '\n')
         {
             scanner->line++;
         }
-        advance(scanner);
+        else if (c != ' ' && c != '\t' && c != '\r')
+        {
+            break;
+        }
+        pos++;
     }
-    if (isAtEnd_scanner(scanner))
+    return pos;
+}
+
+// Returns the offset of the newline ending the comment at pos, or the end of
+// the source. The newline itself is left for skip_whitespace to count.
+static size_t skip_comment(Scanner *scanner, size_t pos)
+{
+    const char *source = scanner->source;
+    size_t length = scanner->length;
+#ifdef VEC_WIDTH
+    while (pos + VEC_WIDTH <= length)
     {
-        fprintf(stderr, "[line %d] Error: Unterminated string.\n", scanner->line);
-        scanner->had_error = 1;
-        return;
+        uint32_t newlines = vec_mask(vec_eq(vec_load(source + pos), vec_set1('\n')));
+        if (newlines != 0)
+        {
+            return pos + __builtin_ctz(newlines);
+        }
+        pos += VEC_WIDTH;
     }
-    advance(scanner);
-    char *value = calloc(scanner->current - scanner->start + 2, sizeof(char));
-    strncpy(value, scanner->source + scanner->start + 1, scanner->current - scanner->start - 2);
-    addToken(scanner, init_literal(STRING, value, 0));
+#endif
+    while (pos < length && source[pos] != '\n')
+    {
+        pos++;
+    }
+    return pos;
 }
 
-int isDigit(char c)
+// Returns the offset of the first byte at or after pos that cannot continue
+// an identifier.
+static size_t skip_identifier(Scanner *scanner, size_t pos)
 {
-    return c >= '0' && c <= '9';
+    const char *source = scanner->source;
+    size_t length = scanner->length;
+#ifdef VEC_WIDTH
+    while (pos + VEC_WIDTH <= length)
+    {
+        vec_t chunk = vec_load(source + pos);
+        // Setting bit 5 folds upper case letters onto lower case ones
+        vec_t alpha = vec_in_range(vec_or(chunk, vec_set1(0x20)), 'a', 'z');
+        vec_t digit = vec_in_range(chunk, '0', '9');
+        vec_t word = vec_or(vec_or(alpha, digit), vec_eq(chunk, vec_set1('_')));
+        uint32_t stop = ~vec_mask(word) & VEC_ALL_MASK;
+        if (stop != 0)
+        {
+            return pos + __builtin_ctz(stop);
+        }
+        pos += VEC_WIDTH;
+    }
+#endif
+    while (pos < length && isAlphanumeric(source[pos]))
+    {
+        pos++;
+    }
+    return pos;
 }
 
-char peekNext(Scanner *scanner)
+// Returns the offset of the closing quote of the string whose body starts at
+// pos, or the end of the source when it is unterminated. Strings may span
+// lines, so the newlines in the body are counted.
+static size_t skip_string_body(Scanner *scanner, size_t pos)
 {
-    if (scanner->current + 1 >= strlen(scanner->source))
-        return '\0';
-    return scanner->source[scanner->current + 1];
+    const char *source = scanner->source;
+    size_t length = scanner->length;
+#ifdef VEC_WIDTH
+    while (pos + VEC_WIDTH <= length)
+    {
+        vec_t chunk = vec_load(source + pos);
+        uint32_t quotes = vec_mask(vec_eq(chunk, vec_set1('"')));
+        uint32_t newlines = vec_mask(vec_eq(chunk, vec_set1('\n')));
+        if (quotes != 0)
+        {
+            int offset = __builtin_ctz(quotes);
+            scanner->line += __builtin_popcount(newlines & ((1u << offset) - 1));
+            return pos + offset;
+        }
+        scanner->line += __builtin_popcount(newlines);
+        pos += VEC_WIDTH;
+    }
+#endif
+    while (pos < length && source[pos] != '"')
+    {
+        if (source[pos] == '\n')
+        {
+            scanner->line++;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+// Returns the offset of the next quote or slash at or after pos, counting
+// the newlines before it. Those are the only bytes that can start a string
+// or a comment, which is all the parallel scanner's pre-pass cares about.
+static size_t skip_code(Scanner *scanner, size_t pos)
+{
+    const char *source = scanner->source;
+    size_t length = scanner->length;
+#ifdef VEC_WIDTH
+    while (pos + VEC_WIDTH <= length)
+    {
+        vec_t chunk = vec_load(source + pos);
+        uint32_t stop = vec_mask(vec_or(vec_eq(chunk, vec_set1('"')), vec_eq(chunk, vec_set1('/'))));
+        uint32_t newlines = vec_mask(vec_eq(chunk, vec_set1('\n')));
+        if (stop != 0)
+        {
+            int offset = __builtin_ctz(stop);
+            scanner->line += __builtin_popcount(newlines & ((1u << offset) - 1));
+            return pos + offset;
+        }
+        scanner->line += __builtin_popcount(newlines);
+        pos += VEC_WIDTH;
+    }
+#endif
+    while (pos < length && source[pos] != '"' && source[pos] != '/')
+    {
+        if (source[pos] == '\n')
+        {
+            scanner->line++;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+void string(Scanner *scanner)
+{
+    scanner->current = skip_string_body(scanner, scanner->current);
+    if (isAtEnd_scanner(scanner))
+    {
+        fprintf(scanner->err, "[line %d] Error: Unterminated string.\n", scanner->line);
+        scanner->had_error = 1;
+        return;
+    }
+    advance(scanner);
+    Token *token = addToken(scanner, STRING);
+    if (scanner->intern)
+    {
+        token->symbol = copy_string(scanner->source + scanner->start + 1, token->length - 2);
+    }
 }
 
 void number(Scanner *scanner)
@@ -209,32 +333,40 @@ void number(Scanner *scanner)
     {
         advance(scanner);
     }
+    int is_integer = 1;
     if (peek_scanner(scanner) == '.' && isDigit(peekNext(scanner)))
     {
+        is_integer = 0;
         advance(scanner);
         while (isDigit(peek_scanner(scanner)))
         {
             advance(scanner);
         }
     }
-    char *lexeme = calloc(scanner->current - scanner->start + 2, sizeof(char));
-    strncpy(lexeme, scanner->source + scanner->start, scanner->current - scanner->start);
-    double *value = calloc(1, sizeof(double));
-    *value = strtod(lexeme, (char **)NULL);
-    free(lexeme);
-    addToken(scanner, init_literal(NUMBER, value, 0));
-}
-
-int isAlpha(char c)
-{
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           c == '_';
-}
-
-int isAlphanumeric(char c)
-{
-    return isDigit(c) || isAlpha(c);
+    size_t length = scanner->current - scanner->start;
+    const char *digits = scanner->source + scanner->start;
+    // Up to 15 digits fit exactly in a double, which covers nearly every
+    // literal without going through strtod
+    if (is_integer && length <= 15)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            value = value * 10 + (uint64_t)(digits[i] - '0');
+        }
+        addToken(scanner, NUMBER)->number = (double)value;
+        return;
+    }
+    // strtod would also accept exponents and hex, so it only gets the lexeme
+    char buffer[64];
+    char *lexeme = length < sizeof(buffer) ? buffer : malloc(length + 1);
+    memcpy(lexeme, digits, length);
+    lexeme[length] = '\0';
+    addToken(scanner, NUMBER)->number = strtod(lexeme, (char **)NULL);
+    if (lexeme != buffer)
+    {
+        free(lexeme);
+    }
 }
 
 Keyword keywords[] = {
@@ -258,138 +390,616 @@ Keyword keywords[] = {
 
 const int keywordCount = sizeof(keywords) / sizeof(Keyword);
 
-TokenType get_keyword_type(const char *text)
+static TokenType check_keyword(const char *text, size_t length, size_t start, const char *rest, TokenType type)
 {
-    for (int i = 0; i < keywordCount; i++)
+    size_t len_rest = strlen(rest);
+    if (length == start + len_rest && memcmp(text + start, rest, len_rest) == 0)
+    {
+        return type;
+    }
+    return IDENTIFIER;
+}
+
+// Trie over the keywords, unrolled into switches: at most one memcmp against
+// the only keyword left once the first one or two letters are known.
+TokenType get_keyword_type(const char *text, size_t length)
+{
+    switch (text[0])
     {
-        if (strcmp(text, keywords[i].keyword) == 0)
+    case 'a':
+        return check_keyword(text, length, 1, "nd", AND);
+    case 'c':
+        return check_keyword(text, length, 1, "lass", CLASS);
+    case 'e':
+        return check_keyword(text, length, 1, "lse", ELSE);
+    case 'f':
+        if (length > 1)
+        {
+            switch (text[1])
+            {
+            case 'a':
+                return check_keyword(text, length, 2, "lse", FALSE);
+            case 'o':
+                return check_keyword(text, length, 2, "r", FOR);
+            case 'u':
+                return check_keyword(text, length, 2, "n", FUN);
+            }
+        }
+        break;
+    case 'i':
+        return check_keyword(text, length, 1, "f", IF);
+    case 'n':
+        return check_keyword(text, length, 1, "il", NIL);
+    case 'o':
+        return check_keyword(text, length, 1, "r", OR);
+    case 'p':
+        return check_keyword(text, length, 1, "rint", PRINT);
+    case 'r':
+        return check_keyword(text, length, 1, "eturn", RETURN);
+    case 's':
+        return check_keyword(text, length, 1, "uper", SUPER);
+    case 't':
+        if (length > 1)
         {
-            return keywords[i].type;
+            switch (text[1])
+            {
+            case 'h':
+                return check_keyword(text, length, 2, "is", THIS);
+            case 'r':
+                return check_keyword(text, length, 2, "ue", TRUE);
+            }
         }
+        break;
+    case 'v':
+        return check_keyword(text, length, 1, "ar", VAR);
+    case 'w':
+        return check_keyword(text, length, 1, "hile", WHILE);
     }
     return IDENTIFIER;
 }
 
 void identifier(Scanner *scanner)
 {
-    while (isAlphanumeric(peek_scanner(scanner)))
+    scanner->current = skip_identifier(scanner, scanner->current);
+    const char *text = scanner->source + scanner->start;
+    size_t length = scanner->current - scanner->start;
+    TokenType type = get_keyword_type(text, length);
+    Token *token = addToken(scanner, type);
+    if (type == IDENTIFIER && scanner->intern)
     {
-        advance(scanner);
+        token->symbol = copy_string(text, length);
+    }
+}
+
+const char *token_type_to_lexeme(TokenType type)
+{
+    static const char *punctuation[] = {
+        [LEFT_PAREN] = "(", [RIGHT_PAREN] = ")", [LEFT_BRACE] = "{", [RIGHT_BRACE] = "}",
+        [COMMA] = ",", [DOT] = ".", [MINUS] = "-", [PLUS] = "+", [SEMICOLON] = ";",
+        [SLASH] = "/", [STAR] = "*", [BANG] = "!", [BANG_EQUAL] = "!=", [EQUAL] = "=",
+        [EQUAL_EQUAL] = "==", [LESS] = "<", [LESS_EQUAL] = "<=", [GREATER] = ">",
+        [GREATER_EQUAL] = ">=",
+    };
+    if (type <= GREATER_EQUAL)
+    {
+        return punctuation[type];
+    }
+    for (int i = 0; i < keywordCount; i++)
+    {
+        if (keywords[i].type == type)
+        {
+            return keywords[i].keyword;
+        }
+    }
+    return "";
+}
+
+// Scans the next token, skipping whitespace and comments. Returns 1 if a
+// literal EOF byte ends the source there.
+static inline int scan_one(Scanner *scanner)
+{
+    scanner->start = scanner->current;
+    char c = advance(scanner);
+    switch (c)
+    {
+    case '(':
+        addToken(scanner, LEFT_PAREN);
+        break;
+    case ')':
+        addToken(scanner, RIGHT_PAREN);
+        break;
+    case '{':
+        addToken(scanner, LEFT_BRACE);
+        break;
+    case '}':
+        addToken(scanner, RIGHT_BRACE);
+        break;
+    case ',':
+        addToken(scanner, COMMA);
+        break;
+    case '.':
+        addToken(scanner, DOT);
+        break;
+    case '-':
+        addToken(scanner, MINUS);
+        break;
+    case '+':
+        addToken(scanner, PLUS);
+        break;
+    case ';':
+        addToken(scanner, SEMICOLON);
+        break;
+    case '*':
+        addToken(scanner, STAR);
+        break;
+    case '/':
+        if (match_scanner(scanner, '/'))
+        {
+            scanner->current = skip_comment(scanner, scanner->current);
+        }
+        else
+        {
+            addToken(scanner, SLASH);
+        }
+        break;
+    case '"':
+        string(scanner);
+        break;
+    case '!':
+        addToken(scanner, match_scanner(scanner, '=') ? BANG_EQUAL : BANG);
+        break;
+    case '=':
+        addToken(scanner, match_scanner(scanner, '=') ? EQUAL_EQUAL : EQUAL);
+        break;
+    case '<':
+        addToken(scanner, match_scanner(scanner, '=') ? LESS_EQUAL : LESS);
+        break;
+    case '>':
+        addToken(scanner, match_scanner(scanner, '=') ? GREATER_EQUAL : GREATER);
+        break;
+    case '#':
+    case '$':
+    case '@':
+    case '%':
+        fprintf(scanner->err, "[line %d] Error: Unexpected character: %c\n", scanner->line, c);
+        scanner->had_error = 1;
+        break;
+    case ' ':
+    case '\r':
+    case '\t':
+    case '\n':
+        // Ignore whitespace, the whole run at once
+        scanner->current = skip_whitespace(scanner, scanner->start);
+        break;
+    case EOF:
+        return 1;
+    default:
+        if (isDigit(c))
+        {
+            number(scanner);
+        }
+        else if (isAlpha(c))
+        {
+            identifier(scanner);
+        }
+        else
+        {
+            fprintf(scanner->err, "Unexpected char: %c\n", c);
+        }
+    }
+    return 0;
+}
+
+// Scans [scanner->current, scanner->length) without adding the EOF token.
+// Returns 1 if a literal EOF byte stopped the scan early.
+static int scan_range(Scanner *scanner)
+{
+    while (scanner->current < scanner->length)
+    {
+        if (scan_one(scanner))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+Scanner *scanToken(const char *source, size_t length)
+{
+    Scanner *scanner = init_scanner(source, length);
+    scan_range(scanner);
+    addToken(scanner, EOF_LOX);
+    return scanner;
+}
+
+// Streaming scanners produce tokens on demand through fill_tokens. Their
+// token array is reserved up front for the worst case (a token per byte plus
+// EOF) and only backed by memory once written, so it never moves: tokens the
+// parser holds on to stay valid, and release_tokens hands back the pages of
+// the ones it is done with.
+Scanner *init_scanner_stream(const char *source, size_t length)
+{
+    Scanner *scanner = init_scanner(source, length);
+    free(scanner->tokens);
+    scanner->size_tokens = length + 1;
+    scanner->tokens = mmap(NULL, scanner->size_tokens * sizeof(Token), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (scanner->tokens == MAP_FAILED)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    scanner->streaming = 1;
+    return scanner;
+}
+
+// Tokens travel from the scanning thread to the parsing one through a
+// bounded single-producer/single-consumer ring. Each side only writes its own
+// counter, published with release stores, so no locks are needed.
+#define RING_SIZE 4096
+#define RING_BATCH 64 // tokens the producer scans before publishing them
+
+struct Pipeline_
+{
+    _Alignas(64) size_t head; // tokens pushed, written by the producer only
+    _Alignas(64) size_t tail; // tokens popped, written by the consumer only
+    _Alignas(64) Token slots[RING_SIZE];
+    Scanner *producer;
+    pthread_t thread;
+    char *errors; // the producer's diagnostics, printed by finish_scanning
+    size_t len_errors;
+};
+
+static void push_tokens(Pipeline *pipeline, const Token *tokens, size_t count)
+{
+    size_t head = pipeline->head;
+    for (size_t i = 0; i < count; i++)
+    {
+        while (head - __atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+        {
+            __atomic_store_n(&pipeline->head, head, __ATOMIC_RELEASE);
+            sched_yield();
+        }
+        pipeline->slots[head & (RING_SIZE - 1)] = tokens[i];
+        head++;
+    }
+    __atomic_store_n(&pipeline->head, head, __ATOMIC_RELEASE);
+}
+
+static void *produce_tokens(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *)arg;
+    Scanner *scanner = pipeline->producer;
+    for (;;)
+    {
+        int at_end = scanner->current >= scanner->length || scan_one(scanner);
+        if (at_end)
+        {
+            addToken(scanner, EOF_LOX);
+        }
+        if (at_end || scanner->number_tokens >= RING_BATCH)
+        {
+            push_tokens(pipeline, scanner->tokens, scanner->number_tokens);
+            scanner->number_tokens = 0;
+        }
+        if (at_end)
+        {
+            return NULL;
+        }
+    }
+}
+
+// Moves whatever the producer has published into the token array
+static void pull_tokens(Scanner *scanner)
+{
+    Pipeline *pipeline = scanner->pipeline;
+    size_t tail = pipeline->tail;
+    size_t head;
+    while ((head = __atomic_load_n(&pipeline->head, __ATOMIC_ACQUIRE)) == tail)
+    {
+        sched_yield();
+    }
+    for (; tail != head; tail++)
+    {
+        Token *token = &scanner->tokens[scanner->number_tokens++];
+        *token = pipeline->slots[tail & (RING_SIZE - 1)];
+        if (token->type == EOF_LOX)
+        {
+            scanner->finished = 1;
+        }
+    }
+    __atomic_store_n(&pipeline->tail, tail, __ATOMIC_RELEASE);
+}
+
+// A streaming scanner whose tokens are produced by a thread running in
+// parallel with whoever consumes them. Diagnostics and had_error are only
+// reported by finish_scanning, the way scanToken reports them all before any
+// later phase runs.
+Scanner *scanTokenPipelined(const char *source, size_t length)
+{
+    Scanner *scanner = init_scanner_stream(source, length);
+    Pipeline *pipeline = calloc(1, sizeof(Pipeline));
+    pipeline->producer = init_scanner(source, length);
+    pipeline->producer->err = open_memstream(&pipeline->errors, &pipeline->len_errors);
+    scanner->pipeline = pipeline;
+    pthread_create(&pipeline->thread, NULL, produce_tokens, pipeline);
+    return scanner;
+}
+
+// Waits for a pipelined scanner to produce every token and reports its
+// errors. Does nothing for other scanners.
+void finish_scanning(Scanner *scanner)
+{
+    Pipeline *pipeline = scanner->pipeline;
+    if (pipeline == NULL)
+    {
+        return;
     }
-    char *value = calloc(scanner->current - scanner->start + 2, sizeof(char));
-    strncpy(value, scanner->source + scanner->start, scanner->current - scanner->start);
-    TokenType type = get_keyword_type(value);
-    addToken(scanner, init_literal(type, value, 0));
-    free(value);
-    value = NULL;
+    fill_tokens(scanner, SIZE_MAX);
+    pthread_join(pipeline->thread, NULL);
+    fclose(pipeline->producer->err);
+    fwrite(pipeline->errors, 1, pipeline->len_errors, stderr);
+    scanner->had_error = pipeline->producer->had_error;
+    scanner->line = pipeline->producer->line;
+    free(pipeline->errors);
+    free_scanner(pipeline->producer);
+    free(pipeline);
+    scanner->pipeline = NULL;
 }
 
-Scanner *scanToken(char *file_contents)
+// Scans until there are at least count tokens or the EOF token was added
+void fill_tokens(Scanner *scanner, size_t count)
 {
-    Scanner *scanner = init_scanner(file_contents);
-    size_t file_len = strlen(file_contents);
-    if (file_len > 0)
+    while (scanner->number_tokens < count && !scanner->finished)
     {
-        while (scanner->current < file_len)
+        if (scanner->pipeline != NULL)
         {
-            scanner->start = scanner->current;
-            char c = advance(scanner);
-            switch (c)
+            pull_tokens(scanner);
+            continue;
+        }
+        if (scanner->current >= scanner->length || scan_one(scanner))
+        {
+            addToken(scanner, EOF_LOX);
+            scanner->finished = 1;
+        }
+    }
+}
+
+// Returns the memory of the first count tokens, which must not be read again
+void release_tokens(Scanner *scanner, size_t count)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = (count * sizeof(Token)) & ~(page - 1);
+    if (end > scanner->len_released)
+    {
+        madvise((char *)scanner->tokens + scanner->len_released, end - scanner->len_released, MADV_DONTNEED);
+        scanner->len_released = end;
+    }
+}
+
+// Inputs are only split when every chunk gets at least this much source
+#define PARALLEL_MIN_CHUNK (1024 * 1024)
+
+typedef struct
+{
+    size_t begin;
+    size_t end;
+    int line; // line number at begin
+    Scanner *scanner;
+    char *errors; // everything the chunk reported, printed in order afterwards
+    size_t len_errors;
+    int hit_eof;
+    size_t first_token; // index of its first token in the stitched array
+} ScanChunk;
+
+typedef struct
+{
+    const char *source;
+    ScanChunk *chunks;
+    size_t len_chunks;
+    size_t next_chunk; // claimed with an atomic increment
+    Token *tokens;     // stitched array
+} ScanPool;
+
+// Chunks start just past a newline outside of any string literal or comment,
+// where the scanner can start in its initial state. The pre-pass only stops
+// at quotes and slashes, counting lines in bulk to know the number each chunk
+// starts on. Returns the number of chunks.
+static size_t find_split_points(const char *source, size_t length, size_t chunk_size, ScanChunk *chunks, size_t max_chunks)
+{
+    Scanner cursor = {0};
+    cursor.source = source;
+    cursor.length = length;
+    cursor.line = 1;
+    size_t len_chunks = 0;
+    chunks[len_chunks].begin = 0;
+    chunks[len_chunks++].line = 1;
+    size_t target = chunk_size;
+    size_t pos = 0;
+    while (len_chunks < max_chunks)
+    {
+        size_t next = skip_code(&cursor, pos);
+        // [pos, next) is plain code, any newline in it past the target will do
+        while (next > target && len_chunks < max_chunks)
+        {
+            size_t from = pos > target ? pos : target;
+            const char *newline = memchr(source + from, '\n', next - from);
+            if (newline == NULL || (size_t)(newline - source) + 1 >= length)
             {
-            case '(':
-                addToken(scanner, init_literal(LEFT_PAREN, NULL, 0));
-                break;
-            case ')':
-                addToken(scanner, init_literal(RIGHT_PAREN, NULL, 0));
-                break;
-            case '{':
-                addToken(scanner, init_literal(LEFT_BRACE, NULL, 0));
-                break;
-            case '}':
-                addToken(scanner, init_literal(RIGHT_BRACE, NULL, 0));
-                break;
-            case ',':
-                addToken(scanner, init_literal(COMMA, NULL, 0));
-                break;
-            case '.':
-                addToken(scanner, init_literal(DOT, NULL, 0));
-                break;
-            case '-':
-                addToken(scanner, init_literal(MINUS, NULL, 0));
                 break;
-            case '+':
-                addToken(scanner, init_literal(PLUS, NULL, 0));
-                break;
-            case ';':
-                addToken(scanner, init_literal(SEMICOLON, NULL, 0));
-                break;
-            case '*':
-                addToken(scanner, init_literal(STAR, NULL, 0));
-                break;
-            case '/':
-                if (match_scanner(scanner, '/'))
-                {
-                    while (scanner->source[scanner->current] != '\n' && scanner->current < strlen(scanner->source))
-                    {
-                        advance(scanner);
-                    }
-                }
-                else
-                {
-                    addToken(scanner, init_literal(SLASH, NULL, 0));
-                }
-                break;
-            case '"':
-                string(scanner);
-                break;
-            case '!':
-                addToken(scanner, init_literal(match_scanner(scanner, '=') ? BANG_EQUAL : BANG, NULL, 0));
-                break;
-            case '=':
-                addToken(scanner, init_literal(match_scanner(scanner, '=') ? EQUAL_EQUAL : EQUAL, NULL, 0));
-                break;
-            case '<':
-                addToken(scanner, init_literal(match_scanner(scanner, '=') ? LESS_EQUAL : LESS, NULL, 0));
-                break;
-            case '>':
-                addToken(scanner, init_literal(match_scanner(scanner, '=') ? GREATER_EQUAL : GREATER, NULL, 0));
-                break;
-            case '#':
-            case '$':
-            case '@':
-            case '%':
-                fprintf(stderr, "[line %d] Error: Unexpected character: %c\n", scanner->line, c);
-                scanner->had_error = 1;
-                break;
-            case ' ':
-            case '\r':
-            case '\t':
-                // Ignore whitespace.
-                break;
-            case '\n':
-                scanner->line++;
-                break;
-            case EOF:
-                addToken(scanner, init_literal(EOF_LOX, NULL, 0));
-                return scanner;
-                break;
-            default:
-                if (isDigit(c))
-                {
-                    number(scanner);
-                }
-                else if (isAlpha(c))
-                {
-                    identifier(scanner);
-                }
-                else
-                {
-                    fprintf(stderr, "Unexpected char: %c\n", c);
-                }
+            }
+            size_t split = (size_t)(newline - source) + 1;
+            int line = cursor.line;
+            for (size_t i = split; i < next; i++)
+            {
+                line -= source[i] == '\n';
+            }
+            chunks[len_chunks].begin = split;
+            chunks[len_chunks++].line = line;
+            target = split + chunk_size;
+        }
+        if (next >= length)
+        {
+            break;
+        }
+        if (source[next] == '"')
+        {
+            pos = skip_string_body(&cursor, next + 1) + 1;
+        }
+        else if (next + 1 < length && source[next + 1] == '/')
+        {
+            pos = skip_comment(&cursor, next + 2);
+        }
+        else
+        {
+            pos = next + 1;
+        }
+    }
+    for (size_t i = 0; i < len_chunks; i++)
+    {
+        chunks[i].end = i + 1 < len_chunks ? chunks[i + 1].begin : length;
+    }
+    return len_chunks;
+}
+
+static void *scan_worker(void *arg)
+{
+    ScanPool *pool = (ScanPool *)arg;
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED);
+        if (i >= pool->len_chunks)
+        {
+            return NULL;
+        }
+        ScanChunk *chunk = &pool->chunks[i];
+        Scanner *scanner = init_scanner(pool->source, chunk->end);
+        scanner->start = scanner->current = chunk->begin;
+        scanner->line = chunk->line;
+        // The intern table is not thread safe, symbols are filled in once
+        // the chunks are stitched back together
+        scanner->intern = 0;
+        scanner->err = open_memstream(&chunk->errors, &chunk->len_errors);
+        chunk->hit_eof = scan_range(scanner);
+        fclose(scanner->err);
+        scanner->err = stderr;
+        chunk->scanner = scanner;
+    }
+}
+
+// Copying the tokens into place touches as much memory as scanning produced,
+// so it is spread over the threads as well
+static void *stitch_worker(void *arg)
+{
+    ScanPool *pool = (ScanPool *)arg;
+    for (;;)
+    {
+        size_t i = __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED);
+        if (i >= pool->len_chunks)
+        {
+            return NULL;
+        }
+        ScanChunk *chunk = &pool->chunks[i];
+        memcpy(pool->tokens + chunk->first_token, chunk->scanner->tokens, chunk->scanner->number_tokens * sizeof(Token));
+    }
+}
+
+// Runs worker on len_threads threads, the calling one included
+static void run_pool(ScanPool *pool, void *(*worker)(void *), size_t len_threads)
+{
+    pthread_t *threads = calloc(len_threads, sizeof(pthread_t));
+    pool->next_chunk = 0;
+    for (size_t i = 1; i < len_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, worker, pool);
+    }
+    worker(pool);
+    for (size_t i = 1; i < len_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+// Same tokens, lines and error output as scanToken, with the source split into
+// chunks scanned by `jobs` threads (0 means one per online CPU). Symbols are
+// only interned when `intern` is set, tokenizing alone does not need them.
+Scanner *scanTokenParallel(const char *source, size_t length, int jobs, int intern)
+{
+    if (jobs <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+    if (jobs == 1 || length < 2 * PARALLEL_MIN_CHUNK)
+    {
+        Scanner *scanner = init_scanner(source, length);
+        scanner->intern = intern;
+        scan_range(scanner);
+        addToken(scanner, EOF_LOX);
+        return scanner;
+    }
+
+    // A few chunks per thread so an unlucky split does not leave threads idle
+    size_t max_chunks = (size_t)jobs * 4;
+    size_t chunk_size = length / max_chunks;
+    if (chunk_size < PARALLEL_MIN_CHUNK)
+    {
+        chunk_size = PARALLEL_MIN_CHUNK;
+    }
+    ScanPool pool = {source, calloc(max_chunks, sizeof(ScanChunk)), 0, 0, NULL};
+    size_t len_chunks = find_split_points(source, length, chunk_size, pool.chunks, max_chunks);
+    pool.len_chunks = len_chunks;
+    size_t len_threads = (size_t)jobs < len_chunks ? (size_t)jobs : len_chunks;
+    run_pool(&pool, scan_worker, len_threads);
+
+    // Stitch the chunks back together. Everything after a chunk that hit a
+    // literal EOF byte is dropped, as the serial scanner would never get there.
+    Scanner *scanner = init_scanner(source, length);
+    scanner->intern = intern;
+    for (size_t i = 0; i < pool.len_chunks; i++)
+    {
+        ScanChunk *chunk = &pool.chunks[i];
+        chunk->first_token = scanner->number_tokens;
+        scanner->number_tokens += chunk->scanner->number_tokens;
+        scanner->had_error |= chunk->scanner->had_error;
+        scanner->line = chunk->scanner->line;
+        scanner->start = chunk->scanner->start;
+        scanner->current = chunk->scanner->current;
+        fwrite(chunk->errors, 1, chunk->len_errors, stderr);
+        if (chunk->hit_eof)
+        {
+            pool.len_chunks = i + 1;
+            break;
+        }
+    }
+    free(scanner->tokens);
+    scanner->size_tokens = scanner->number_tokens + 1;
+    pool.tokens = scanner->tokens = malloc(scanner->size_tokens * sizeof(Token));
+    run_pool(&pool, stitch_worker, len_threads);
+    for (size_t i = 0; i < len_chunks; i++)
+    {
+        free(pool.chunks[i].errors);
+        free_scanner(pool.chunks[i].scanner);
+    }
+    free(pool.chunks);
+
+    if (intern)
+    {
+        for (size_t i = 0; i < scanner->number_tokens; i++)
+        {
+            Token *token = &scanner->tokens[i];
+            if (token->type == IDENTIFIER)
+            {
+                token->symbol = copy_string(source + token->start, token->length);
+            }
+            else if (token->type == STRING)
+            {
+                token->symbol = copy_string(source + token->start + 1, token->length - 2);
             }
         }
     }
-    addToken(scanner, init_literal(EOF_LOX, NULL, 0));
+    addToken(scanner, EOF_LOX);
     return scanner;
 }
 
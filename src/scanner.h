@@ -1,10 +1,13 @@
 #ifndef __SCANNER__
 #define __SCANNER__
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "value.h"
+
 typedef enum 
 {
     LEFT_PAREN,
@@ -54,42 +57,52 @@ typedef struct
     TokenType type;
 } Keyword;
 
-typedef struct
-{
-    TokenType token_type;
-    union
-    {
-        int bool_val;
-        int null;
-        char *string;
-        double *number;
-    } data;
-} Literal;
-
+// Tokens are plain values stored back to back in one array. The lexeme is
+// the slice [start, start + length) of the scanned source, it is not NUL
+// terminated.
 typedef struct Token_
 {
-    char *lexeme;
-    Literal *literal;
+    TokenType type;
     int line;
+    uint32_t start;
+    uint32_t length;
+    union
+    {
+        double number;     // value of NUMBER tokens
+        ObjString *symbol; // interned name of IDENTIFIER tokens, contents of STRING tokens
+    };
 } Token;
 
+typedef struct Pipeline_ Pipeline;
+
 typedef struct Scanner_
 {
-    char *source;
-    Token **tokens; // array of Token*
+    const char *source; // not owned, and not necessarily NUL terminated
+    size_t length;
+    Token *tokens;
     size_t number_tokens;
     size_t size_tokens;
-    int start;
-    int current;
+    size_t start;
+    size_t current;
     int line;
     int had_error;
+    FILE *err;  // where errors are reported, stderr unless buffered by a worker
+    int intern; // whether IDENTIFIER and STRING tokens get their symbol
+    int streaming;
+    int finished;        // streaming: the EOF token has been added
+    size_t len_released; // streaming: bytes at the start of tokens given back
+    Pipeline *pipeline;  // set while a producer thread is scanning
 } Scanner;
 
-Scanner *scanToken(char *file_contents);
+Scanner *scanToken(const char *source, size_t length);
+Scanner *scanTokenParallel(const char *source, size_t length, int jobs, int intern);
+Scanner *init_scanner_stream(const char *source, size_t length);
+void fill_tokens(Scanner *scanner, size_t count);
+void release_tokens(Scanner *scanner, size_t count);
+Scanner *scanTokenPipelined(const char *source, size_t length);
+void finish_scanning(Scanner *scanner);
 char *token_type_to_str(TokenType type);
+const char *token_type_to_lexeme(TokenType type);
 void free_scanner(Scanner *scanner);
-void free_token(Token *tok);
-Literal *init_literal(TokenType type, void *string_number, int bool_nil);
-void free_literal(Literal *lit);
 
 #endif // __SCANNER__
\ No newline at end of file
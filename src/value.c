@@ -0,0 +1,421 @@
+#include <math.h>
+
+#include "value.h"
+#include "gc.h"
+
+// Open addressing set of every live string, sized to a power of two. The
+// strings a collection frees leave a tombstone behind, so that the probe
+// sequences going past them stay intact until the next rehash.
+static ObjString **strings = NULL;
+static size_t len_strings = 0;
+static size_t len_tombstones = 0;
+static size_t size_strings = 0;
+
+static ObjString tombstone;
+#define TOMBSTONE (&tombstone)
+
+// FNV-1a, which can be carried on from the hash of a prefix
+static uint32_t continue_hash(uint32_t hash, const char *chars, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+uint32_t hash_string(const char *chars, size_t length)
+{
+    return continue_hash(2166136261u, chars, length);
+}
+
+// Looks up the string made of a followed by b, so that a concatenation is only
+// copied when it is new. Returns its bucket, or the one it would go in.
+static ObjString **find_string(const char *a, size_t len_a, const char *b, size_t len_b, uint32_t hash)
+{
+    size_t mask = size_strings - 1;
+    size_t bucket = hash & mask;
+    ObjString **reusable = NULL;
+    while (strings[bucket] != NULL)
+    {
+        ObjString *string = strings[bucket];
+        if (string == TOMBSTONE)
+        {
+            if (reusable == NULL)
+            {
+                reusable = &strings[bucket];
+            }
+        }
+        else if (string->hash == hash && string->length == len_a + len_b && memcmp(string->chars, a, len_a) == 0 &&
+                 memcmp(string->chars + len_a, b, len_b) == 0)
+        {
+            return &strings[bucket];
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return reusable != NULL ? reusable : &strings[bucket];
+}
+
+static ObjString *found(ObjString **bucket)
+{
+    return *bucket == TOMBSTONE ? NULL : *bucket;
+}
+
+// Drops the tombstones, and doubles the table unless most of it was them
+static void rehash_strings()
+{
+    ObjString **old = strings;
+    size_t old_size = size_strings;
+    if (size_strings == 0)
+    {
+        size_strings = 256;
+    }
+    else if ((len_strings + 1) * 2 > size_strings)
+    {
+        size_strings *= 2;
+    }
+    strings = calloc(size_strings, sizeof(ObjString *));
+    for (size_t i = 0; i < old_size; i++)
+    {
+        if (old[i] != NULL && old[i] != TOMBSTONE)
+        {
+            *find_string(old[i]->chars, old[i]->length, "", 0, old[i]->hash) = old[i];
+        }
+    }
+    len_tombstones = 0;
+    free(old);
+}
+
+// Adds a string find_string did not find, bucket is where it looked
+static void intern_string(ObjString *string, ObjString **bucket)
+{
+    if ((len_strings + len_tombstones + 1) * 4 > size_strings * 3)
+    {
+        rehash_strings();
+        bucket = find_string(string->chars, string->length, "", 0, string->hash);
+    }
+    if (*bucket == TOMBSTONE)
+    {
+        len_tombstones--;
+    }
+    *bucket = string;
+    len_strings++;
+}
+
+void replace_interned_string(ObjString *string, ObjString *replacement)
+{
+    size_t mask = size_strings - 1;
+    for (size_t bucket = string->hash & mask; strings[bucket] != NULL; bucket = (bucket + 1) & mask)
+    {
+        if (strings[bucket] == string)
+        {
+            if (replacement == NULL)
+            {
+                strings[bucket] = TOMBSTONE;
+                len_strings--;
+                len_tombstones++;
+            }
+            else
+            {
+                strings[bucket] = replacement;
+            }
+            return;
+        }
+    }
+}
+
+// Strings made here come from the scanner and parser, so they stay until exit
+ObjString *copy_string(const char *chars, size_t length)
+{
+    uint32_t hash = hash_string(chars, length);
+    ObjString **bucket = NULL;
+    if (strings != NULL)
+    {
+        bucket = find_string(chars, length, "", 0, hash);
+        ObjString *interned = found(bucket);
+        if (interned != NULL)
+        {
+            return interned->obj.space == SPACE_PERMANENT ? interned : make_permanent(interned);
+        }
+    }
+    ObjString *string = allocate_string_object(length, SPACE_PERMANENT);
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
+    string->hash = hash;
+    intern_string(string, bucket);
+    return string;
+}
+
+// Takes ownership of chars, which are freed once copied
+ObjString *take_string(char *chars, size_t length)
+{
+    ObjString *string = copy_string(chars, length);
+    free(chars);
+    return string;
+}
+
+// The interned string made of a followed by b, young if it is new
+static ObjString *intern_concatenation(const char *a, size_t len_a, const char *b, size_t len_b, uint32_t hash)
+{
+    ObjString **bucket = find_string(a, len_a, b, len_b, hash);
+    ObjString *interned = found(bucket);
+    if (interned != NULL)
+    {
+        return interned;
+    }
+    ObjString *string = allocate_string_object(len_a + len_b, SPACE_NURSERY);
+    memcpy(string->chars, a, len_a);
+    memcpy(string->chars + len_a, b, len_b);
+    string->chars[len_a + len_b] = '\0';
+    string->hash = hash;
+    intern_string(string, bucket);
+    return string;
+}
+
+// A rope may outlive the scratch arena its halves came from
+static ObjString *keep_string(ObjString *string)
+{
+    if (string->obj.space != SPACE_SCRATCH)
+    {
+        return string;
+    }
+    return intern_concatenation(string->chars, string->length, "", 0, string->hash);
+}
+
+static int fits_short(const char *a, size_t len_a, const char *b, size_t len_b)
+{
+    return len_a + len_b <= SHORT_STRING_MAX && memchr(a, '\0', len_a) == NULL && memchr(b, '\0', len_b) == NULL;
+}
+
+static Value short_string(const char *a, size_t len_a, const char *b, size_t len_b)
+{
+    Value value = QNAN | SHORT_STRING_BIT;
+    for (size_t i = 0; i < len_a; i++)
+    {
+        value |= (uint64_t)(uint8_t)a[i] << (8 * i);
+    }
+    for (size_t i = 0; i < len_b; i++)
+    {
+        value |= (uint64_t)(uint8_t)b[i] << (8 * (len_a + i));
+    }
+    return value;
+}
+
+#define SHORT_STRING_CHARS ((uint64_t)0x0000ffffffffffff)
+
+// The chars have no zero byte, so the length is up to the highest non-zero one
+static inline size_t short_string_length(Value value)
+{
+    uint64_t chars = value & SHORT_STRING_CHARS;
+    return chars == 0 ? 0 : (size_t)(64 - __builtin_clzll(chars) + 7) / 8;
+}
+
+// Marked as scratch, so that a rope copies it before keeping it
+ObjString *as_string(Value value, ShortString *buffer)
+{
+    if (!IS_SHORT_STRING(value))
+    {
+        return AS_STRING(value);
+    }
+    size_t length = short_string_length(value);
+    for (size_t i = 0; i < length; i++)
+    {
+        buffer->chars[i] = (char)(value >> (8 * i));
+    }
+    buffer->chars[length] = '\0';
+    ObjString *string = &buffer->string;
+    string->obj.type = OBJ_STRING;
+    string->obj.space = SPACE_SCRATCH;
+    string->obj.next = NULL;
+    string->length = length;
+    string->hash = hash_string(buffer->chars, length);
+    string->chars = buffer->chars;
+    string->left = string->right = NULL;
+    return string;
+}
+
+Value string_value(ObjString *string)
+{
+    if (fits_short(string->chars, string->length, "", 0))
+    {
+        return short_string(string->chars, string->length, "", 0);
+    }
+    return OBJ_VAL(string);
+}
+
+Value concatenate_strings(Value a, Value b)
+{
+    if (IS_SHORT_STRING(a) && IS_SHORT_STRING(b))
+    {
+        size_t len_a = short_string_length(a);
+        if (len_a + short_string_length(b) <= SHORT_STRING_MAX)
+        {
+            return a | (b & SHORT_STRING_CHARS) << (8 * len_a);
+        }
+    }
+    ShortString short_a;
+    ShortString short_b;
+    ObjString *x = as_string(a, &short_a);
+    ObjString *y = as_string(b, &short_b);
+    if (x->length + y->length >= ROPE_MIN_LENGTH)
+    {
+        return OBJ_VAL(allocate_rope_object(keep_string(x), keep_string(y)));
+    }
+    // Both halves are shorter than any rope, so flat
+    if (fits_short(x->chars, x->length, y->chars, y->length))
+    {
+        return short_string(x->chars, x->length, y->chars, y->length);
+    }
+    uint32_t hash = continue_hash(x->hash, y->chars, y->length);
+    return OBJ_VAL(intern_concatenation(x->chars, x->length, y->chars, y->length, hash));
+}
+
+Value concatenate_scratch(Arena *arena, Value a, Value b)
+{
+    ShortString short_a;
+    ShortString short_b;
+    ObjString *x = as_string(a, &short_a);
+    ObjString *y = as_string(b, &short_b);
+    size_t length = x->length + y->length;
+    if (length >= ROPE_MIN_LENGTH || fits_short(x->chars, x->length, y->chars, y->length))
+    {
+        return concatenate_strings(a, b);
+    }
+    ObjString *string = arena_alloc(arena, sizeof(ObjString) + length + 1);
+    string->obj.type = OBJ_STRING;
+    string->obj.space = SPACE_SCRATCH;
+    string->length = length;
+    string->hash = continue_hash(x->hash, y->chars, y->length);
+    string->chars = (char *)(string + 1);
+    memcpy(string->chars, x->chars, x->length);
+    memcpy(string->chars + x->length, y->chars, y->length);
+    string->chars[length] = '\0';
+    return OBJ_VAL(string);
+}
+
+ObjString *flatten_string(ObjString *string)
+{
+    if (string->chars != NULL)
+    {
+        return string;
+    }
+    if (string->right == NULL)
+    {
+        return string->left;
+    }
+
+    // Filled in from the end: a rope built by appending leans left, and then
+    // the stack of parts still to copy stays at two
+    ObjString *flat = allocate_string_object(string->length, SPACE_NURSERY);
+    size_t size_parts = 16;
+    size_t len_parts = 0;
+    ObjString **parts = malloc(size_parts * sizeof(ObjString *));
+    parts[len_parts++] = string;
+    size_t end = string->length;
+    while (len_parts > 0)
+    {
+        ObjString *part = parts[--len_parts];
+        if (part->chars == NULL && part->right == NULL)
+        {
+            part = part->left;
+        }
+        if (part->chars != NULL)
+        {
+            end -= part->length;
+            memcpy(flat->chars + end, part->chars, part->length);
+            continue;
+        }
+        if (len_parts + 2 > size_parts)
+        {
+            size_parts *= 2;
+            parts = realloc(parts, size_parts * sizeof(ObjString *));
+        }
+        parts[len_parts++] = part->left;
+        parts[len_parts++] = part->right;
+    }
+    free(parts);
+    flat->chars[string->length] = '\0';
+    flat->hash = hash_string(flat->chars, string->length);
+
+    // When the contents already exist, the copy is left for the collector
+    ObjString **bucket = find_string(flat->chars, flat->length, "", 0, flat->hash);
+    ObjString *interned = found(bucket);
+    if (interned == NULL)
+    {
+        intern_string(flat, bucket);
+        interned = flat;
+    }
+    string->left = interned;
+    string->right = NULL;
+    write_barrier(string, interned);
+    return interned;
+}
+
+int values_equal(Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        // Compared as doubles so NaN != NaN
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    // Flat strings are interned, so equal ones are the same object
+    if (a == b)
+    {
+        return 1;
+    }
+    // Short strings are equal only as values, all other strings are objects
+    if (!IS_OBJ(a) || !IS_OBJ(b))
+    {
+        return 0;
+    }
+    ObjString *x = AS_STRING(a);
+    ObjString *y = AS_STRING(b);
+    if (x->length != y->length || (x->chars != NULL && y->chars != NULL))
+    {
+        return 0;
+    }
+    return flatten_string(x) == flatten_string(y);
+}
+
+// Whole numbers are printed without a fractional part
+void print_value(Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        double number = AS_NUMBER(value);
+        if (floor(number) == number)
+        {
+            printf("%.0lf\n", number);
+        }
+        else
+        {
+            printf("%.15g\n", number);
+        }
+    }
+    else if (IS_BOOL(value))
+    {
+        printf(AS_BOOL(value) ? "true\n" : "false\n");
+    }
+    else if (IS_NIL(value))
+    {
+        printf("nil\n");
+    }
+    else if (IS_STRING(value))
+    {
+        ShortString buffer;
+        printf("%s\n", flatten_string(as_string(value, &buffer))->chars);
+    }
+    else
+    {
+        fprintf(stderr, "print_value for undefined value\n");
+    }
+}
+
+void free_objects()
+{
+    free_heap();
+    free(strings);
+    strings = NULL;
+    len_strings = len_tombstones = size_strings = 0;
+}
@@ -0,0 +1,144 @@
+#ifndef __VALUE__
+#define __VALUE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+typedef struct Obj_ Obj;
+typedef struct ObjString_ ObjString;
+
+// Values are NaN-boxed into 64 bits. A double is stored as is; everything
+// else lives in the payload of a quiet NaN that real arithmetic never
+// produces. Objects set the sign bit and keep their pointer in the low 48
+// bits, singletons (nil, true, false) use a small tag in the low bits.
+// Strings of up to SHORT_STRING_MAX bytes are stored in the value itself:
+// SHORT_STRING_BIT is set and the low 48 bits hold the chars, padded with
+// zeros. Every string that fits is stored that way, so equal short strings
+// are equal values.
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4 // global slot that was never defined, not visible to scripts
+
+#define SHORT_STRING_BIT ((uint64_t)0x0002000000000000)
+#define SHORT_STRING_MAX 6 // a string with a NUL byte never fits, the padding gives its length
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(num) number_to_value(num)
+#define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_SHORT_STRING(value) (((value) & (SIGN_BIT | QNAN | SHORT_STRING_BIT)) == (QNAN | SHORT_STRING_BIT))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJ(value) ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+static inline double value_to_number(Value value)
+{
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
+static inline Value number_to_value(double number)
+{
+    Value value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+typedef enum
+{
+    OBJ_STRING,
+} ObjType;
+
+struct Obj_
+{
+    ObjType type;
+    uint8_t space; // an ObjSpace, see gc.h
+    uint8_t marked;
+    uint8_t remembered; // by the write barrier
+    // Next object of the same space, so they can be swept and freed at exit.
+    // In the nursery: where the object was copied to by a collection.
+    struct Obj_ *next;
+};
+
+// Every flat string is interned: equal contents always share one ObjString,
+// so strings compare by pointer and the hash is computed only once. The
+// chars follow the header in the same allocation.
+//
+// Long concatenations are ropes instead, which only point at their two
+// halves, so that building a string piece by piece does not copy it every
+// time. A rope has no chars and is not interned. The first time its contents
+// are needed it is flattened into an interned string, which it then points
+// at instead of its halves.
+struct ObjString_
+{
+    Obj obj;
+    size_t length;
+    uint32_t hash; // ropes: 0
+    char *chars;   // ropes: NULL
+    ObjString *left;
+    ObjString *right; // NULL once the rope is flattened into left
+};
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+#define IS_STRING(value) (IS_SHORT_STRING(value) || (IS_OBJ(value) && OBJ_TYPE(value) == OBJ_STRING))
+#define AS_STRING(value) ((ObjString *)AS_OBJ(value)) // not for short strings, see as_string
+
+// nil and false are falsey, everything else is truthy
+static inline int is_truthy(Value value)
+{
+    return !IS_NIL(value) && value != FALSE_VAL;
+}
+
+uint32_t hash_string(const char *chars, size_t length);
+ObjString *copy_string(const char *chars, size_t length);
+ObjString *take_string(char *chars, size_t length);
+// Concatenations this long or longer are ropes
+#define ROPE_MIN_LENGTH 128
+
+// A short string spelled out as a flat ObjString, for the code that works on
+// those. It lives as long as the buffer.
+typedef struct
+{
+    ObjString string;
+    char chars[SHORT_STRING_MAX + 1];
+} ShortString;
+
+ObjString *as_string(Value value, ShortString *buffer);
+// The value of a parsed string literal, short when it fits
+Value string_value(ObjString *string);
+Value concatenate_strings(Value a, Value b);
+// The interned string with a rope's contents, or the string itself if flat
+ObjString *flatten_string(ObjString *string);
+// For a concatenation only another concatenation will see: the result is
+// neither interned nor collected, so it must not be stored, compared or
+// printed, and is gone once the arena is reset
+Value concatenate_scratch(Arena *arena, Value a, Value b);
+// For the garbage collector: points the intern table at replacement instead
+// of string, or forgets string when replacement is NULL
+void replace_interned_string(ObjString *string, ObjString *replacement);
+int values_equal(Value a, Value b);
+void print_value(Value value);
+void free_objects();
+
+#endif //__VALUE__
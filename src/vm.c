@@ -0,0 +1,308 @@
+#include "vm.h"
+#include "compiler.h"
+#include "gc.h"
+
+static void runtime_error(const char *message)
+{
+    fprintf(stderr, "%s\n", message);
+}
+
+static void undefined_variable(VM *vm, uint16_t slot)
+{
+    fprintf(stderr, "Undefined variable '%s'.\n", vm->chunk->global_names[slot]->chars);
+}
+
+// Every value is on the stack or in a global between statements, at the pop
+// ending an expression statement, and at loop back edges
+static void safepoint(VM *vm)
+{
+    if (gc_requested)
+    {
+        GcRoots roots = {NULL, vm->stack, vm->stack_top - vm->stack, vm->globals, vm->len_globals};
+        collect_garbage(&roots);
+    }
+}
+
+static int run(VM *vm)
+{
+#define READ_BYTE() (*vm->ip++)
+#define READ_SHORT() (vm->ip += 2, (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]))
+#define PUSH(value) (*vm->stack_top++ = (value))
+#define POP() (*--vm->stack_top)
+#define PEEK(distance) (vm->stack_top[-1 - (distance)])
+#define NUMBER_OPERANDS()                                  \
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))        \
+    {                                                      \
+        runtime_error("Operands must be numbers.");        \
+        return 70;                                         \
+    }                                                      \
+    double b = AS_NUMBER(POP());                           \
+    double a = AS_NUMBER(POP());
+
+    for (;;)
+    {
+        uint8_t instruction = READ_BYTE();
+        switch (instruction)
+        {
+        case OP_CONSTANT:
+            PUSH(vm->chunk->constants[READ_SHORT()]);
+            break;
+        case OP_NIL:
+            PUSH(NIL_VAL);
+            break;
+        case OP_TRUE:
+            PUSH(BOOL_VAL(1));
+            break;
+        case OP_FALSE:
+            PUSH(BOOL_VAL(0));
+            break;
+        case OP_POP:
+            vm->stack_top--;
+            safepoint(vm);
+            break;
+        case OP_POPN:
+            vm->stack_top -= READ_BYTE();
+            break;
+        case OP_GET_LOCAL:
+            PUSH(vm->stack[READ_BYTE()]);
+            break;
+        case OP_SET_LOCAL:
+            vm->stack[READ_BYTE()] = PEEK(0);
+            break;
+        case OP_GET_GLOBAL:
+        {
+            uint16_t slot = READ_SHORT();
+            Value value = vm->globals[slot];
+            if (IS_UNDEFINED(value))
+            {
+                undefined_variable(vm, slot);
+                return 70;
+            }
+            PUSH(value);
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+            vm->globals[READ_SHORT()] = POP();
+            break;
+        case OP_SET_GLOBAL:
+        {
+            uint16_t slot = READ_SHORT();
+            if (IS_UNDEFINED(vm->globals[slot]))
+            {
+                undefined_variable(vm, slot);
+                return 70;
+            }
+            vm->globals[slot] = PEEK(0);
+            break;
+        }
+        case OP_EQUAL:
+        {
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(values_equal(a, b)));
+            break;
+        }
+        case OP_NOT_EQUAL:
+        {
+            Value b = POP();
+            Value a = POP();
+            PUSH(BOOL_VAL(!values_equal(a, b)));
+            break;
+        }
+        case OP_GREATER:
+        {
+            NUMBER_OPERANDS();
+            PUSH(BOOL_VAL(a > b));
+            break;
+        }
+        case OP_GREATER_EQUAL:
+        {
+            NUMBER_OPERANDS();
+            PUSH(BOOL_VAL(a >= b));
+            break;
+        }
+        case OP_LESS:
+        {
+            NUMBER_OPERANDS();
+            PUSH(BOOL_VAL(a < b));
+            break;
+        }
+        case OP_LESS_EQUAL:
+        {
+            NUMBER_OPERANDS();
+            PUSH(BOOL_VAL(a <= b));
+            break;
+        }
+        case OP_ADD:
+        {
+            if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+            {
+                double b = AS_NUMBER(POP());
+                double a = AS_NUMBER(POP());
+                PUSH(NUMBER_VAL(a + b));
+            }
+            else if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
+            {
+                Value b = POP();
+                Value a = POP();
+                PUSH(concatenate_strings(a, b));
+            }
+            else
+            {
+                runtime_error("Operands must be two numbers or two strings.");
+                return 70;
+            }
+            break;
+        }
+        case OP_SUBTRACT:
+        {
+            NUMBER_OPERANDS();
+            PUSH(NUMBER_VAL(a - b));
+            break;
+        }
+        case OP_MULTIPLY:
+        {
+            NUMBER_OPERANDS();
+            PUSH(NUMBER_VAL(a * b));
+            break;
+        }
+        case OP_DIVIDE:
+        {
+            NUMBER_OPERANDS();
+            PUSH(NUMBER_VAL(a / b));
+            break;
+        }
+        case OP_NOT:
+            PEEK(0) = BOOL_VAL(!is_truthy(PEEK(0)));
+            break;
+        case OP_NEGATE:
+            if (!IS_NUMBER(PEEK(0)))
+            {
+                runtime_error("Operand must be a number.");
+                return 70;
+            }
+            PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+            break;
+        case OP_PRINT:
+            print_value(POP());
+            break;
+        case OP_JUMP:
+        {
+            uint16_t offset = READ_SHORT();
+            vm->ip += offset;
+            break;
+        }
+        case OP_JUMP_IF_FALSE:
+        {
+            uint16_t offset = READ_SHORT();
+            if (!is_truthy(PEEK(0)))
+            {
+                vm->ip += offset;
+            }
+            break;
+        }
+        case OP_JUMP_IF_DEFINED:
+        {
+            uint16_t offset = READ_SHORT();
+            if (!IS_UNDEFINED(PEEK(0)))
+            {
+                vm->ip += offset;
+            }
+            break;
+        }
+        case OP_POP_JUMP_IF_FALSE:
+        {
+            uint16_t offset = READ_SHORT();
+            if (!is_truthy(POP()))
+            {
+                vm->ip += offset;
+            }
+            break;
+        }
+        case OP_LOOP:
+        {
+            uint16_t offset = READ_SHORT();
+            vm->ip -= offset;
+            safepoint(vm);
+            break;
+        }
+        case OP_RETURN:
+            return 0;
+        default:
+            fprintf(stderr, "Unknown opcode %d\n", instruction);
+            return 70;
+        }
+    }
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef NUMBER_OPERANDS
+}
+
+VM *init_vm()
+{
+    return calloc(1, sizeof(VM));
+}
+
+void free_vm(VM *vm)
+{
+    free(vm->stack);
+    vm->stack = NULL;
+    free(vm->globals);
+    vm->globals = NULL;
+    free(vm);
+}
+
+// Runs a chunk on a VM that may already have run earlier chunks of the same
+// compiler, the globals they defined are kept
+void run_chunk(VM *vm, Chunk *chunk, int *error_code)
+{
+    if (chunk->max_stack + 1 > vm->size_stack)
+    {
+        vm->size_stack = chunk->max_stack + 1;
+        free(vm->stack);
+        vm->stack = calloc(vm->size_stack, sizeof(Value));
+    }
+    if (chunk->len_globals > vm->len_globals)
+    {
+        vm->globals = realloc(vm->globals, chunk->len_globals * sizeof(Value));
+        for (size_t i = vm->len_globals; i < chunk->len_globals; i++)
+        {
+            vm->globals[i] = UNDEFINED_VAL;
+        }
+        vm->len_globals = chunk->len_globals;
+    }
+    vm->chunk = chunk;
+    vm->ip = chunk->code;
+    vm->stack_top = vm->stack;
+    // Streamed declarations are run after scanning them, which may have made
+    // a nursery string permanent (see make_permanent)
+    safepoint(vm);
+
+    *error_code = run(vm);
+}
+
+void run_vm(Chunk *chunk, int *error_code)
+{
+    VM *vm = init_vm();
+    run_chunk(vm, chunk, error_code);
+    free_vm(vm);
+}
+
+void interpret_vm(Statement **statements, size_t len_statements, int debug, int *error_code)
+{
+    Chunk *chunk = compile(statements, len_statements, error_code);
+    if (chunk == NULL)
+    {
+        return;
+    }
+    if (debug)
+    {
+        disassemble_chunk(chunk, "script");
+    }
+    run_vm(chunk, error_code);
+    free_chunk(chunk);
+}
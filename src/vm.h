@@ -0,0 +1,24 @@
+#ifndef __VM__
+#define __VM__
+
+#include "parser.h"
+#include "chunk.h"
+
+typedef struct
+{
+    Chunk *chunk;
+    uint8_t *ip;
+    Value *stack; // sized from chunk->max_stack, so pushes are never checked
+    Value *stack_top;
+    size_t size_stack;
+    Value *globals; // indexed by the slots the compiler assigned to each name
+    size_t len_globals;
+} VM;
+
+VM *init_vm();
+void free_vm(VM *vm);
+void run_chunk(VM *vm, Chunk *chunk, int *error_code);
+void run_vm(Chunk *chunk, int *error_code);
+void interpret_vm(Statement **statements, size_t len_statements, int debug, int *error_code);
+
+#endif //__VM__
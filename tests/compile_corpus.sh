@@ -0,0 +1,32 @@
+#!/bin/sh
+# Compiles every script in bench/corpus (or the given ones) to C, builds and
+# runs the result and diffs its output and exit code against `./clox run`.
+# Run it from the repository root after building clox.
+CC=${CC:-gcc}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+if [ $# -eq 0 ]; then
+    set -- bench/corpus/*.lox
+fi
+for script in "$@"; do
+    name=$(basename "$script" .lox)
+    if ! ./clox compile "$script" -o "$work/$name.c" ||
+       ! $CC -O2 -Wall -Wextra -Werror "$work/$name.c" -o "$work/$name" -lm; then
+        echo "FAIL $script: does not compile"
+        failed=1
+        continue
+    fi
+    ./clox run --no-cache "$script" > "$work/$name.expected" 2>&1
+    echo "exit $?" >> "$work/$name.expected"
+    "$work/$name" > "$work/$name.actual" 2>&1
+    echo "exit $?" >> "$work/$name.actual"
+    if diff "$work/$name.expected" "$work/$name.actual" > "$work/$name.diff"; then
+        echo "ok   $script"
+    else
+        echo "FAIL $script"
+        cat "$work/$name.diff"
+        failed=1
+    fi
+done
+exit $failed